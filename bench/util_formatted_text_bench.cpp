@@ -0,0 +1,715 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Usage: util_formatted_text_bench [filter...]
+// Progress is printed to stderr, the results are written to stdout as JSON, e.g.:
+// util_formatted_text_bench > results.json
+// If filters are specified, only benchmarks whose names contain one of them are run.
+
+#include "util_formatted_text.hpp"
+#include "util_formatted_text_anchor_point.hpp"
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+
+using namespace util::text;
+
+struct BenchResult
+{
+	uint64_t operations = 0;
+	uint64_t durationNs = 0;
+	// Size of the processed input, if applicable
+	uint64_t bytes = 0;
+	bool success = true;
+};
+
+class Stopwatch
+{
+public:
+	Stopwatch() : m_start{std::chrono::steady_clock::now()} {}
+	uint64_t GetElapsedNs() const {return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -m_start).count();}
+private:
+	std::chrono::steady_clock::time_point m_start;
+};
+
+static BenchResult fail(const std::string &msg)
+{
+	std::cerr<<msg<<std::endl;
+	BenchResult result {};
+	result.success = false;
+	return result;
+}
+
+// All random input is generated from a fixed seed, so every run operates on the same data
+static std::mt19937 create_rng() {return std::mt19937{5'489u};}
+static uint32_t random_int(std::mt19937 &rng,uint32_t n) {return (n > 0) ? (rng() %n) : 0;}
+
+static std::string create_log(uint32_t numLines)
+{
+	std::string str {};
+	for(auto i=0u;i<numLines;++i)
+		str += "[12:00:" +std::to_string(i %60) +"] User" +std::to_string(i %17) +": The quick brown fox jumps over the lazy dog\n";
+	return str;
+}
+
+// Steady state of a capped console/log window: Every appended line evicts the oldest one
+static BenchResult bench_max_line_count()
+{
+	constexpr uint32_t numLines = 1'000'000;
+	constexpr uint32_t maxLineCount = 10'000;
+	auto text = FormattedText::Create();
+	text->SetMaxLineCount(maxLineCount);
+
+	Stopwatch sw {};
+	text->AppendText("Line 0");
+	for(auto i=1u;i<numLines;++i)
+		text->AppendText(util::Utf8String{"\nLine " +std::to_string(i)});
+	auto dt = sw.GetElapsedNs();
+
+	auto expected = util::Utf8String{"Line " +std::to_string(numLines -maxLineCount)};
+	if(text->GetLineCount() != maxLineCount || text->GetLine(0)->GetUnformattedLine().GetText() != expected)
+		return fail("Unexpected text state after eviction: " +std::to_string(text->GetLineCount()) +" lines remaining!");
+	return {numLines,dt};
+}
+
+// Unbounded console log that only ever grows at the end
+static BenchResult bench_console_append()
+{
+	constexpr uint32_t numLines = 200'000;
+	auto text = FormattedText::Create();
+	uint64_t numBytes = 0;
+
+	Stopwatch sw {};
+	for(auto i=0u;i<numLines;++i)
+	{
+		auto line = "\n[12:00:" +std::to_string(i %60) +"] User" +std::to_string(i %17) +": Message " +std::to_string(i);
+		numBytes += line.size();
+		text->AppendText(line);
+	}
+	auto dt = sw.GetElapsedNs();
+
+	if(text->GetLineCount() != numLines +1)
+		return fail("Unexpected line count after appending: " +std::to_string(text->GetLineCount()) +"!");
+	return {numLines,dt,numBytes};
+}
+
+// Same messages as console_append, but queued by several producer threads while the owner thread appends them
+static BenchResult bench_stream_append()
+{
+	constexpr uint32_t numThreads = 4;
+	constexpr uint32_t numLines = 200'000;
+	auto text = FormattedText::Create();
+	std::atomic<uint32_t> numThreadsDone = 0;
+	std::atomic<uint64_t> numBytes = 0;
+
+	Stopwatch sw {};
+	std::vector<std::thread> threads {};
+	for(auto t=0u;t<numThreads;++t)
+	{
+		threads.push_back(std::thread{[&text,&numThreadsDone,&numBytes,t]() {
+			uint64_t threadBytes = 0;
+			for(auto i=t;i<numLines;i+=numThreads)
+			{
+				auto line = "\n[12:00:" +std::to_string(i %60) +"] User" +std::to_string(i %17) +": Message " +std::to_string(i);
+				threadBytes += line.size();
+				text->StreamText(std::move(line));
+			}
+			numBytes += threadBytes;
+			++numThreadsDone;
+		}});
+	}
+	while(numThreadsDone < numThreads)
+		text->FlushStreamedText();
+	for(auto &thread : threads)
+		thread.join();
+	text->FlushStreamedText();
+	auto dt = sw.GetElapsedNs();
+
+	if(text->GetLineCount() != numLines +1)
+		return fail("Unexpected line count after appending: " +std::to_string(text->GetLineCount()) +"!");
+	return {numLines,dt,numBytes};
+}
+
+// Loading a large untagged document (e.g. a chat log) in one go
+static BenchResult bench_set_text()
+{
+	constexpr size_t numBytes = 20 *1024 *1024;
+	std::string str {};
+	str.reserve(numBytes +128);
+	for(auto i=0u;str.size() < numBytes;++i)
+		str += "[12:00:" +std::to_string(i %60) +"] User" +std::to_string(i %17) +": The quick brown fox jumps over the lazy dog\n";
+	auto text = FormattedText::Create();
+
+	Stopwatch sw {};
+	text->SetText(str);
+	auto dt = sw.GetElapsedNs();
+
+	if(text->GetCharCount() != str.size() +1)
+		return fail("Unexpected character count after loading: " +std::to_string(text->GetCharCount()) +"!");
+	return {1,dt,str.size()};
+}
+
+// Same document as set_text, but loaded from a file
+static BenchResult bench_load_file()
+{
+	constexpr size_t numBytes = 20 *1024 *1024;
+	std::string str {};
+	str.reserve(numBytes +128);
+	for(auto i=0u;str.size() < numBytes;++i)
+		str += "[12:00:" +std::to_string(i %60) +"] User" +std::to_string(i %17) +": The quick brown fox jumps over the lazy dog\n";
+	auto fileName = (std::filesystem::temp_directory_path() /"util_formatted_text_bench.txt").string();
+	std::ofstream{fileName,std::ios::binary}<<str;
+	auto text = FormattedText::Create();
+
+	Stopwatch sw {};
+	auto loaded = text->LoadFromFile(fileName);
+	auto dt = sw.GetElapsedNs();
+	std::filesystem::remove(fileName);
+
+	if(loaded == false)
+		return fail("Unable to load file '" +fileName +"'!");
+	if(text->GetCharCount() != str.size() +1)
+		return fail("Unexpected character count after loading: " +std::to_string(text->GetCharCount()) +"!");
+	return {1,dt,str.size()};
+}
+
+// Editing in the middle of a large document at random positions
+static BenchResult bench_random_edits()
+{
+	constexpr uint32_t numLines = 10'000;
+	constexpr uint32_t numEdits = 20'000;
+	auto text = FormattedText::Create();
+	text->SetText(create_log(numLines));
+	auto rng = create_rng();
+
+	Stopwatch sw {};
+	for(auto i=0u;i<numEdits;++i)
+	{
+		auto lineIdx = random_int(rng,text->GetLineCount());
+		auto lineLen = text->GetLine(lineIdx)->GetLength();
+		auto charOffset = random_int(rng,lineLen +1);
+		switch(random_int(rng,4))
+		{
+		case 0:
+			text->InsertText("inserted\ntext",lineIdx,charOffset);
+			break;
+		case 1:
+			text->InsertText("word ",lineIdx,charOffset);
+			break;
+		default:
+			if(charOffset < lineLen)
+				text->RemoveText(lineIdx,charOffset,std::min<TextLength>(1 +random_int(rng,8),lineLen -charOffset));
+			break;
+		}
+	}
+	auto dt = sw.GetElapsedNs();
+
+	if(text->GetLineCount() < numLines)
+		return fail("Unexpected line count after editing: " +std::to_string(text->GetLineCount()) +"!");
+	return {numEdits,dt};
+}
+
+// Long lines with only a few tags in between, i.e. tag parsing should cost (almost) nothing for the plain text
+// Edits a single long line, e.g. generated code in a script editor
+static BenchResult run_long_line_edits(TextLength pieceTableThreshold)
+{
+	constexpr uint32_t lineLength = 1'000'000;
+	constexpr uint32_t numEdits = 20'000;
+	auto text = FormattedText::Create();
+	text->SetTagsEnabled(false);
+	text->SetPieceTableThreshold(pieceTableThreshold);
+	std::string line {};
+	line.reserve(lineLength);
+	while(line.size() < lineLength)
+		line += "local x" +std::to_string(line.size()) +" = 0; ";
+	text->SetText(line);
+	auto expectedLength = text->GetLine(0)->GetLength();
+	auto rng = create_rng();
+
+	Stopwatch sw {};
+	for(auto i=0u;i<numEdits;++i)
+	{
+		auto lineLen = text->GetLine(0)->GetLength();
+		auto charOffset = random_int(rng,lineLen);
+		switch(random_int(rng,3))
+		{
+		case 0:
+			text->InsertText("word ",0,charOffset);
+			expectedLength += 5;
+			break;
+		case 1:
+		{
+			auto len = std::min<TextLength>(1 +random_int(rng,8),lineLen -charOffset);
+			text->RemoveText(0,charOffset,len);
+			expectedLength -= len;
+			break;
+		}
+		default:
+		{
+			auto len = std::min<TextLength>(1 +random_int(rng,16),lineLen -charOffset);
+			text->MoveText(0,charOffset,len,0,random_int(rng,lineLen -len));
+			break;
+		}
+		}
+	}
+	auto dt = sw.GetElapsedNs();
+
+	if(text->GetLineCount() != 1 || text->GetLine(0)->GetLength() != expectedLength)
+		return fail("Unexpected line length after editing: " +std::to_string(text->GetLine(0)->GetLength()) +"!");
+	return {numEdits,dt};
+}
+static BenchResult bench_long_line_edits() {return run_long_line_edits(UNTIL_THE_END);}
+static BenchResult bench_long_line_edits_piece_table() {return run_long_line_edits(0);}
+
+static BenchResult bench_typing()
+{
+	constexpr uint32_t lineLength = 200'000;
+	constexpr uint32_t numKeystrokes = 50'000;
+	auto text = FormattedText::Create();
+	text->SetTagsEnabled(false);
+	text->SetText(std::string(lineLength,'x'));
+	auto rng = create_rng();
+
+	// Typing in the middle of a long line, with the occasional backspace and cursor jump
+	Stopwatch sw {};
+	CharOffset cursor = lineLength /2;
+	for(auto i=0u;i<numKeystrokes;++i)
+	{
+		auto r = random_int(rng,100);
+		if(r == 0)
+			cursor = random_int(rng,text->GetLine(0)->GetLength());
+		else if(r < 10 && cursor > 0)
+			text->RemoveText(0,--cursor,1);
+		else
+			text->InsertText("a",0,cursor++);
+	}
+	auto dt = sw.GetElapsedNs();
+
+	if(text->GetLineCount() != 1 || text->GetLine(0)->GetUnformattedLine().GetText().length() != text->GetLine(0)->GetLength())
+		return fail("Unexpected line after typing!");
+	return {numKeystrokes,dt};
+}
+
+// Drag and drop of large selections between lines, with some of the lines being joined
+static BenchResult bench_move_text()
+{
+	constexpr uint32_t numLines = 1'000;
+	constexpr uint32_t lineLength = 2'000;
+	constexpr uint32_t numMoves = 20'000;
+	auto text = FormattedText::Create();
+	text->SetTagsEnabled(false);
+	std::string line(lineLength,'x');
+	std::string str {};
+	for(auto i=0u;i<numLines;++i)
+		str += line +'\n';
+	text->SetText(str);
+	auto charCount = text->GetCharCount();
+	auto lineCount = text->GetLineCount();
+	auto rng = create_rng();
+
+	Stopwatch sw {};
+	for(auto i=0u;i<numMoves;++i)
+	{
+		auto lineIdx = random_int(rng,text->GetLineCount());
+		auto lineLen = text->GetLine(lineIdx)->GetLength();
+		auto targetLineIdx = random_int(rng,text->GetLineCount());
+		if(i %100 == 0 && lineIdx +1 < text->GetLineCount() && lineLen > 0)
+		{
+			text->RemoveText(lineIdx,lineLen -1,2);
+			--charCount;
+			continue;
+		}
+		if(lineLen == 0 || targetLineIdx == lineIdx)
+			continue;
+		auto charOffset = random_int(rng,lineLen);
+		auto len = std::min<TextLength>(1 +random_int(rng,lineLength /2),lineLen -charOffset);
+		text->MoveText(lineIdx,charOffset,len,targetLineIdx,random_int(rng,text->GetLine(targetLineIdx)->GetLength() +1));
+	}
+	auto dt = sw.GetElapsedNs();
+
+	// Joining lines removes a character and a line break
+	if(text->GetCharCount() +(lineCount -text->GetLineCount()) != charCount)
+		return fail("Unexpected character count after moving text: " +std::to_string(text->GetCharCount()) +"!");
+	return {numMoves,dt};
+}
+
+static BenchResult bench_remove_range()
+{
+	constexpr uint32_t numLines = 200'000;
+	constexpr uint32_t lineLength = 80;
+	constexpr uint32_t numRemovals = 100;
+	constexpr uint32_t linesPerRemoval = 1'000;
+	auto text = FormattedText::Create();
+	std::string line(lineLength,'x');
+	std::string str {};
+	for(auto i=0u;i<numLines;++i)
+		str += line +'\n';
+	text->SetText(str);
+	auto rng = create_rng();
+
+	Stopwatch sw {};
+	for(auto i=0u;i<numRemovals;++i)
+	{
+		// Selections start and end in the middle of a line
+		auto lineIdx = random_int(rng,text->GetLineCount() -linesPerRemoval -1);
+		auto offset = *text->GetTextCharOffset(lineIdx,lineLength /2);
+		text->RemoveText(offset,linesPerRemoval *(lineLength +1));
+	}
+	auto dt = sw.GetElapsedNs();
+
+	if(text->GetLineCount() != numLines +1 -numRemovals *linesPerRemoval)
+		return fail("Unexpected line count after removing text: " +std::to_string(text->GetLineCount()) +"!");
+	return {numRemovals,dt};
+}
+
+// Undoing and redoing single edits in a large tagged text, which only applies the recorded deltas
+static BenchResult bench_undo_redo()
+{
+	constexpr uint32_t numLines = 20'000;
+	constexpr uint32_t numEdits = 2'000;
+	std::string str {};
+	for(auto i=0u;i<numLines;++i)
+		str += ((i %100 == 0) ? ("{[c:ff0000]}" +std::string(40,'x') +"{[/c]}") : std::string(40,'x')) +std::string(40,'y') +'\n';
+	auto text = FormattedText::Create();
+	text->SetText(str);
+	text->SetHistoryBudget(64 *1'024 *1'024);
+	auto rng = create_rng();
+	for(auto i=0u;i<numEdits;++i)
+	{
+		auto lineIdx = random_int(rng,text->GetLineCount());
+		auto lineLen = text->GetLine(lineIdx)->GetLength();
+		if(i %2 == 0 && lineLen > 0)
+			text->RemoveText(lineIdx,random_int(rng,lineLen),1);
+		else
+			text->InsertText("ab",lineIdx,random_int(rng,lineLen +1));
+	}
+	auto expected = std::string{text->GetUnformattedText().c_str()};
+
+	Stopwatch sw {};
+	uint64_t numOperations = 0;
+	while(text->Undo())
+		++numOperations;
+	while(text->Redo())
+		++numOperations;
+	auto dt = sw.GetElapsedNs();
+
+	if(numOperations != 2 *numEdits || text->GetUnformattedText() != expected)
+		return fail("Unexpected text after undoing and redoing all edits!");
+	return {numOperations,dt};
+}
+
+static BenchResult bench_parse_tags()
+{
+	constexpr uint32_t numLines = 100;
+	constexpr uint32_t lineLength = 100'000;
+	std::string plain(lineLength,'x');
+	std::string str {};
+	for(auto i=0u;i<numLines;++i)
+		str += "{[c:ff0000]}" +plain +"{[/c]}" +plain +'\n';
+	auto text = FormattedText::Create();
+
+	Stopwatch sw {};
+	text->SetText(str);
+	auto dt = sw.GetElapsedNs();
+
+	if(text->GetLine(0)->GetFormattedLine().GetText() != util::Utf8String{plain +plain})
+		return fail("Unexpected formatted text after parsing tags!");
+	return {1,dt,str.size()};
+}
+
+// Markup where almost every word is tagged
+static BenchResult bench_tag_dense()
+{
+	constexpr uint32_t numLines = 2'000;
+	constexpr uint32_t tagsPerLine = 20;
+	std::string str {};
+	for(auto i=0u;i<numLines;++i)
+	{
+		for(auto j=0u;j<tagsPerLine;++j)
+			str += (j %2 == 0) ? "{[c:ff0000]}red{[/c]} " : "{[u]}underlined{[/u]} ";
+		str += '\n';
+	}
+	auto text = FormattedText::Create();
+
+	Stopwatch sw {};
+	text->SetText(str);
+	auto dt = sw.GetElapsedNs();
+
+	if(text->GetTags().size() != numLines *tagsPerLine)
+		return fail("Unexpected number of tags after parsing: " +std::to_string(text->GetTags().size()) +"!");
+	return {numLines *tagsPerLine,dt,str.size()};
+}
+
+// Tag-heavy document that keeps growing (e.g. a colored chat log), with the visible part being queried after every line
+static BenchResult bench_tagged_append()
+{
+	constexpr uint32_t numLines = 20'000;
+	constexpr uint32_t numAppends = 1'000;
+	std::string str {};
+	for(auto i=0u;i<numLines;++i)
+		str += "{[c:ff0000]}User" +std::to_string(i %17) +"{[/c]}: Hello {[c:00ff00]}world{[/c]}\n";
+	auto text = FormattedText::Create();
+	text->SetText(str);
+
+	size_t numVisibleTags = 0;
+	Stopwatch sw {};
+	for(auto i=0u;i<numAppends;++i)
+	{
+		text->AppendText("\n{[c:0000ff]}User{[/c]}: Line " +std::to_string(i));
+		auto lineIdx = text->GetLineCount() -std::min<LineIndex>(text->GetLineCount(),50);
+		numVisibleTags = text->QueryTags(*text->GetTextCharOffset(lineIdx,0),UNTIL_THE_END).size();
+	}
+	auto dt = sw.GetElapsedNs();
+
+	if(numVisibleTags == 0)
+		return fail("No tags found in the visible range!");
+	return {numAppends,dt};
+}
+
+// Frames of many small tagged edits (e.g. a UI updating a console), each applied as a single batch
+static BenchResult bench_batched_edits()
+{
+	constexpr uint32_t numFrames = 200;
+	constexpr uint32_t editsPerFrame = 32;
+	auto text = FormattedText::Create();
+	size_t numCallbacks = 0;
+	FormattedText::Callbacks callbacks {};
+	callbacks.onLineAdded = [&numCallbacks](FormattedTextLine&) {++numCallbacks;};
+	callbacks.onLineChanged = [&numCallbacks](FormattedTextLine&) {++numCallbacks;};
+	text->SetCallbacks(callbacks);
+
+	Stopwatch sw {};
+	for(auto i=0u;i<numFrames;++i)
+	{
+		FormattedText::BatchGuard batch {*text};
+		for(auto j=0u;j<editsPerFrame;++j)
+		{
+			if(j %4 == 3)
+				text->AppendText(" {[c:00ff00]}done{[/c]}");
+			else
+				text->AppendText("\n{[c:ff0000]}Task " +std::to_string(j) +"{[/c]}:");
+		}
+	}
+	auto dt = sw.GetElapsedNs();
+
+	if(text->GetTags().empty())
+		return fail("No tags found after the last batch!");
+	if(numCallbacks > numFrames *editsPerFrame)
+		return fail("Line callbacks were not coalesced!");
+	return {numFrames *editsPerFrame,dt};
+}
+
+// Many anchor points on a single line (e.g. a long line with lots of tags) that are moved along with the text
+static BenchResult bench_anchor_points()
+{
+	constexpr uint32_t numAnchorPoints = 50'000;
+	auto text = FormattedText::Create();
+	text->SetText(std::string(numAnchorPoints,'x'));
+
+	Stopwatch sw {};
+	std::vector<AnchorPointHandle> anchorPoints {};
+	anchorPoints.reserve(numAnchorPoints);
+	for(auto i=0u;i<numAnchorPoints;++i)
+		anchorPoints.push_back(text->CreateAnchorPoint(0,i));
+	text->InsertText("abc\n",0,numAnchorPoints /2);
+	anchorPoints.clear();
+	auto dt = sw.GetElapsedNs();
+
+	if(text->GetLineCount() != 2)
+		return fail("Unexpected line count after inserting text: " +std::to_string(text->GetLineCount()) +"!");
+	return {numAnchorPoints,dt};
+}
+
+// Extracting small ranges, e.g. for copying the selection to the clipboard
+static BenchResult bench_substr()
+{
+	constexpr uint32_t numLines = 100'000;
+	constexpr uint32_t numQueries = 100'000;
+	auto text = FormattedText::Create();
+	text->SetText(create_log(numLines));
+	auto rng = create_rng();
+	auto numChars = text->GetCharCount();
+
+	uint64_t numBytes = 0;
+	Stopwatch sw {};
+	for(auto i=0u;i<numQueries;++i)
+		numBytes += text->Substr(random_int(rng,numChars),80).length();
+	auto dt = sw.GetElapsedNs();
+
+	if(numBytes == 0)
+		return fail("Extracted substrings are empty!");
+	return {numQueries,dt,numBytes};
+}
+
+// Rebuilding the full formatted text after every change, e.g. for a text element without its own line cache
+static BenchResult bench_formatted_text()
+{
+	constexpr uint32_t numLines = 20'000;
+	constexpr uint32_t numQueries = 100;
+	auto text = FormattedText::Create();
+	text->SetText(create_log(numLines));
+
+	uint64_t numBytes = 0;
+	Stopwatch sw {};
+	for(auto i=0u;i<numQueries;++i)
+	{
+		text->AppendText("\n{[c:ff0000]}Line{[/c]} " +std::to_string(i));
+		numBytes += text->GetFormattedText().length();
+	}
+	auto dt = sw.GetElapsedNs();
+
+	if(numBytes == 0)
+		return fail("Formatted text is empty!");
+	return {numQueries,dt,numBytes};
+}
+
+// Mapping absolute offsets to lines, e.g. for hit-testing or cursor movement
+static BenchResult bench_relative_offset()
+{
+	constexpr uint32_t numLines = 100'000;
+	constexpr uint32_t numQueries = 1'000'000;
+	auto text = FormattedText::Create();
+	text->SetText(create_log(numLines));
+	auto rng = create_rng();
+	auto numChars = text->GetCharCount();
+
+	uint64_t lineSum = 0;
+	Stopwatch sw {};
+	for(auto i=0u;i<numQueries;++i)
+	{
+		auto relOffset = text->GetRelativeCharOffset(random_int(rng,numChars));
+		if(relOffset.has_value())
+			lineSum += relOffset->first;
+	}
+	auto dt = sw.GetElapsedNs();
+
+	if(lineSum == 0)
+		return fail("Relative offsets could not be determined!");
+	return {numQueries,dt};
+}
+
+// Restoring the tag_dense document from its serialized form instead of re-parsing it
+static BenchResult bench_deserialize()
+{
+	constexpr uint32_t numLines = 2'000;
+	constexpr uint32_t tagsPerLine = 20;
+	std::string str {};
+	for(auto i=0u;i<numLines;++i)
+	{
+		for(auto j=0u;j<tagsPerLine;++j)
+			str += (j %2 == 0) ? "{[c:ff0000]}red{[/c]} " : "{[u]}underlined{[/u]} ";
+		str += '\n';
+	}
+	std::vector<uint8_t> data {};
+	FormattedText::Create(str)->Serialize(data);
+	auto text = FormattedText::Create();
+
+	Stopwatch sw {};
+	auto success = text->Deserialize(data.data(),data.size());
+	auto &formattedText = text->GetFormattedText();
+	auto dt = sw.GetElapsedNs();
+
+	if(success == false || formattedText.empty())
+		return fail("Unable to deserialize text!");
+	if(text->GetTags().size() != numLines *tagsPerLine)
+		return fail("Unexpected number of tags after deserializing: " +std::to_string(text->GetTags().size()) +"!");
+	return {numLines *tagsPerLine,dt,data.size()};
+}
+
+// A writer that hands a snapshot to its reader threads after every small edit
+static BenchResult bench_snapshot()
+{
+	constexpr uint32_t numLines = 20'000;
+	constexpr uint32_t numSnapshots = 1'000;
+	auto text = FormattedText::Create();
+	text->SetText(create_log(numLines));
+	auto rng = create_rng();
+
+	size_t numChars = 0;
+	Stopwatch sw {};
+	for(auto i=0u;i<numSnapshots;++i)
+	{
+		text->InsertText("x",random_int(rng,text->GetLineCount()),0);
+		numChars += text->Snapshot()->GetCharCount();
+	}
+	auto dt = sw.GetElapsedNs();
+
+	if(numChars == 0)
+		return fail("Snapshots are empty!");
+	return {numSnapshots,dt};
+}
+
+int main(int argc,char *argv[])
+{
+	struct Benchmark
+	{
+		const char *name;
+		BenchResult(*function)();
+	};
+	const Benchmark benchmarks[] = {
+		{"max_line_count",bench_max_line_count},
+		{"console_append",bench_console_append},
+		{"stream_append",bench_stream_append},
+		{"set_text",bench_set_text},
+		{"load_file",bench_load_file},
+		{"random_edits",bench_random_edits},
+		{"long_line_edits",bench_long_line_edits},
+		{"long_line_edits_piece_table",bench_long_line_edits_piece_table},
+		{"typing",bench_typing},
+		{"move_text",bench_move_text},
+		{"remove_range",bench_remove_range},
+		{"undo_redo",bench_undo_redo},
+		{"parse_tags",bench_parse_tags},
+		{"tag_dense",bench_tag_dense},
+		{"tagged_append",bench_tagged_append},
+		{"batched_edits",bench_batched_edits},
+		{"anchor_points",bench_anchor_points},
+		{"substr",bench_substr},
+		{"formatted_text",bench_formatted_text},
+		{"relative_offset",bench_relative_offset},
+		{"snapshot",bench_snapshot},
+		{"deserialize",bench_deserialize}
+	};
+	std::vector<std::string> filters {argv +1,argv +argc};
+
+	auto success = true;
+	std::stringstream json {};
+	json<<"{\n\t\"benchmarks\": [";
+	auto first = true;
+	for(auto &benchmark : benchmarks)
+	{
+		std::string name = benchmark.name;
+		if(filters.empty() == false && std::find_if(filters.begin(),filters.end(),[&name](const std::string &filter) {return name.find(filter) != std::string::npos;}) == filters.end())
+			continue;
+		auto result = benchmark.function();
+		success = success && result.success;
+
+		auto nsPerOp = (result.operations > 0) ? (result.durationNs /static_cast<double>(result.operations)) : 0.0;
+		auto mbs = (result.durationNs > 0) ? ((result.bytes /(1024.0 *1024.0)) /(result.durationNs /1'000'000'000.0)) : 0.0;
+		std::cerr<<name<<": "<<result.operations<<" operations took "<<(result.durationNs /1'000'000)<<" ms ("<<nsPerOp<<" ns/op";
+		if(result.bytes > 0)
+			std::cerr<<", "<<mbs<<" MB/s";
+		std::cerr<<")"<<(result.success ? "" : " FAILED")<<std::endl;
+
+		json<<(first ? "\n" : ",\n");
+		first = false;
+		json<<"\t\t{\"name\": \""<<name<<"\", \"success\": "<<(result.success ? "true" : "false")
+			<<", \"operations\": "<<result.operations<<", \"total_ns\": "<<result.durationNs<<", \"ns_per_op\": "<<nsPerOp;
+		if(result.bytes > 0)
+			json<<", \"bytes\": "<<result.bytes<<", \"mb_per_s\": "<<mbs;
+		json<<"}";
+	}
+	json<<"\n\t]\n}\n";
+	std::cout<<json.str();
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -7,11 +7,17 @@
 
 #include "util_formatted_text_config.hpp"
 #include "util_formatted_text_line.hpp"
+#include "util_formatted_text_line_tree.hpp"
+#include "util_formatted_text_tag_tree.hpp"
+#include "util_formatted_text_snapshot.hpp"
+#include "util_formatted_text_stream_queue.hpp"
+#include "util_formatted_text_history.hpp"
 #include <sharedutils/util_utf8.hpp>
 #include <sharedutils/util_shared_handle.hpp>
 #include <vector>
 #include <string_view>
 #include <functional>
+#include <unordered_set>
 
 #ifdef ENABLE_FORMATTED_TEXT_UNIT_TESTS
 	#include <sstream>
@@ -28,6 +34,12 @@ namespace util
 			: public std::enable_shared_from_this<FormattedText>
 		{
 		public:
+			enum class ChangeKind : uint8_t
+			{
+				Added = 0u,
+				Removed,
+				Changed
+			};
 			struct Callbacks
 			{
 				Callbacks()=default;
@@ -38,28 +50,65 @@ namespace util
 				std::function<void(FormattedTextLine&)> onLineRemoved = nullptr;
 				std::function<void(FormattedTextLine&)> onLineChanged = nullptr;
 				std::function<void()> onTextCleared = nullptr;
+				// Range-based alternative to the per-line callbacks above. Changes to adjacent lines are merged and delivered once the
+				// operation (or batch) that caused them has been completed. Applying the ranges in order reproduces the line changes, e.g.
+				// removed lines are specified by the indices they had at the time of their removal. The contents of the added and changed
+				// lines should only be retrieved once all ranges have been applied.
+				std::function<void(LineIndex first,LineIndex count,ChangeKind kind)> onLinesChanged = nullptr;
 
 				std::function<void(TextTag&)> onTagAdded = nullptr;
 				std::function<void(TextTag&)> onTagRemoved = nullptr;
 				std::function<void()> onTagsCleared = nullptr;
 			};
+			// Keeps a batch open for as long as it exists, see BeginBatch
+			class BatchGuard
+			{
+			public:
+				BatchGuard(FormattedText &text);
+				BatchGuard(const BatchGuard&)=delete;
+				BatchGuard &operator=(const BatchGuard&)=delete;
+				~BatchGuard();
+			private:
+				FormattedText &m_text;
+			};
 
 			static std::shared_ptr<FormattedText> Create(const util::Utf8StringView &text="");
-			virtual ~FormattedText()=default;
+			virtual ~FormattedText();
 			void AppendText(const util::Utf8StringView &text);
+			// Queues the text to be appended by the next call to FlushStreamedText. Can be called from any thread without blocking, even while the
+			// text is being edited. Chunks are appended as a whole and in the order they were queued in, so producers on different threads
+			// should only queue complete lines.
+			void StreamText(std::string text);
+			// Appends all queued text in a single operation, has to be called on the thread that edits the text. If the queued text ends with
+			// an incomplete UTF-8 sequence, it's kept back until the remaining bytes have been queued. Returns false if nothing was appended.
+			bool FlushStreamedText();
 			bool InsertText(const util::Utf8StringView &text,LineIndex lineIdx,CharOffset charOffset=LAST_CHAR);
 			void AppendLine(const util::Utf8StringView &line);
 			void PopFrontLine();
+			// Removes the first count lines at once. If tags are preserved on line removal, the tags
+			// of all removed lines are moved to the new first line in a single step.
+			void PopFrontLines(uint32_t count);
 			void PopBackLine();
 			void RemoveLine(LineIndex lineIdx);
 			bool RemoveText(LineIndex lineIdx,CharOffset charOffset,TextLength len);
 			bool RemoveText(TextOffset offset,TextLength len);
 			bool MoveText(LineIndex lineIdx,CharOffset startOffset,TextLength len,LineIndex targetLineIdx,CharOffset targetCharOffset=LAST_CHAR);
 			void SetText(const util::Utf8StringView &text);
+			// Replaces the text with the contents of the specified file. The file is memory-mapped and the lines only reference
+			// the mapped contents until they're modified for the first time. Returns false if the file couldn't be opened.
+			bool LoadFromFile(const std::string &fileName);
+			// Writes the text, the formatted lines with their index maps, the tags and the specified anchor points to a compact binary format.
+			void Serialize(std::vector<uint8_t> &outData,const std::vector<AnchorPointHandle> &anchorPoints={}) const;
+			// Replaces the text with serialized data without having to re-parse or re-format it. The anchor points that were specified
+			// when serializing are re-created in the same order (empty handles for anchor points that were invalid at the time).
+			// Returns false, without modifying the text, if the data is invalid or was written by an incompatible version.
+			bool Deserialize(const void *data,size_t size,std::vector<AnchorPointHandle> *outAnchorPoints=nullptr);
+			// Same as Deserialize, but the file is memory-mapped and the lines reference its contents until they're modified
+			bool DeserializeFromFile(const std::string &fileName,std::vector<AnchorPointHandle> *outAnchorPoints=nullptr);
 			util::Utf8String Substr(TextOffset startOffset,TextLength len) const;
 			void Clear();
-			util::TSharedHandle<AnchorPoint> CreateAnchorPoint(LineIndex lineIdx,CharOffset charOffset,bool allowOutOfBounds=false);
-			util::TSharedHandle<AnchorPoint> CreateAnchorPoint(TextOffset offset,bool allowOutOfBounds=false);
+			AnchorPointHandle CreateAnchorPoint(LineIndex lineIdx,CharOffset charOffset,bool allowOutOfBounds=false);
+			AnchorPointHandle CreateAnchorPoint(TextOffset offset,bool allowOutOfBounds=false);
 			bool operator==(const util::Utf8StringView &text) const;
 			bool operator!=(const util::Utf8StringView &text) const;
 			operator util::Utf8String() const;
@@ -69,23 +118,54 @@ namespace util
 
 			const util::Utf8String &GetUnformattedText() const;
 			const util::Utf8String &GetFormattedText() const;
+			// Returns an immutable copy of the current state of the text, which can safely be read from other threads while the text is being edited.
+			// Unchanged lines are shared with the previous snapshot and the same snapshot is returned until the text is changed again.
+			// The snapshot itself has to be created on the thread that edits the text.
+			PTextSnapshot Snapshot() const;
 
 			uint32_t GetMaxLineCount() const {return m_maxLineCount;}
+			// Turns the text into a bounded history: Once the line count exceeds the maximum, the
+			// oldest lines are evicted from the front
 			void SetMaxLineCount(uint32_t c) {m_maxLineCount = c;}
+			TextLength GetPieceTableThreshold() const {return m_pieceTableThreshold;}
+			// Lines with at least this many characters are switched to piece table storage when they're edited, which avoids
+			// copying the remainder of the line on every insertion or deletion. Disabled by default.
+			void SetPieceTableThreshold(TextLength minLineLength) {m_pieceTableThreshold = minLineLength;}
 
 			void SetCallbacks(const Callbacks &callbacks);
+			// Edits made within a batch only record the affected lines. Lines without any tag components are parsed once
+			// the batch ends (instead of after every edit) and the line added/changed callbacks are coalesced to one call per line,
+			// which is fired at the same time. Removed lines are still reported immediately, unless they were added within the same batch.
+			// Tags starting in lines that have been edited may be out of date until the batch ends. Batches can be nested.
+			void BeginBatch();
+			void EndBatch();
+			bool IsBatchActive() const;
+
+			// Edits are recorded in a journal once a budget (in bytes) has been set, which allows them to be undone and redone. Each operation
+			// (or batch) is undone as a single step, by applying the inverse edits through the regular edit methods. Anchor points outside
+			// of the affected ranges are kept. Replacing the text (SetText, LoadFromFile, Deserialize, Clear) discards the history.
+			size_t GetHistoryBudget() const;
+			void SetHistoryBudget(size_t budget);
+			bool CanUndo() const;
+			bool CanRedo() const;
+			// Returns false if there is nothing to undo/redo, or while the text is being edited (e.g. within a batch)
+			bool Undo();
+			bool Redo();
+			void ClearHistory();
 
 			std::optional<TextOffset> GetTextCharOffset(LineIndex lineIdx,CharOffset charOffset) const;
 			std::optional<std::pair<LineIndex,CharOffset>> GetRelativeCharOffset(TextOffset absCharOffset) const;
 			std::optional<char> GetChar(LineIndex lineIdx,CharOffset charOffset) const;
 			std::optional<char> GetChar(TextOffset absCharOffset) const;
-			const std::vector<PFormattedTextLine> &GetLines() const;
+			const LineTree &GetLines() const;
 			FormattedTextLine *GetLine(LineIndex lineIdx) const;
 			uint32_t GetLineCount() const;
 			uint32_t GetCharCount() const;
 
-			const std::vector<util::TSharedHandle<TextTag>> &GetTags() const;
-			std::vector<util::TSharedHandle<TextTag>> &GetTags();
+			const TagTree &GetTags() const;
+			TagTree &GetTags();
+			// Returns all tags overlapping the specified range (e.g. the visible part of the text) in O(log n +k)
+			std::vector<util::TSharedHandle<TextTag>> QueryTags(TextOffset startOffset,TextLength len) const;
 			void SetTagsEnabled(bool tagsEnabled);
 			bool AreTagsEnabled() const;
 			void SetPreserveTagsOnLineRemoval(bool preserveTags);
@@ -105,34 +185,128 @@ namespace util
 			};
 			FormattedText()=default;
 			LineIndex InsertLine(FormattedTextLine &line,LineIndex lineIdx=LAST_LINE);
+			void InsertLines(const PFormattedTextLine *lines,size_t count,LineIndex lineIdx);
 			void RemoveLine(LineIndex lineIdx,bool preserveTags);
-			void RemoveEmptyTags(util::text::LineIndex lineIndex,bool fromEnd=false);
-			TextOffset FindFirstVisibleChar(util::text::LineIndex lineIndex,bool fromEnd=false) const;
+			// Removes a range of lines in a single step, without preserving their tags
+			void RemoveLines(LineIndex lineIdx,uint32_t count);
+			// Moves text by splicing the storage of the lines, which is possible if tags are disabled and the range
+			// either lies within a single line or covers an entire line including its line break
+			bool CanMoveTextInPlace(const FormattedTextLine &lineSrc,CharOffset startOffset,TextLength len,const FormattedTextLine &lineTgt,CharOffset targetCharOffset) const;
+			bool MoveTextInPlace(FormattedTextLine &lineSrc,CharOffset startOffset,TextLength len,FormattedTextLine &lineTgt,CharOffset targetCharOffset);
+			// Removes the line break at the end of the line, i.e. joins the next line with it
+			bool JoinLines(LineIndex lineIdx);
+			// Variants of the edit methods based on absolute offsets, which are used to apply the deltas of the history.
+			// Unlike RemoveText, ranges starting at a line break can be removed as well.
+			bool InsertTextAt(TextOffset offset,const util::Utf8StringView &text);
+			bool RemoveTextAt(TextOffset offset,TextLength len);
+			// The target offset is relative to the text without the moved range
+			bool MoveTextAt(TextOffset offset,TextLength len,TextOffset targetOffset);
+			bool ApplyHistoryDelta(const EditHistory::Delta &delta);
+			// Applies the next group to undo/redo and moves it to the other stack. If a delta can't be applied, the
+			// group is reverted and the history is cleared.
+			bool ApplyHistoryGroup(bool undo);
+			// Removes the components of all tags within the line that don't contain any visible characters
+			void RemoveEmptyTags(util::text::LineIndex lineIndex);
 
 			void OnLineAdded(FormattedTextLine &line);
-			void OnLineRemoved(FormattedTextLine &line);
+			void OnLineRemoved(FormattedTextLine &line,LineIndex lineIdx);
 			void OnLineChanged(FormattedTextLine &line);
+			// Called whenever the contents of a line have changed (see FormattedTextLine::SetDirty)
+			void OnLineDirty(FormattedTextLine &line);
+			void AddLineChange(LineIndex lineIdx,ChangeKind kind);
+			// Delivers the recorded line changes, unless an operation or batch is still in progress
+			void FlushLineChanges();
+			// Keeps the line changes from being delivered until the outermost operation has been completed
+			struct OperationGuard
+			{
+				OperationGuard(FormattedText &text);
+				~OperationGuard();
+				FormattedText &text;
+			};
+			struct LineChange
+			{
+				LineIndex first;
+				LineIndex count;
+				ChangeKind kind;
+			};
+			std::vector<LineChange> m_lineChanges {};
+			uint32_t m_operationDepth = 0u;
+
+			bool IsRecordingHistory() const;
+			// Records the removal of the specified lines, has to be called before they're removed
+			void RecordLineRemoval(LineIndex lineIdx,uint32_t count);
+			// Keeps the edits from being recorded for as long as it exists, e.g. if an operation records its changes itself
+			struct HistorySuspension
+			{
+				HistorySuspension(FormattedText &text);
+				~HistorySuspension();
+				FormattedText &text;
+			};
+			EditHistory m_history {};
+			uint32_t m_historySuspensionDepth = 0u;
 			Callbacks m_callbacks = {};
 
 			void ParseTags(LineIndex lineIdx,CharOffset offset=0,TextLength len=UNTIL_THE_END);
+			void ParseTags(FormattedTextLine &line,CharOffset offset,TextLength len);
+			// Parses the specified lines, which have to be ordered by their indices. Lines without any tag components are tokenized first
+			// and, unless existing tags are affected, paired up in a single pass afterwards.
+			void ParseTags(const std::vector<FormattedTextLine*> &lines);
+			// Creates the tag components within the specified range of the line, without pairing them up. Only the line itself is modified.
+			static void ParseTagComponents(FormattedTextLine &line,CharOffset offset,TextLength len,std::vector<util::TSharedHandle<TextTagComponent>> &outNewTagComponents);
+			// Re-creates the candidate tags intersecting the range [absOffset,absEndOffset] and pairs the new tag components
+			void UpdateTags(std::vector<TagTree::Iterator> &candidateTags,TextOffset absOffset,TextOffset absEndOffset,std::vector<util::TSharedHandle<TextTagComponent>> &newTagComponents);
+			// Creates the tags for a sequence of components ordered by their offsets, closing components are assigned to the most recent open tag with the same name
+			std::vector<util::TSharedHandle<TextTag>> PairTagComponents(const std::vector<util::TSharedHandle<TextTagComponent>> &tagComponents);
+			// Returns the tags with components located in the specified lines, which have to be passed to UpdateRemovedTags once the lines have been destroyed
+			std::vector<TagTree::Iterator> FindLineTags(LineIndex lineIdx,uint32_t count) const;
+			// Returns the valid tags with a component anchored within [startOffset,endOffset]
+			std::vector<TagTree::Iterator> FindTags(TextOffset startOffset,TextOffset endOffset) const;
+			// Erases the tags without any remaining components and updates the cached ranges of the others, instead of rebuilding the entire tag tree
+			void UpdateRemovedTags(const std::vector<TagTree::Iterator> &tags);
+			// Parses the lines whose tags were deferred by the active batch, up to (excluding) the specified line
+			void ParsePendingTags(LineIndex endLineIdx=LAST_LINE);
 			void ParseText(const util::Utf8StringView &text,std::vector<PFormattedTextLine> &outLines);
+			bool Deserialize(const std::shared_ptr<const void> &source,std::string_view data,std::vector<AnchorPointHandle> *outAnchorPoints);
 			void UpdateTextInfo() const;
-			void UpdateTextOffsets(LineIndex lineStartIdx=0);
+			// Returns the snapshot of the specified subtree of the line tree, only the subtrees that have changed since the previous snapshot are rebuilt
+			std::shared_ptr<const TextSnapshot::Node> GetSnapshotNode(LineTree::Node &node) const;
+			// Returns the tags whose opening tag component is located in the specified line
+			std::shared_ptr<const std::vector<TextSnapshot::Tag>> GetSnapshotTags(FormattedTextLine &line) const;
+			// The pool is only created once the first anchor point of the text is created
+			AnchorPointPool &GetAnchorPointPool();
+			// Line and character counts are maintained by the line tree, the full text strings
+			// are only rebuilt once they're actually requested
 			struct {
-				uint32_t lineCount = 0u;
-				TextLength charCount = 0u;
 				util::Utf8String unformattedText = "";
 				util::Utf8String formattedText = "";
+				bool unformattedTextDirty = true;
+				bool formattedTextDirty = true;
+				PTextSnapshot snapshot = nullptr;
+				// Lines that have changed since the last snapshot. The snapshot tags of all tags intersecting them have to be updated,
+				// including the ones that start in a different line.
+				std::vector<std::weak_ptr<FormattedTextLine>> snapshotChangedLines {};
+				// Changes only have to be tracked once a snapshot exists
+				bool trackSnapshotChanges = false;
 			} mutable m_textInfo = {};
+			struct {
+				uint32_t depth = 0u;
+				std::unordered_set<FormattedTextLine*> pendingTagLines {};
+				std::unordered_set<FormattedTextLine*> addedLines {};
+				std::unordered_set<FormattedTextLine*> changedLines {};
+			} m_batch = {};
 			mutable bool m_bDirty = true;
 			uint32_t m_maxLineCount = std::numeric_limits<uint32_t>::max();
-			std::vector<PFormattedTextLine> m_textLines = {};
-			std::vector<LineIndex> m_formattedOffsetToLineIndex = {};
-			std::vector<LineIndex> m_unformattedOffsetToLineIndex = {};
-			std::vector<util::TSharedHandle<TextTag>> m_tags = {};
+			TextLength m_pieceTableThreshold = UNTIL_THE_END;
+			AnchorPointPool *m_anchorPointPool = nullptr;
+			LineTree m_textLines {};
+			TagTree m_tags {};
+			TextStreamQueue m_streamQueue {};
+			std::string m_streamRemainder {};
 			StateFlags m_stateFlags = static_cast<StateFlags>(
 				static_cast<std::underlying_type_t<StateFlags>>(StateFlags::TagsEnabled) | static_cast<std::underlying_type_t<StateFlags>>(StateFlags::PreserveTagsOnLineRemoval)
 			);
+			friend FormattedTextLine;
+			friend AnchorPoint;
 		};
 	};
 };
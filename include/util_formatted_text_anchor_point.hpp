@@ -6,9 +6,14 @@
 #define __UTIL_FORMATTED_TEXT_ANCHOR_POINT_HPP__
 
 #include "util_formatted_text_types.hpp"
-#include <sharedutils/util_shared_handle.hpp>
 #include <memory>
 #include <vector>
+#include <iterator>
+#include <cstddef>
+#include <type_traits>
+#include <limits>
+#include <bit>
+#include <new>
 
 namespace util
 {
@@ -16,14 +21,107 @@ namespace util
 	{
 		class FormattedTextLine;
 		class LineStartAnchorPoint;
+		class AnchorPoint;
+		class AnchorPointPool;
+		// Handle to an anchor point in the pool of its text. The anchor point is destroyed once the last handle to it has been released,
+		// or when it's removed explicitly, in which case all other handles to it become invalid. Handles keep the pool alive, so they may outlive their text.
+		template<class TAnchorPoint>
+			class TAnchorPointHandle
+		{
+		public:
+			TAnchorPointHandle()=default;
+			TAnchorPointHandle(std::nullptr_t);
+			TAnchorPointHandle(const TAnchorPointHandle &other);
+			TAnchorPointHandle(TAnchorPointHandle &&other);
+			template<class TOther,typename=std::enable_if_t<std::is_convertible_v<TOther*,TAnchorPoint*>>>
+				TAnchorPointHandle(const TAnchorPointHandle<TOther> &other);
+			~TAnchorPointHandle();
+			TAnchorPointHandle &operator=(const TAnchorPointHandle &other);
+			TAnchorPointHandle &operator=(TAnchorPointHandle &&other);
+			TAnchorPointHandle &operator=(std::nullptr_t);
+
+			bool IsValid() const;
+			bool IsExpired() const;
+			TAnchorPoint *Get() const;
+			TAnchorPoint *operator->() const;
+			TAnchorPoint &operator*() const;
+			// Destroys the anchor point, even if there are other handles to it
+			void Remove();
+
+			bool operator==(std::nullptr_t) const;
+			bool operator!=(std::nullptr_t) const;
+			bool operator==(const TAnchorPointHandle &other) const;
+			bool operator!=(const TAnchorPointHandle &other) const;
+		private:
+			// Takes over a reference to the anchor point that has already been added to the slot
+			TAnchorPointHandle(AnchorPointPool &pool,uint32_t index,uint32_t generation);
+			void Acquire();
+			void Release();
+			AnchorPointPool *m_pool = nullptr;
+			uint32_t m_index = 0u;
+			uint32_t m_generation = 0u;
+			template<class TOther>
+				friend class TAnchorPointHandle;
+			friend AnchorPointPool;
+		};
+		using AnchorPointHandle = TAnchorPointHandle<AnchorPoint>;
+
+		// Intrusive list of the child anchor points of a line start anchor point, which allows them to be attached and detached in O(1).
+		// Anchor points are linked through a single link stored in the anchor point itself, and unlink themselves when they're destroyed.
+		class AnchorPointList
+		{
+		public:
+			struct Link
+			{
+				AnchorPoint *prev = nullptr;
+				AnchorPoint *next = nullptr;
+			};
+			class Iterator
+			{
+			public:
+				using iterator_category = std::forward_iterator_tag;
+				using value_type = AnchorPoint;
+				using difference_type = std::ptrdiff_t;
+				using pointer = AnchorPoint*;
+				using reference = AnchorPoint&;
+
+				Iterator(AnchorPoint *anchorPoint);
+				reference operator*() const;
+				pointer operator->() const;
+				// The next anchor point is determined in advance, so the current one may be detached or removed while iterating
+				Iterator &operator++();
+				bool operator==(const Iterator &other) const;
+				bool operator!=(const Iterator &other) const;
+			private:
+				AnchorPoint *m_anchorPoint = nullptr;
+				AnchorPoint *m_next = nullptr;
+			};
+			AnchorPointList()=default;
+			AnchorPointList(const AnchorPointList&)=delete;
+			AnchorPointList &operator=(const AnchorPointList&)=delete;
+			~AnchorPointList();
+			void PushBack(AnchorPoint &anchorPoint);
+			// The anchor point has to be part of this list
+			void Remove(AnchorPoint &anchorPoint);
+
+			size_t size() const;
+			bool empty() const;
+			Iterator begin() const;
+			Iterator end() const;
+		private:
+			AnchorPoint *m_first = nullptr;
+			AnchorPoint *m_last = nullptr;
+			size_t m_size = 0;
+		};
+
 		class AnchorPoint
 		{
 		public:
 			template<class TAnchorPoint=AnchorPoint>
-				static util::TSharedHandle<TAnchorPoint> Create(FormattedTextLine &line,bool allowOutOfBounds=false);
-			virtual ~AnchorPoint()=default;
+				static TAnchorPointHandle<TAnchorPoint> Create(FormattedTextLine &line,bool allowOutOfBounds=false);
+			virtual ~AnchorPoint();
 			LineIndex GetLineIndex() const;
-			TextOffset GetTextCharOffset() const;
+			virtual TextOffset GetTextCharOffset() const;
 			FormattedTextLine &GetLine() const;
 			bool IsValid() const;
 
@@ -35,7 +133,7 @@ namespace util
 			bool operator>(const AnchorPoint &other) const;
 			bool operator<=(const AnchorPoint &other) const;
 			bool operator>=(const AnchorPoint &other) const;
-			
+
 			void SetLine(FormattedTextLine &line);
 			LineStartAnchorPoint *GetParent();
 			void SetParent(LineStartAnchorPoint &parent);
@@ -50,54 +148,234 @@ namespace util
 			void ShiftToOffset(TextOffset offset);
 			void SetOffset(TextOffset offset);
 
-			util::TSharedHandle<AnchorPoint> GetHandle();
+			AnchorPointHandle GetHandle();
 		protected:
 			AnchorPoint(TextOffset charOffset=0,bool allowOutOfBounds=false);
 			AnchorPoint(const AnchorPoint&)=delete;
 		private:
+			static AnchorPointPool &GetPool(FormattedTextLine &line);
 			TextOffset m_charOffset = 0u;
 			bool m_bAllowOutOfBounds = false;
+			uint32_t m_poolIndex = 0u;
+			AnchorPointPool *m_pool = nullptr;
 			std::weak_ptr<FormattedTextLine> m_wpLine = {};
-			util::TWeakSharedHandle<AnchorPoint> m_parent = {};
-
-			util::TWeakSharedHandle<AnchorPoint> m_handle = {};
+			// The anchor point is part of the child list of its parent
+			LineStartAnchorPoint *m_parent = nullptr;
+			AnchorPointList::Link m_link {};
+			friend AnchorPointList;
+			friend AnchorPointPool;
+			friend LineStartAnchorPoint;
 		};
 
+		// The offset of a line start anchor point is not stored, but derived from the position
+		// of its line in the line tree. All other anchor points of a line are stored relative to it, so
+		// modifying a line never requires the anchor points of subsequent lines to be updated.
 		class LineStartAnchorPoint
 			: public AnchorPoint
 		{
 		public:
-			void SetPreviousLineAnchorStartPoint(LineStartAnchorPoint &anchor);
-			void ClearPreviousLineAnchorStartPoint();
+			virtual ~LineStartAnchorPoint() override;
 			LineStartAnchorPoint *GetPreviousLineAnchorStartPoint();
-
-			void SetNextLineAnchorStartPoint(LineStartAnchorPoint &anchor);
-			void ClearNextLineAnchorStartPoint();
 			LineStartAnchorPoint *GetNextLineAnchorStartPoint();
 
+			virtual TextOffset GetTextCharOffset() const override;
 			virtual bool IsLineStartAnchorPoint() const override;
+			// No-op, the offset is always derived from the line
 			virtual void ShiftByOffset(ShiftOffset offset) override;
 
-			std::vector<util::TWeakSharedHandle<AnchorPoint>> &GetChildren();
-			const std::vector<util::TWeakSharedHandle<AnchorPoint>> &GetChildren() const;
+			AnchorPointList &GetChildren();
+			const AnchorPointList &GetChildren() const;
 		protected:
-			void RemoveChild(const AnchorPoint &anchorPoint);
-			std::vector<util::TWeakSharedHandle<AnchorPoint>> m_children = {};
+			void RemoveChild(AnchorPoint &anchorPoint);
+			AnchorPointList m_children {};
 			using AnchorPoint::AnchorPoint;
 			using AnchorPoint::SetParent;
 			friend AnchorPoint;
+			friend AnchorPointPool;
+		};
+
+		// Tags create two anchor points per tag component, so the anchor points of a text are allocated from fixed-size slots in slabs
+		// owned by the text instead of individually. Handles address an anchor point by its slot index and the generation of the slot,
+		// which changes whenever an anchor point is destroyed, so no separate control block is required.
+		// The pool isn't thread-safe, anchor points and their handles may only be used on the thread that edits the text.
+		class AnchorPointPool
+		{
+		public:
+			static constexpr size_t SLOT_SIZE = (sizeof(AnchorPoint) > sizeof(LineStartAnchorPoint)) ? sizeof(AnchorPoint) : sizeof(LineStartAnchorPoint);
+			// The size of each slab is twice the size of the previous one, so small texts don't allocate more slots than they need
+			static constexpr uint32_t FIRST_SLAB_SIZE = 16u;
+			struct Slot
+			{
+				alignas(AnchorPoint) alignas(LineStartAnchorPoint) std::byte data[SLOT_SIZE];
+				AnchorPoint *anchorPoint = nullptr;
+				uint32_t generation = 0u;
+				// Number of handles to the anchor point, or the index of the next free slot if the slot is unused
+				uint32_t refCount = 0u;
+			};
+			// The pool is released once the owner and all handles to its anchor points have released their references
+			static AnchorPointPool *Create();
+			AnchorPointPool(const AnchorPointPool&)=delete;
+			AnchorPointPool &operator=(const AnchorPointPool&)=delete;
+			void AddReference();
+			void RemoveReference();
+
+			template<class TAnchorPoint>
+				TAnchorPointHandle<TAnchorPoint> Add(TextOffset charOffset,bool allowOutOfBounds);
+			template<class TAnchorPoint>
+				TAnchorPointHandle<TAnchorPoint> GetHandle(TAnchorPoint &anchorPoint);
+			Slot &GetSlot(uint32_t index);
+			void Destroy(uint32_t index);
 		private:
-			util::TWeakSharedHandle<AnchorPoint> m_prevLineAnchorStartPoint = {};
-			util::TWeakSharedHandle<AnchorPoint> m_nextLineAnchorStartPoint = {};
+			AnchorPointPool()=default;
+			uint32_t Allocate();
+			std::vector<std::unique_ptr<Slot[]>> m_slabs {};
+			uint32_t m_slotCount = 0u;
+			uint32_t m_firstFreeSlot = std::numeric_limits<uint32_t>::max();
+			uint32_t m_refCount = 1u;
 		};
 	};
 };
 
 template<class TAnchorPoint>
-	util::TSharedHandle<TAnchorPoint> util::text::AnchorPoint::Create(FormattedTextLine &line,bool allowOutOfBounds)
+	util::text::TAnchorPointHandle<TAnchorPoint>::TAnchorPointHandle(std::nullptr_t)
+{}
+template<class TAnchorPoint>
+	util::text::TAnchorPointHandle<TAnchorPoint>::TAnchorPointHandle(AnchorPointPool &pool,uint32_t index,uint32_t generation)
+	: m_pool{&pool},m_index{index},m_generation{generation}
+{
+	pool.AddReference();
+}
+template<class TAnchorPoint>
+	util::text::TAnchorPointHandle<TAnchorPoint>::TAnchorPointHandle(const TAnchorPointHandle &other)
+	: m_pool{other.m_pool},m_index{other.m_index},m_generation{other.m_generation}
+{
+	Acquire();
+}
+template<class TAnchorPoint>
+	util::text::TAnchorPointHandle<TAnchorPoint>::TAnchorPointHandle(TAnchorPointHandle &&other)
+	: m_pool{other.m_pool},m_index{other.m_index},m_generation{other.m_generation}
+{
+	other.m_pool = nullptr;
+}
+template<class TAnchorPoint>
+	template<class TOther,typename>
+		util::text::TAnchorPointHandle<TAnchorPoint>::TAnchorPointHandle(const TAnchorPointHandle<TOther> &other)
+	: m_pool{other.m_pool},m_index{other.m_index},m_generation{other.m_generation}
+{
+	Acquire();
+}
+template<class TAnchorPoint>
+	util::text::TAnchorPointHandle<TAnchorPoint>::~TAnchorPointHandle() {Release();}
+template<class TAnchorPoint>
+	util::text::TAnchorPointHandle<TAnchorPoint> &util::text::TAnchorPointHandle<TAnchorPoint>::operator=(const TAnchorPointHandle &other)
+{
+	if(this == &other)
+		return *this;
+	TAnchorPointHandle copy {other};
+	return operator=(std::move(copy));
+}
+template<class TAnchorPoint>
+	util::text::TAnchorPointHandle<TAnchorPoint> &util::text::TAnchorPointHandle<TAnchorPoint>::operator=(TAnchorPointHandle &&other)
+{
+	if(this == &other)
+		return *this;
+	Release();
+	m_pool = other.m_pool;
+	m_index = other.m_index;
+	m_generation = other.m_generation;
+	other.m_pool = nullptr;
+	return *this;
+}
+template<class TAnchorPoint>
+	util::text::TAnchorPointHandle<TAnchorPoint> &util::text::TAnchorPointHandle<TAnchorPoint>::operator=(std::nullptr_t)
+{
+	Release();
+	return *this;
+}
+template<class TAnchorPoint>
+	void util::text::TAnchorPointHandle<TAnchorPoint>::Acquire()
+{
+	if(m_pool == nullptr)
+		return;
+	m_pool->AddReference();
+	auto &slot = m_pool->GetSlot(m_index);
+	if(slot.generation == m_generation && slot.anchorPoint)
+		++slot.refCount;
+}
+template<class TAnchorPoint>
+	void util::text::TAnchorPointHandle<TAnchorPoint>::Release()
+{
+	if(m_pool == nullptr)
+		return;
+	auto *pool = m_pool;
+	m_pool = nullptr;
+	auto &slot = pool->GetSlot(m_index);
+	if(slot.generation == m_generation && slot.anchorPoint && --slot.refCount == 0)
+		pool->Destroy(m_index);
+	pool->RemoveReference();
+}
+template<class TAnchorPoint>
+	bool util::text::TAnchorPointHandle<TAnchorPoint>::IsValid() const {return Get() != nullptr;}
+template<class TAnchorPoint>
+	bool util::text::TAnchorPointHandle<TAnchorPoint>::IsExpired() const {return IsValid() == false;}
+template<class TAnchorPoint>
+	TAnchorPoint *util::text::TAnchorPointHandle<TAnchorPoint>::Get() const
+{
+	if(m_pool == nullptr)
+		return nullptr;
+	auto &slot = m_pool->GetSlot(m_index);
+	return (slot.generation == m_generation) ? static_cast<TAnchorPoint*>(slot.anchorPoint) : nullptr;
+}
+template<class TAnchorPoint>
+	TAnchorPoint *util::text::TAnchorPointHandle<TAnchorPoint>::operator->() const {return Get();}
+template<class TAnchorPoint>
+	TAnchorPoint &util::text::TAnchorPointHandle<TAnchorPoint>::operator*() const {return *Get();}
+template<class TAnchorPoint>
+	void util::text::TAnchorPointHandle<TAnchorPoint>::Remove()
+{
+	if(IsValid())
+		m_pool->Destroy(m_index);
+}
+template<class TAnchorPoint>
+	bool util::text::TAnchorPointHandle<TAnchorPoint>::operator==(std::nullptr_t) const {return IsExpired();}
+template<class TAnchorPoint>
+	bool util::text::TAnchorPointHandle<TAnchorPoint>::operator!=(std::nullptr_t) const {return IsValid();}
+template<class TAnchorPoint>
+	bool util::text::TAnchorPointHandle<TAnchorPoint>::operator==(const TAnchorPointHandle &other) const {return Get() == other.Get();}
+template<class TAnchorPoint>
+	bool util::text::TAnchorPointHandle<TAnchorPoint>::operator!=(const TAnchorPointHandle &other) const {return operator==(other) == false;}
+
+inline util::text::AnchorPointPool::Slot &util::text::AnchorPointPool::GetSlot(uint32_t index)
+{
+	// Slab i starts at slot FIRST_SLAB_SIZE *(2^i -1)
+	auto slabIdx = std::bit_width(index /FIRST_SLAB_SIZE +1) -1;
+	return m_slabs[slabIdx][index -FIRST_SLAB_SIZE *((1u<<slabIdx) -1)];
+}
+template<class TAnchorPoint>
+	util::text::TAnchorPointHandle<TAnchorPoint> util::text::AnchorPointPool::Add(TextOffset charOffset,bool allowOutOfBounds)
+{
+	static_assert(sizeof(TAnchorPoint) <= SLOT_SIZE && alignof(Slot) %alignof(TAnchorPoint) == 0);
+	auto index = Allocate();
+	auto &slot = GetSlot(index);
+	auto *anchorPoint = new(slot.data) TAnchorPoint{charOffset,allowOutOfBounds};
+	anchorPoint->m_pool = this;
+	anchorPoint->m_poolIndex = index;
+	slot.anchorPoint = anchorPoint;
+	slot.refCount = 1;
+	return TAnchorPointHandle<TAnchorPoint>{*this,index,slot.generation};
+}
+template<class TAnchorPoint>
+	util::text::TAnchorPointHandle<TAnchorPoint> util::text::AnchorPointPool::GetHandle(TAnchorPoint &anchorPoint)
+{
+	auto &slot = GetSlot(anchorPoint.m_poolIndex);
+	++slot.refCount;
+	return TAnchorPointHandle<TAnchorPoint>{*this,anchorPoint.m_poolIndex,slot.generation};
+}
+
+template<class TAnchorPoint>
+	util::text::TAnchorPointHandle<TAnchorPoint> util::text::AnchorPoint::Create(FormattedTextLine &line,bool allowOutOfBounds)
 {
-	auto hAnchorPoint = util::TSharedHandle<TAnchorPoint>{new TAnchorPoint{allowOutOfBounds}};
-	hAnchorPoint->m_handle = util::shared_handle_cast<TAnchorPoint,AnchorPoint>(hAnchorPoint);
+	auto hAnchorPoint = GetPool(line).Add<TAnchorPoint>(0u,allowOutOfBounds);
 	hAnchorPoint->SetLine(line);
 	return hAnchorPoint;
 }
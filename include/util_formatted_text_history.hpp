@@ -0,0 +1,92 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __UTIL_FORMATTED_TEXT_HISTORY_HPP__
+#define __UTIL_FORMATTED_TEXT_HISTORY_HPP__
+
+#include "util_formatted_text_types.hpp"
+#include <sharedutils/util_utf8.hpp>
+#include <string>
+#include <vector>
+#include <deque>
+
+namespace util
+{
+	namespace text
+	{
+		// Journal of the edits made to the unformatted text, used to undo and redo them. Edits are recorded as deltas
+		// relative to the text at the time they were made, which only store the affected range and the inserted or
+		// removed characters (moves don't store any characters at all). Deltas are collected in groups, each group
+		// is undone and redone as a single step. The memory occupied by the deltas is bounded by a budget, once it's
+		// exceeded the oldest groups are discarded.
+		class EditHistory
+		{
+		public:
+			enum class DeltaType : uint8_t
+			{
+				Insert = 0u,
+				Remove,
+				Move
+			};
+			struct Delta
+			{
+				DeltaType type;
+				// Start of the inserted or removed range, or the offset the moved range was moved from
+				TextOffset offset;
+				// Offset of the moved range after the move, which is relative to the text without the moved range
+				TextOffset targetOffset;
+				TextLength length;
+				// Inserted or removed characters
+				util::Utf8String text;
+			};
+			using Group = std::vector<Delta>;
+
+			// Returns the delta that reverts the specified delta
+			static Delta Invert(const Delta &delta);
+
+			EditHistory()=default;
+			EditHistory(const EditHistory&)=delete;
+			EditHistory &operator=(const EditHistory&)=delete;
+			// Maximum number of bytes the recorded deltas may occupy. A budget of 0 disables the history.
+			void SetBudget(size_t budget);
+			size_t GetBudget() const;
+			bool IsEnabled() const;
+			// Number of bytes occupied by the recorded deltas
+			size_t GetSize() const;
+
+			// Recording a delta discards all groups that could have been redone
+			void RecordInsert(TextOffset offset,const util::Utf8StringView &text);
+			void RecordRemove(TextOffset offset,const util::Utf8StringView &text);
+			void RecordMove(TextOffset offset,TextLength len,TextOffset targetOffset);
+			// Completes the group of the deltas recorded since the last call
+			void EndGroup();
+
+			// Returns the group that would be undone/redone next, or nullptr if there is none
+			const Group *GetUndoGroup() const;
+			const Group *GetRedoGroup() const;
+			// Has to be called once the group has been undone/redone
+			void PopUndoGroup();
+			void PopRedoGroup();
+			void Clear();
+		private:
+			static size_t GetSize(const Delta &delta);
+			static size_t GetSize(const Group &group);
+			void Record(Delta delta);
+			// Tries to extend the most recent delta of the current group, e.g. if characters are typed one at a time within a batch
+			bool Merge(const Delta &delta);
+			// Discards the oldest groups until the budget is met
+			void Trim();
+
+			std::deque<Group> m_undoGroups {};
+			std::vector<Group> m_redoGroups {};
+			Group m_group {};
+			// Set if the current group alone has exceeded the budget, in which case the rest of it isn't recorded either
+			bool m_groupDiscarded = false;
+			size_t m_size = 0;
+			size_t m_budget = 0;
+		};
+	};
+};
+
+#endif
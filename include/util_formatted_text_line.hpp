@@ -7,6 +7,9 @@
 
 #include "util_formatted_text_config.hpp"
 #include "util_text_line.hpp"
+#include "util_formatted_text_line_tree.hpp"
+#include "util_formatted_text_anchor_point.hpp"
+#include "util_formatted_text_snapshot.hpp"
 #include <sharedutils/util_shared_handle.hpp>
 #include <sharedutils/util_utf8.hpp>
 #include <optional>
@@ -20,11 +23,13 @@ namespace util
 		class TextTagComponent;
 		class LineStartAnchorPoint;
 		class AnchorPoint;
+		class TextTag;
 		class FormattedTextLine
 			: public std::enable_shared_from_this<FormattedTextLine>
 		{
 		public:
-			static PFormattedTextLine Create(FormattedText &text,const std::string &line="");
+			static PFormattedTextLine Create(FormattedText &text,std::string line="");
+			static PFormattedTextLine Create(FormattedText &text,TextLine line);
 			FormattedTextLine(const FormattedTextLine&)=delete;
 			FormattedTextLine &operator=(const FormattedTextLine&)=delete;
 			~FormattedTextLine();
@@ -42,11 +47,11 @@ namespace util
 			
 			std::vector<util::TSharedHandle<TextTagComponent>> &GetTagComponents();
 			const std::vector<util::TSharedHandle<TextTagComponent>> &GetTagComponents() const;
-			std::vector<util::TWeakSharedHandle<AnchorPoint>> &GetAnchorPoints();
-			const std::vector<util::TWeakSharedHandle<AnchorPoint>> &GetAnchorPoints() const;
 			const LineStartAnchorPoint &GetStartAnchorPoint() const;
 			LineStartAnchorPoint &GetStartAnchorPoint();
 			LineIndex GetIndex() const;
+			FormattedTextLine *GetPreviousLine() const;
+			FormattedTextLine *GetNextLine() const;
 
 			bool IsEmpty() const;
 			TextOffset GetStartOffset() const;
@@ -63,7 +68,7 @@ namespace util
 			std::optional<char> GetChar(CharOffset offset) const;
 			CharOffset GetFormattedCharOffset(CharOffset offset) const;
 			CharOffset GetUnformattedCharOffset(CharOffset offset) const;
-			util::TSharedHandle<AnchorPoint> CreateAnchorPoint(CharOffset charOffset,bool allowOutOfBounds=false);
+			AnchorPointHandle CreateAnchorPoint(CharOffset charOffset,bool allowOutOfBounds=false);
 
 			void AppendCharacter(int32_t c);
 			TextLine &Format();
@@ -73,33 +78,59 @@ namespace util
 			bool Validate(std::stringstream &msg) const;
 #endif
 		protected:
-			FormattedTextLine(FormattedText &text,const std::string &line="");
-			void Initialize(LineIndex lineIndex);
-			void SetIndex(LineIndex lineIndex);
-			void DetachAnchorPoint(const AnchorPoint &anchorPoint);
-			void AttachAnchorPoint(AnchorPoint &anchorPoint);
+			FormattedTextLine(FormattedText &text,std::string line="");
+			FormattedTextLine(FormattedText &text,TextLine line);
+			bool HasAnchorPoints() const;
 
 			// oldLineLen = original length of this line before the modification that caused the shift
 			// was applied
 			void ShiftAnchors(CharOffset startOffset,TextLength len,ShiftOffset shiftAmount,TextLength oldLineLen);
-			std::vector<TSharedHandle<AnchorPoint>> DetachAnchorPoints(CharOffset startOffset,TextLength len=UNTIL_THE_END);
-			void AttachAnchorPoints(std::vector<TSharedHandle<AnchorPoint>> &anchorPoints,ShiftOffset shiftOffset=0);
+			std::vector<AnchorPointHandle> DetachAnchorPoints(CharOffset startOffset,TextLength len=UNTIL_THE_END);
+			void AttachAnchorPoints(std::vector<AnchorPointHandle> &anchorPoints,ShiftOffset shiftOffset=0);
 			util::TSharedHandle<TextTagComponent> ParseTagComponent(CharOffset offset,const util::Utf8StringView &str);
+			// Returns an immutable copy of the line, which is re-used until the line is changed
+			std::shared_ptr<const TextSnapshot::Line> GetSnapshot();
+			// Has to be called whenever a tag opened within this line has been added, removed or changed
+			void InvalidateSnapshotTags();
 			friend FormattedText;
 			friend AnchorPoint;
+			friend LineTree;
+			friend TextTag;
 		private:
+			// Has to be called whenever the contents of the line have changed
+			void SetDirty();
+			// Switches the unformatted line to piece table storage once it has reached the threshold of the target text
+			void UpdateStorage();
 			FormattedText &m_text;
-			util::TSharedHandle<LineStartAnchorPoint> m_startAnchorPoint = nullptr;
-			TextOffset m_formattedStartOffset = 0;
+			TAnchorPointHandle<LineStartAnchorPoint> m_startAnchorPoint = nullptr;
 			TextLine m_formattedLine;
 			TextLine m_unformattedLine;
-			std::vector<CharOffset> m_unformattedCharIndexToFormatted = {};
-			std::vector<CharOffset> m_formattedCharIndexToUnformatted = {};
-			LineIndex m_lineIndex = INVALID_LINE_INDEX;
+			// Unformatted character range covered by a tag component, sorted by offset. Characters
+			// outside of these ranges map linearly between the unformatted and the formatted line.
+			struct CharMapSegment
+			{
+				CharOffset unformattedStart;
+				CharOffset unformattedEnd;
+				// Formatted offset of all characters within the range
+				CharOffset formattedOffset;
+				// Formatted offset of the first character after the range
+				CharOffset formattedNext;
+			};
+			std::vector<CharMapSegment> m_charMapSegments = {};
+			// Absolute unformatted length at the time the line was last formatted
+			TextLength m_unformattedMapLength = 0;
+			// Node of this line in the line tree of the target text, or nullptr if the line hasn't been inserted (yet)
+			LineTree::Node *m_treeNode = nullptr;
 			std::vector<util::TSharedHandle<TextTagComponent>> m_tagComponents = {};
-			std::vector<util::TWeakSharedHandle<AnchorPoint>> m_anchorPoints = {};
+			std::shared_ptr<const TextSnapshot::Line> m_snapshot = nullptr;
+			// Snapshot tags of the tags opened within this line, with offsets relative to the start of the line (see FormattedText::GetSnapshotTags)
+			std::shared_ptr<const std::vector<TextSnapshot::Tag>> m_snapshotTags = nullptr;
 			
 			bool m_bDirty = false;
+			// If true, the line is already contained in the changed lines of the target text (see FormattedText::OnLineDirty)
+			bool m_bSnapshotChangeRecorded = false;
+			// If true, the line had no tags when it was last formatted and the unformatted line is used as formatted line
+			bool m_bUntagged = false;
 		};
 	};
 };
@@ -0,0 +1,142 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __UTIL_FORMATTED_TEXT_LINE_TREE_HPP__
+#define __UTIL_FORMATTED_TEXT_LINE_TREE_HPP__
+
+#include "util_formatted_text_types.hpp"
+#include "util_formatted_text_snapshot.hpp"
+#include <iterator>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <cstddef>
+
+namespace util
+{
+	namespace text
+	{
+		// Balanced (treap) sequence of lines. Every node caches the number of lines and characters
+		// in its subtree, which allows the index and start offset of a line to be derived
+		// in O(log n) instead of having to be stored (and updated) per line. The same sums are used
+		// to map absolute (formatted or unformatted) text offsets back to lines.
+		class LineTree
+		{
+		public:
+			struct Node
+			{
+				PFormattedTextLine line = nullptr;
+				Node *parent = nullptr;
+				Node *left = nullptr;
+				Node *right = nullptr;
+				uint32_t priority = 0u;
+				uint32_t count = 1u;
+				// Absolute lengths of this line (including the new-line character)
+				TextLength length = 0u;
+				TextLength formattedLength = 0u;
+				TextLength subtreeLength = 0u;
+				TextLength subtreeFormattedLength = 0u;
+				// Snapshot of this subtree, which is reused by subsequent snapshots until the subtree has changed
+				std::shared_ptr<const TextSnapshot::Node> snapshot = nullptr;
+			};
+			class Iterator
+			{
+			public:
+				using iterator_category = std::bidirectional_iterator_tag;
+				using value_type = PFormattedTextLine;
+				using difference_type = std::ptrdiff_t;
+				using pointer = const PFormattedTextLine*;
+				using reference = const PFormattedTextLine&;
+
+				Iterator()=default;
+				Iterator(const LineTree &tree,Node *node);
+				reference operator*() const;
+				pointer operator->() const;
+				Iterator &operator++();
+				Iterator operator++(int);
+				Iterator &operator--();
+				Iterator operator--(int);
+				bool operator==(const Iterator &other) const;
+				bool operator!=(const Iterator &other) const;
+			private:
+				const LineTree *m_tree = nullptr;
+				Node *m_node = nullptr;
+			};
+			using iterator = Iterator;
+			using const_iterator = Iterator;
+
+			static LineIndex GetIndex(const Node &node);
+			static TextOffset GetStartOffset(const Node &node);
+			static TextOffset GetFormattedStartOffset(const Node &node);
+			// Has to be called whenever the (formatted or unformatted) length of the line of the specified node has changed
+			static void UpdateLength(Node &node);
+			// Has to be called whenever the contents of the line of the specified node have changed
+			static void InvalidateSnapshot(Node &node);
+			// Returns the node of the next/previous line, or nullptr if there is none
+			static Node *GetNext(Node *node);
+			static Node *GetPrevious(Node *node);
+
+			LineTree()=default;
+			LineTree(const LineTree&)=delete;
+			LineTree &operator=(const LineTree&)=delete;
+			~LineTree();
+
+			Node &Insert(LineIndex lineIdx,const PFormattedTextLine &line);
+			// Inserts a sequence of lines at once. The subtree for the new lines is built
+			// in linear time, which is considerably faster than inserting them one by one.
+			void Insert(LineIndex lineIdx,const PFormattedTextLine *lines,size_t count);
+			PFormattedTextLine Erase(LineIndex lineIdx);
+			// Removes a range of lines in O(log n +count) and returns them in order
+			std::vector<PFormattedTextLine> Erase(LineIndex lineIdx,uint32_t count);
+			void Clear();
+
+			size_t size() const;
+			bool empty() const;
+			TextLength GetLength() const;
+			TextLength GetFormattedLength() const;
+			// Returns the index of the line containing the specified absolute offset, as well as
+			// the offset relative to the start of that line
+			std::optional<std::pair<LineIndex,CharOffset>> FindOffset(TextOffset offset) const;
+			std::optional<std::pair<LineIndex,CharOffset>> FindFormattedOffset(TextOffset offset) const;
+			const PFormattedTextLine &at(size_t lineIdx) const;
+			const PFormattedTextLine &operator[](size_t lineIdx) const;
+			const PFormattedTextLine &front() const;
+			const PFormattedTextLine &back() const;
+			// Returns an iterator to the specified line, or the end iterator if the index is out of range
+			Iterator Find(size_t lineIdx) const;
+			Node *GetRoot() const;
+			Iterator begin() const;
+			Iterator end() const;
+		private:
+			static uint32_t GetCount(const Node *node);
+			static TextLength GetSubtreeLength(const Node *node);
+			static TextLength GetSubtreeFormattedLength(const Node *node);
+			template<TextLength Node::*TLength,TextLength Node::*TSubtreeLength>
+				std::optional<std::pair<LineIndex,CharOffset>> FindOffset(TextOffset offset) const;
+			static void Pull(Node &node);
+			static Node *GetFirst(Node *node);
+			static Node *GetLast(Node *node);
+			static Node *Merge(Node *a,Node *b);
+			static void Split(Node *node,uint32_t count,Node *&outLeft,Node *&outRight);
+			void Destroy(Node *node);
+			void Release(Node *node,std::vector<PFormattedTextLine> &outLines);
+			static void PullSubtree(Node &node);
+			Node *CreateNode(const PFormattedTextLine &line);
+			void FreeNode(Node *node);
+			Node *FindNode(size_t lineIdx) const;
+			uint32_t GeneratePriority();
+			Node *m_root = nullptr;
+			// Nodes are allocated in blocks and recycled through a free list (linked via Node::right),
+			// to avoid a separate heap allocation for every line
+			static constexpr size_t NODE_BLOCK_SIZE = 1'024;
+			std::vector<std::unique_ptr<Node[]>> m_nodeBlocks {};
+			Node *m_freeNodes = nullptr;
+			uint32_t m_seed = 2463534242u;
+			friend Iterator;
+		};
+	};
+};
+
+#endif
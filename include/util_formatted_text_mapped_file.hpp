@@ -0,0 +1,39 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __UTIL_FORMATTED_TEXT_MAPPED_FILE_HPP__
+#define __UTIL_FORMATTED_TEXT_MAPPED_FILE_HPP__
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+namespace util
+{
+	namespace text
+	{
+		// Read-only memory mapping of an entire file. The mapping is released once the last reference to it has been destroyed.
+		class MappedFile
+		{
+		public:
+			// Returns nullptr if the file couldn't be opened
+			static std::shared_ptr<const MappedFile> Open(const std::string &fileName);
+			MappedFile(const MappedFile&)=delete;
+			MappedFile &operator=(const MappedFile&)=delete;
+			~MappedFile();
+			std::string_view GetData() const;
+		private:
+			MappedFile()=default;
+			const char *m_data = nullptr;
+			size_t m_size = 0;
+#ifdef _WIN32
+			void *m_fileHandle = nullptr;
+			void *m_mappingHandle = nullptr;
+#endif
+		};
+	};
+};
+
+#endif
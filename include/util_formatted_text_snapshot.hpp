@@ -0,0 +1,88 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __UTIL_FORMATTED_TEXT_SNAPSHOT_HPP__
+#define __UTIL_FORMATTED_TEXT_SNAPSHOT_HPP__
+
+#include "util_formatted_text_types.hpp"
+#include <sharedutils/util_utf8.hpp>
+#include <optional>
+#include <memory>
+#include <vector>
+#include <string>
+#include <mutex>
+
+namespace util
+{
+	namespace text
+	{
+		class FormattedText;
+		// Immutable copy of the state of a text at the time it was created (see FormattedText::Snapshot).
+		// All methods are const and thread-safe, so a snapshot can be read by any number of threads while the original text
+		// continues to be edited. Lines and tag descriptions that haven't changed are shared with earlier snapshots.
+		class TextSnapshot
+		{
+		public:
+			struct Line
+			{
+				util::Utf8String unformattedText;
+				util::Utf8String formattedText;
+			};
+			struct TagInfo
+			{
+				std::string name;
+				std::string label;
+				std::vector<std::string> attributes;
+			};
+			struct Tag
+			{
+				std::shared_ptr<const TagInfo> info;
+				// Range of the tag including its tag components. The ranges of unclosed tags extend until the end of the text (UNTIL_THE_END).
+				TextOffset outerOffset;
+				TextLength outerLength;
+				// Range of the tag contents
+				TextOffset innerOffset;
+				TextLength innerLength;
+				bool closed;
+			};
+
+			// Node of the persistent (balanced) line tree of a snapshot. Subtrees that haven't changed are shared between snapshots,
+			// so creating a new snapshot only requires rebuilding the paths to the lines that have changed.
+			struct Node;
+
+			TextSnapshot(const TextSnapshot&)=delete;
+			TextSnapshot &operator=(const TextSnapshot&)=delete;
+
+			uint32_t GetLineCount() const;
+			uint32_t GetCharCount() const;
+			const Line &GetLine(LineIndex lineIdx) const;
+			std::optional<TextOffset> GetTextCharOffset(LineIndex lineIdx,CharOffset charOffset) const;
+			std::optional<std::pair<LineIndex,CharOffset>> GetRelativeCharOffset(TextOffset absCharOffset) const;
+			util::Utf8String Substr(TextOffset startOffset,TextLength len) const;
+
+			// The full strings are only built once they're requested for the first time
+			const util::Utf8String &GetUnformattedText() const;
+			const util::Utf8String &GetFormattedText() const;
+
+			// Tags are ordered by their outer offset. The list is only built once it's requested for the first time.
+			const std::vector<Tag> &GetTags() const;
+			// Returns all tags overlapping the specified range, ordered by their outer offset. Unclosed tags are treated as extending to the end of the text.
+			std::vector<Tag> QueryTags(TextOffset startOffset,TextLength len) const;
+		private:
+			TextSnapshot()=default;
+			std::shared_ptr<const Node> m_root = nullptr;
+
+			mutable std::once_flag m_unformattedTextFlag {};
+			mutable std::once_flag m_formattedTextFlag {};
+			mutable std::once_flag m_tagsFlag {};
+			mutable util::Utf8String m_unformattedText {};
+			mutable util::Utf8String m_formattedText {};
+			mutable std::vector<Tag> m_tags {};
+			friend FormattedText;
+		};
+		using PTextSnapshot = std::shared_ptr<const TextSnapshot>;
+	};
+};
+
+#endif
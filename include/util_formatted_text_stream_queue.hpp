@@ -0,0 +1,42 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __UTIL_FORMATTED_TEXT_STREAM_QUEUE_HPP__
+#define __UTIL_FORMATTED_TEXT_STREAM_QUEUE_HPP__
+
+#include <atomic>
+#include <string>
+
+namespace util
+{
+	namespace text
+	{
+		// Lock-free queue of text chunks with any number of producers and a single consumer.
+		// Producers never block: Pushing a chunk only requires a single compare-and-swap (retried under contention).
+		class TextStreamQueue
+		{
+		public:
+			TextStreamQueue()=default;
+			TextStreamQueue(const TextStreamQueue&)=delete;
+			TextStreamQueue &operator=(const TextStreamQueue&)=delete;
+			~TextStreamQueue();
+			// Thread-safe
+			void Push(std::string chunk);
+			bool IsEmpty() const;
+			// Removes all queued chunks and appends them to outText in the order they were pushed in. May only be called by the consumer.
+			// Returns the number of chunks that were removed.
+			size_t Drain(std::string &outText);
+		private:
+			struct Chunk
+			{
+				std::string text;
+				Chunk *next;
+			};
+			// Most recently pushed chunk
+			std::atomic<Chunk*> m_head = nullptr;
+		};
+	};
+};
+
+#endif
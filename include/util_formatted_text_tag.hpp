@@ -6,6 +6,7 @@
 #define __UTIL_FORMATTED_TEXT_TAG_HPP__
 
 #include "util_formatted_text_anchor_point.hpp"
+#include "util_formatted_text_snapshot.hpp"
 #include <sharedutils/util_shared_handle.hpp>
 #include <sharedutils/util_utf8.hpp>
 #include <optional>
@@ -16,10 +17,12 @@ namespace util
 	namespace text
 	{
 		class FormattedText;
+		class FormattedTextLine;
+		class TagTree;
 		class TextTagComponent
 		{
 		public:
-			TextTagComponent(const std::string &tagName,const util::TSharedHandle<AnchorPoint> &startAnchor,const util::TSharedHandle<AnchorPoint> &endAnchor);
+			TextTagComponent(const std::string &tagName,const AnchorPointHandle &startAnchor,const AnchorPointHandle &endAnchor);
 			TextTagComponent(const TextTagComponent&)=delete;
 			TextTagComponent &operator=(const TextTagComponent&)=delete;
 
@@ -42,8 +45,8 @@ namespace util
 			const std::string &GetTagName() const;
 		private:
 			std::string m_tagName = "";
-			util::TSharedHandle<AnchorPoint> m_startAnchor = {};
-			util::TSharedHandle<AnchorPoint> m_endAnchor = {};
+			AnchorPointHandle m_startAnchor = {};
+			AnchorPointHandle m_endAnchor = {};
 		};
 
 		class TextOpeningTagComponent
@@ -52,7 +55,7 @@ namespace util
 		public:
 			TextOpeningTagComponent(
 				const std::string &tagName,const std::string &label,const std::vector<std::string> &attributes,
-				const util::TSharedHandle<AnchorPoint> &startAnchor,const util::TSharedHandle<AnchorPoint> &endAnchor
+				const AnchorPointHandle &startAnchor,const AnchorPointHandle &endAnchor
 			);
 			const std::string &GetLabel() const;
 			const std::vector<std::string> &GetTagAttributes() const;
@@ -87,10 +90,16 @@ namespace util
 			const TextTagComponent *GetClosingTagComponent() const;
 			TextTagComponent *GetClosingTagComponent();
 		private:
+			// Has to be called whenever the tag has been added, removed or changed, so it's updated in the next snapshot
+			void InvalidateSnapshot();
 			util::TSharedHandle<TextTagComponent> m_openingTag = {};
 			util::TSharedHandle<TextTagComponent> m_closingTag = {};
 			std::weak_ptr<const FormattedText> m_wpText = {};
+			std::shared_ptr<const TextSnapshot::TagInfo> m_snapshotInfo = nullptr;
+			// Line whose snapshot tags contain this tag (see FormattedText::GetSnapshotTags)
+			std::weak_ptr<FormattedTextLine> m_wpSnapshotLine = {};
 			friend FormattedText;
+			friend TagTree;
 		};
 		using PTextTag = std::shared_ptr<TextTag>;
 	};
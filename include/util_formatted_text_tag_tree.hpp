@@ -0,0 +1,146 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __UTIL_FORMATTED_TEXT_TAG_TREE_HPP__
+#define __UTIL_FORMATTED_TEXT_TAG_TREE_HPP__
+
+#include "util_formatted_text_types.hpp"
+#include "util_formatted_text_anchor_point.hpp"
+#include <sharedutils/util_shared_handle.hpp>
+#include <iterator>
+#include <vector>
+#include <cstddef>
+
+namespace util
+{
+	namespace text
+	{
+		class TextTag;
+		// Balanced (treap) sequence of tags, generally ordered by the start offset of their opening tag components.
+		// Every node caches the tags with the lowest and highest offsets in its subtree, which allows the tags
+		// overlapping a text range to be found in O(log n +k) instead of having to check every tag.
+		// The offsets themselves are never stored, they're always derived from the anchor points of the tags.
+		// Text changes shift these offsets, but usually keep their relative order intact, in which case the
+		// cached nodes remain correct. If only the ranges of individual tags have changed (e.g. because anchor points
+		// were removed), Refresh updates their paths. If the order may have changed, Invalidate has to be called and
+		// the cache is rebuilt on the next lookup.
+		class TagTree
+		{
+		public:
+			struct Node
+			{
+				util::TSharedHandle<TextTag> tag = {};
+				Node *parent = nullptr;
+				Node *left = nullptr;
+				Node *right = nullptr;
+				uint32_t priority = 0u;
+				uint32_t count = 1u;
+				// Number of active volatile ranges this tag is part of
+				uint32_t volatileCount = 0u;
+				// Number of invalid tags in this subtree
+				uint32_t invalidCount = 0u;
+				// Valid tags in this subtree with the lowest and highest offsets covered by their components,
+				// as well as the highest start offset
+				Node *minOffset = nullptr;
+				Node *maxOffset = nullptr;
+				Node *maxStartOffset = nullptr;
+			};
+			class Iterator
+			{
+			public:
+				using iterator_category = std::bidirectional_iterator_tag;
+				using value_type = util::TSharedHandle<TextTag>;
+				using difference_type = std::ptrdiff_t;
+				using pointer = const util::TSharedHandle<TextTag>*;
+				using reference = const util::TSharedHandle<TextTag>&;
+
+				Iterator()=default;
+				Iterator(const TagTree &tree,Node *node);
+				reference operator*() const;
+				pointer operator->() const;
+				Iterator &operator++();
+				Iterator operator++(int);
+				Iterator &operator--();
+				Iterator operator--(int);
+				bool operator==(const Iterator &other) const;
+				bool operator!=(const Iterator &other) const;
+			private:
+				const TagTree *m_tree = nullptr;
+				Node *m_node = nullptr;
+				friend TagTree;
+			};
+			using iterator = Iterator;
+			using const_iterator = Iterator;
+
+			TagTree()=default;
+			TagTree(const TagTree&)=delete;
+			TagTree &operator=(const TagTree&)=delete;
+			~TagTree();
+
+			// Inserts the tag in front of the first valid tag that starts after it
+			Iterator Insert(const util::TSharedHandle<TextTag> &tag);
+			// Inserts a sequence of tags ordered by their start offsets, none of which may overlap any existing tags.
+			// The tags are added as a single subtree, which is considerably faster than inserting them one by one.
+			void Insert(const std::vector<util::TSharedHandle<TextTag>> &tags);
+			// Returns the iterator following the erased tag
+			Iterator Erase(Iterator it);
+			void Clear();
+			// Has to be called whenever the relative order of the tag offsets may have changed
+			void Invalidate();
+			// Updates the cached offsets along the path of a tag whose range has changed without affecting the order of the tags,
+			// e.g. because some of its components have been removed
+			void Refresh(Iterator it);
+			// Detached anchor points don't move along with the text, so the offsets of all tags overlapping them can't be relied upon
+			// until they've been re-attached. These tags are never skipped by lookups in the meantime. Calls can be nested.
+			void BeginVolatileOffsets(const std::vector<AnchorPointHandle> &anchorPoints);
+			void EndVolatileOffsets();
+			// Returns all tags (in order) whose components may cover an offset within [startOffset,endOffset]. Unclosed tags are treated as
+			// extending to the end of the text. The caller is expected to check the exact tag ranges.
+			std::vector<Iterator> Query(TextOffset startOffset,TextOffset endOffset,bool includeInvalidTags=false) const;
+
+			size_t size() const;
+			bool empty() const;
+			Iterator begin() const;
+			Iterator end() const;
+		private:
+			struct Range
+			{
+				TextOffset start;
+				TextOffset minOffset;
+				TextOffset maxOffset;
+			};
+			static bool GetRange(const Node *node,Range &outRange);
+			// Same as GetRange, but fails for tags with volatile offsets
+			static bool GetKnownRange(const Node *node,Range &outRange);
+			template<TextOffset Range::*TOffset,bool TMax>
+				static Node *SelectNode(Node *a,Node *b);
+			static uint32_t GetCount(const Node *node);
+			static uint32_t GetInvalidCount(const Node *node);
+			static void Pull(Node &node);
+			static void PullSubtree(Node &node);
+			static void PullPath(Node &node);
+			static Node *GetFirst(Node *node);
+			static Node *GetLast(Node *node);
+			static Node *GetNext(Node *node);
+			static Node *GetPrevious(Node *node);
+			static uint32_t GetIndex(const Node &node);
+			static Node *Merge(Node *a,Node *b);
+			static void Split(Node *node,uint32_t count,Node *&outLeft,Node *&outRight);
+			static void Destroy(Node *node);
+			static void Query(Node *node,TextOffset startOffset,TextOffset endOffset,bool includeInvalidTags,const TagTree &tree,std::vector<Iterator> &outTags);
+			static bool FindFirstAfter(Node *node,TextOffset offset,uint32_t &outIdx);
+			// Snapshots cache the tags of each line, which have to be updated whenever a tag is inserted or erased
+			static void InvalidateSnapshot(const util::TSharedHandle<TextTag> &tag);
+			void Update() const;
+			uint32_t GeneratePriority();
+			Node *m_root = nullptr;
+			uint32_t m_seed = 2463534242u;
+			mutable bool m_bDirty = false;
+			std::vector<std::vector<Node*>> m_volatileNodes {};
+			friend Iterator;
+		};
+	};
+};
+
+#endif
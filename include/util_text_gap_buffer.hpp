@@ -0,0 +1,49 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __UTIL_TEXT_GAP_BUFFER_HPP__
+#define __UTIL_TEXT_GAP_BUFFER_HPP__
+
+#include "util_formatted_text_types.hpp"
+#include <string>
+#include <string_view>
+#include <optional>
+
+namespace util
+{
+	namespace text
+	{
+		// Storage for the characters of a single line with an unused gap at the position of the last edit.
+		// Consecutive insertions and deletions at the gap only have to write into (or widen) the gap, moving the
+		// gap somewhere else only moves the characters between the old and the new position.
+		class GapBuffer
+		{
+		public:
+			GapBuffer(std::string_view str);
+			TextLength GetLength() const;
+			bool Insert(CharOffset charOffset,std::string_view str);
+			// Returns the number of erased characters
+			TextLength Erase(CharOffset startOffset,TextLength len,std::string *outErasedString=nullptr);
+			// Only available if every character is a single byte, otherwise the line has to be flattened first
+			std::optional<int32_t> At(CharOffset offset) const;
+			std::string ToString() const;
+		private:
+			bool IsSingleByte() const;
+			std::string_view GetDataBeforeGap() const;
+			std::string_view GetDataAfterGap() const;
+			// Returns the offset of the character within the buffer, excluding the gap
+			size_t GetByteOffset(CharOffset charOffset) const;
+			void MoveGap(CharOffset charOffset);
+			void GrowGap(size_t minSize);
+
+			std::string m_buffer;
+			size_t m_gapStart = 0;
+			size_t m_gapEnd = 0;
+			CharOffset m_gapCharOffset = 0;
+			TextLength m_length = 0;
+		};
+	};
+};
+
+#endif
@@ -7,6 +7,8 @@
 
 #include "util_formatted_text_config.hpp"
 #include "util_formatted_text_types.hpp"
+#include "util_text_piece_table.hpp"
+#include "util_text_gap_buffer.hpp"
 #include <sharedutils/util_utf8.hpp>
 #include <string>
 #include <string_view>
@@ -31,11 +33,22 @@ namespace util
 				Newline = Tag<<1u
 			};
 
-			TextLine(const std::string &line="");
+			TextLine(std::string line="");
+			// Creates a line that references the specified characters instead of owning a copy of them. The source keeps the characters alive
+			// and is released once the line has been modified for the first time (or GetText has been called).
+			TextLine(const std::shared_ptr<const void> &source,std::string_view data);
 			TextLength GetLength() const;
 			// Returns length including new-line character
 			TextLength GetAbsLength() const;
 			const util::Utf8String &GetText() const;
+			// Returns the raw characters of the line without creating a copy of referenced lines
+			std::string_view GetData() const;
+			bool IsView() const;
+			bool IsPieceTable() const;
+			bool IsGapBuffer() const;
+			// Returns the characters of the range as a sequence of contiguous ranges. Lines backed by a piece table
+			// return their pieces, without assembling the line. The ranges remain valid until the line is changed.
+			std::vector<std::string_view> GetSegments(CharOffset offset,TextLength len=UNTIL_THE_END) const;
 			int32_t At(CharOffset offset) const;
 			std::optional<int32_t> GetChar(CharOffset offset) const;
 			void Reserve(TextLength len);
@@ -57,10 +70,31 @@ namespace util
 			void Clear();
 			void AppendCharacter(int32_t c);
 			bool InsertString(const util::Utf8StringView &str,CharOffset charOffset);
+			// Moves the characters within the range to the target offset, which is relative to the line without the moved range
+			bool Move(CharOffset startOffset,TextLength len,CharOffset targetOffset);
+			// Stores the line in a piece table, which turns insertions, deletions and moves into operations on the piece list.
+			// Reading the line as a whole assembles a copy of it, which is kept until the line is changed.
+			void EnablePieceTable();
 			friend FormattedTextLine;
 			friend FormattedText;
 		private:
-			util::Utf8String m_line = "";
+			// Replaces the referenced characters with an owned copy, flattens the gap buffer or assembles the characters of the piece table
+			void Materialize() const;
+			// Switches to a gap buffer if the edit continues where the previous one ended. Appending to the end of the line
+			// is cheap for contiguous storage as well, so it doesn't count.
+			void UpdateGapBuffer(CharOffset startOffset,TextLength len);
+			mutable util::Utf8String m_line = "";
+			// Points to the referenced characters and keeps their source alive
+			mutable std::shared_ptr<const char> m_view = nullptr;
+			uint32_t m_viewSize = 0;
+			CharOffset m_viewLength = 0;
+			std::unique_ptr<PieceTable> m_pieceTable = nullptr;
+			// If true, m_line contains the characters of the piece table
+			mutable bool m_pieceTableAssembled = false;
+			// Used while the line is edited repeatedly at the same position, until the line is read as a whole
+			mutable std::unique_ptr<GapBuffer> m_gapBuffer = nullptr;
+			// Offset at which the last edit ended, or LAST_CHAR if the line has been read since
+			mutable CharOffset m_lastEditOffset = LAST_CHAR;
 			std::vector<CharFlags> m_charFlags = {};
 		};
 		using PTextLine = std::shared_ptr<TextLine>;
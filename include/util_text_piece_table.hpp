@@ -0,0 +1,67 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __UTIL_TEXT_PIECE_TABLE_HPP__
+#define __UTIL_TEXT_PIECE_TABLE_HPP__
+
+#include "util_formatted_text_types.hpp"
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <optional>
+
+namespace util
+{
+	namespace text
+	{
+		// Storage for the characters of a single line, consisting of the original (immutable) characters, an append-only buffer
+		// for inserted characters and a list of pieces referencing ranges of both. Inserting, erasing and moving characters
+		// only changes the piece list, none of the existing characters have to be copied or moved.
+		class PieceTable
+		{
+		public:
+			// The original characters are referenced, not copied. The source keeps them alive.
+			PieceTable(const std::shared_ptr<const void> &source,std::string_view original);
+			TextLength GetLength() const;
+			size_t GetPieceCount() const;
+			bool Insert(CharOffset charOffset,std::string_view str);
+			// Returns the number of erased characters
+			TextLength Erase(CharOffset startOffset,TextLength len,std::string *outErasedString=nullptr);
+			// Moves the characters within the range to the target offset. The target offset is relative to the
+			// characters *without* the moved range.
+			bool Move(CharOffset startOffset,TextLength len,CharOffset targetOffset);
+			// Returns the contiguous ranges that make up the characters of the specified range, in order. The ranges remain
+			// valid until the piece table is changed.
+			std::vector<std::string_view> GetSegments(CharOffset offset,TextLength len=UNTIL_THE_END) const;
+			std::string ToString() const;
+
+			static size_t GetByteOffset(std::string_view str,CharOffset charOffset);
+			static CharOffset GetCharLength(std::string_view str);
+		private:
+			struct Piece
+			{
+				uint32_t byteOffset;
+				uint32_t byteSize;
+				CharOffset length;
+				bool added;
+			};
+			std::string_view GetData(const Piece &piece) const;
+			// Splits the piece containing the specified offset, so that a piece starts at the offset.
+			// Returns the index of that piece.
+			size_t Split(CharOffset charOffset);
+			// Rebuilds the table from its current contents once the buffers are mostly unused or the piece list has grown too large
+			void Compact();
+
+			std::shared_ptr<const char> m_original = nullptr;
+			size_t m_originalSize = 0;
+			std::string m_added;
+			std::vector<Piece> m_pieces;
+			TextLength m_length = 0;
+			size_t m_byteSize = 0;
+		};
+	};
+};
+
+#endif
@@ -5,14 +5,20 @@
 #include "util_formatted_text.hpp"
 #include "util_formatted_text_anchor_point.hpp"
 #include "util_formatted_text_tag.hpp"
+#include "util_formatted_text_mapped_file.hpp"
 #include <sstream>
 #include <cstring>
 #include <cassert>
 #include <algorithm>
+#include <string_view>
 #ifdef ENABLE_FORMATTED_TEXT_UNIT_TESTS
 	#include <functional>
 	#include <iostream>
 	#include <unordered_set>
+	#include <fstream>
+	#include <filesystem>
+	#include <thread>
+	#include <atomic>
 #endif
 
 using namespace util::text;
@@ -23,12 +29,54 @@ std::shared_ptr<FormattedText> FormattedText::Create(const util::Utf8StringView
 	ftext->AppendText(text);
 	return ftext;
 }
+FormattedText::~FormattedText()
+{
+	// The lines and any remaining handles keep the pool alive until their anchor points have been released
+	if(m_anchorPointPool)
+		m_anchorPointPool->RemoveReference();
+}
+AnchorPointPool &FormattedText::GetAnchorPointPool()
+{
+	if(m_anchorPointPool == nullptr)
+		m_anchorPointPool = AnchorPointPool::Create();
+	return *m_anchorPointPool;
+}
 
 void FormattedText::SetText(const util::Utf8StringView &text)
 {
+	OperationGuard operation {*this};
 	Clear();
+	// The new text can't be undone, the history starts with it
+	HistorySuspension suspension {*this};
 	AppendText(text);
 }
+bool FormattedText::LoadFromFile(const std::string &fileName)
+{
+	auto file = MappedFile::Open(fileName);
+	if(file == nullptr)
+		return false;
+	OperationGuard operation {*this};
+	Clear();
+	HistorySuspension suspension {*this}; // See SetText
+	auto data = file->GetData();
+	if(data.empty())
+		return true;
+	// The lines reference the mapped file until they're modified, so the file contents don't have to be copied
+	std::vector<PFormattedTextLine> lines {};
+	lines.reserve(std::count(data.begin(),data.end(),'\n') +1);
+	for(;;)
+	{
+		auto lineEnd = data.find('\n');
+		lines.push_back(FormattedTextLine::Create(*this,TextLine{file,data.substr(0,lineEnd)}));
+		if(lineEnd == std::string_view::npos)
+			break;
+		data = data.substr(lineEnd +1);
+	}
+	InsertLines(lines.data(),lines.size(),0);
+	if(m_textLines.size() > m_maxLineCount)
+		PopFrontLines(m_textLines.size() -m_maxLineCount);
+	return true;
+}
 util::Utf8String FormattedText::Substr(TextOffset startOffset,TextLength len) const
 {
 	auto relOffset = GetRelativeCharOffset(startOffset);
@@ -39,7 +87,7 @@ util::Utf8String FormattedText::Substr(TextOffset startOffset,TextLength len) co
 	auto lineIndex = relOffset->first;
 	auto relCharOffset = relOffset->second;
 	auto first = true;
-	while(lineIndex < m_textLines.size() && len > 0)
+	for(auto it=m_textLines.Find(lineIndex);it!=m_textLines.end() && len > 0;++it)
 	{
 		if(first)
 			first = false;
@@ -48,23 +96,27 @@ util::Utf8String FormattedText::Substr(TextOffset startOffset,TextLength len) co
 			--len;
 			result += '\n';
 		}
-		auto &line = *m_textLines.at(lineIndex);
+		auto &line = **it;
 
-		auto substr = line.Substr(startOffset,len);
+		auto substr = line.Substr(relCharOffset,len);
 		result += substr;
 
 		len -= substr.length();
-		startOffset = 0;
-		++lineIndex;
+		relCharOffset = 0;
 	}
 	return result;
 }
 void FormattedText::Clear()
 {
-	m_textLines.clear();
-	m_tags.clear();
-	m_unformattedOffsetToLineIndex.clear();
-	m_formattedOffsetToLineIndex.clear();
+	// The pending lines are destroyed along with the text
+	m_lineChanges.clear();
+	m_batch.pendingTagLines.clear();
+	m_batch.addedLines.clear();
+	m_batch.changedLines.clear();
+	m_textInfo.snapshotChangedLines.clear();
+	m_textLines.Clear();
+	m_tags.Clear();
+	m_history.Clear();
 	m_bDirty = true;
 	if(m_callbacks.onTextCleared)
 		m_callbacks.onTextCleared();
@@ -75,15 +127,15 @@ bool FormattedText::operator==(const util::Utf8StringView &text) const
 {
 	TextOffset offset = 0;
 	auto it = text.begin();
-	for(auto lineIdx=decltype(m_textLines.size()){0u};lineIdx<m_textLines.size();++lineIdx)
+	for(auto itLine=m_textLines.begin();itLine!=m_textLines.end();)
 	{
-		auto &line = m_textLines.at(lineIdx);
-		auto &lineText = line->GetUnformattedLine().GetText();
-		if(offset >= text.length() || !util::utf8_strncmp(text.c_str() +offset,lineText.c_str(),lineText.length()))
+		auto &line = *itLine;
+		auto lineText = line->GetUnformattedLine().GetData();
+		if(offset >= text.length() || !util::utf8_strncmp(text.c_str() +offset,lineText.data(),line->GetLength()))
 			return false;
 		offset += line->GetAbsLength();
 		it += line->GetAbsLength();
-		if(lineIdx == m_textLines.size() -1)
+		if(++itLine == m_textLines.end())
 		{
 			if((offset -1) != text.length())
 				return false;
@@ -93,13 +145,13 @@ bool FormattedText::operator==(const util::Utf8StringView &text) const
 }
 bool FormattedText::operator!=(const util::Utf8StringView &text) const {return operator==(text) == false;}
 FormattedText::operator util::Utf8String() const {return GetUnformattedText();}
-util::TSharedHandle<AnchorPoint> FormattedText::CreateAnchorPoint(LineIndex lineIdx,CharOffset charOffset,bool allowOutOfBounds)
+AnchorPointHandle FormattedText::CreateAnchorPoint(LineIndex lineIdx,CharOffset charOffset,bool allowOutOfBounds)
 {
 	if(lineIdx >= m_textLines.size())
 		return {};
 	return m_textLines.at(lineIdx)->CreateAnchorPoint(charOffset,allowOutOfBounds);
 }
-util::TSharedHandle<AnchorPoint> FormattedText::CreateAnchorPoint(TextOffset offset,bool allowOutOfBounds)
+AnchorPointHandle FormattedText::CreateAnchorPoint(TextOffset offset,bool allowOutOfBounds)
 {
 	auto relOffset = GetRelativeCharOffset(offset);
 	if(relOffset.has_value() == false)
@@ -109,11 +161,6 @@ util::TSharedHandle<AnchorPoint> FormattedText::CreateAnchorPoint(TextOffset off
 
 std::optional<TextOffset> FormattedText::GetFormattedTextOffset(TextOffset offset) const
 {
-	/*if(offset >= m_unformattedOffsetToLineIndex.size())
-		return {};
-	auto lineIndex = m_unformattedOffsetToLineIndex.at(offset);
-	auto &pLine = m_textLines.at(lineIndex);
-	return pLine->GetFormattedCharOffset(offset -pLine->GetFormattedStartOffset());*/
 	auto relOffset = GetRelativeCharOffset(offset);
 	if(relOffset.has_value() == false)
 		return {};
@@ -122,68 +169,47 @@ std::optional<TextOffset> FormattedText::GetFormattedTextOffset(TextOffset offse
 }
 std::optional<TextOffset> FormattedText::GetUnformattedTextOffset(TextOffset offset) const
 {
-	/*if(offset >= m_formattedOffsetToLineIndex.size())
+	auto relOffset = m_textLines.FindFormattedOffset(offset);
+	if(relOffset.has_value() == false)
 		return {};
-	auto lineIndex = m_formattedOffsetToLineIndex.at(offset);
-	auto &pLine = m_textLines.at(lineIndex);
-	return pLine->GetUnformattedCharOffset(offset -pLine->GetStartOffset());*/
-	for(auto &line : m_textLines)
-	{
-		auto len = line->GetAbsFormattedLength();
-		if(offset >= len)
-		{
-			offset -= len;
-			continue;
-		}
-		return line->GetStartOffset() +line->GetUnformattedCharOffset(offset);
-	}
-	return {};
+	auto &line = m_textLines.at(relOffset->first);
+	return line->GetStartOffset() +line->GetUnformattedCharOffset(relOffset->second);
 }
 
 const util::Utf8String &FormattedText::GetUnformattedText() const
 {
 	UpdateTextInfo();
+	if(m_textInfo.unformattedTextDirty)
+	{
+		m_textInfo.unformattedTextDirty = false;
+		auto &text = m_textInfo.unformattedText;
+		text.clear();
+		for(auto it=m_textLines.begin();it!=m_textLines.end();++it)
+		{
+			if(it != m_textLines.begin())
+				text += '\n';
+			text += (*it)->GetUnformattedLine().Substr(0);
+		}
+	}
 	return m_textInfo.unformattedText;
 }
 
 const util::Utf8String &FormattedText::GetFormattedText() const
 {
 	UpdateTextInfo();
-	return m_textInfo.formattedText;
-}
-
-void FormattedText::UpdateTextOffsets(LineIndex lineStartIdx)
-{
-	auto &lines = GetLines();
-	TextOffset formattedOffset = 0;
-	TextOffset unformattedOffset = 0;
-	if(lineStartIdx > 0)
-	{
-		auto &prevLine = m_textLines.at(lineStartIdx -1);
-		unformattedOffset = prevLine->GetStartOffset() +prevLine->GetAbsLength();
-		formattedOffset = prevLine->GetFormattedStartOffset() +prevLine->GetAbsFormattedLength();
-	}
-	for(auto lineIndex=lineStartIdx;lineIndex<m_textLines.size();++lineIndex)
+	if(m_textInfo.formattedTextDirty)
 	{
-		auto &line = m_textLines.at(lineIndex);
-		line->m_formattedStartOffset = formattedOffset;
-		auto len = line->GetAbsFormattedLength();
-		auto end = formattedOffset +len;
-		if(m_formattedOffsetToLineIndex.size() < end)
-			m_formattedOffsetToLineIndex.resize(std::max(end,formattedOffset +500));
-		std::fill(m_formattedOffsetToLineIndex.begin() +formattedOffset,m_formattedOffsetToLineIndex.begin() +formattedOffset +len,lineIndex);
-		formattedOffset += len;
-
-		auto startOffset = line->GetStartOffset();
-		len = line->GetAbsLength();
-		end = startOffset +len;
-		if(m_unformattedOffsetToLineIndex.size() < end)
-			m_unformattedOffsetToLineIndex.resize(std::max(end,startOffset +500));
-		std::fill(m_unformattedOffsetToLineIndex.begin() +startOffset,m_unformattedOffsetToLineIndex.begin() +startOffset +len,lineIndex);
-		unformattedOffset += len;
+		m_textInfo.formattedTextDirty = false;
+		auto &text = m_textInfo.formattedText;
+		text.clear();
+		for(auto it=m_textLines.begin();it!=m_textLines.end();++it)
+		{
+			if(it != m_textLines.begin())
+				text += '\n';
+			text += (*it)->GetFormattedLine().Substr(0);
+		}
 	}
-	m_formattedOffsetToLineIndex.resize(formattedOffset);
-	m_unformattedOffsetToLineIndex.resize(unformattedOffset);
+	return m_textInfo.formattedText;
 }
 
 void FormattedText::UpdateTextInfo() const
@@ -191,32 +217,14 @@ void FormattedText::UpdateTextInfo() const
 	if(m_bDirty == false)
 		return;
 	m_bDirty = false;
-	m_textInfo.lineCount = 0u;
-	m_textInfo.charCount = 0u;
-	m_textInfo.unformattedText.clear();
-	m_textInfo.formattedText.clear();
-	auto &lines = GetLines();
-	for(auto &line : lines)
-	{
-		++m_textInfo.lineCount;
-		m_textInfo.charCount += line->GetAbsLength();
-		m_textInfo.unformattedText += line->GetUnformattedLine().GetText();
-		m_textInfo.formattedText += line->GetFormattedLine().GetText();
-		if(m_textInfo.lineCount != lines.size())
-		{
-			m_textInfo.unformattedText += '\n';
-			m_textInfo.formattedText += '\n';
-		}
-	}
+	m_textInfo.unformattedTextDirty = true;
+	m_textInfo.formattedTextDirty = true;
+	m_textInfo.snapshot = nullptr;
 }
 
 std::optional<std::pair<LineIndex,CharOffset>> FormattedText::GetRelativeCharOffset(TextOffset absCharOffset) const
 {
-	if(absCharOffset >= m_unformattedOffsetToLineIndex.size())
-		return {};
-	auto lineIdx = m_unformattedOffsetToLineIndex.at(absCharOffset);
-	auto &pLine = m_textLines.at(lineIdx);
-	return {{lineIdx,absCharOffset -pLine->GetStartOffset()}};
+	return m_textLines.FindOffset(absCharOffset);
 }
 std::optional<TextOffset> FormattedText::GetTextCharOffset(LineIndex lineIdx,CharOffset charOffset) const
 {
@@ -241,25 +249,35 @@ std::optional<char> FormattedText::GetChar(TextOffset absCharOffset) const
 		return {};
 	return GetChar(relCharOffset->first,relCharOffset->second);
 }
-const std::vector<PFormattedTextLine> &FormattedText::GetLines() const {return m_textLines;}
+const LineTree &FormattedText::GetLines() const {return m_textLines;}
 FormattedTextLine *FormattedText::GetLine(LineIndex lineIdx) const
 {
 	if(lineIdx >= m_textLines.size())
 		return nullptr;
 	return m_textLines.at(lineIdx).get();
 }
-uint32_t FormattedText::GetLineCount() const
-{
-	UpdateTextInfo();
-	return m_textInfo.lineCount;
-}
-uint32_t FormattedText::GetCharCount() const
+uint32_t FormattedText::GetLineCount() const {return m_textLines.size();}
+uint32_t FormattedText::GetCharCount() const {return m_textLines.GetLength();}
+const TagTree &FormattedText::GetTags() const {return const_cast<FormattedText*>(this)->GetTags();}
+TagTree &FormattedText::GetTags() {return m_tags;}
+std::vector<util::TSharedHandle<TextTag>> FormattedText::QueryTags(TextOffset startOffset,TextLength len) const
 {
-	UpdateTextInfo();
-	return m_textInfo.charCount;
+	std::vector<util::TSharedHandle<TextTag>> tags {};
+	if(len == 0)
+		return tags;
+	auto endOffset = (len == UNTIL_THE_END) ? std::numeric_limits<TextOffset>::max() : (startOffset +len -1);
+	for(auto &it : m_tags.Query(startOffset,endOffset))
+	{
+		auto &hTag = *it;
+		auto tagRange = hTag->GetOuterRange();
+		if(tagRange.has_value() == false || tagRange->first > endOffset)
+			continue;
+		if(hTag->IsClosed() && (tagRange->first +tagRange->second -1) < startOffset)
+			continue;
+		tags.push_back(hTag);
+	}
+	return tags;
 }
-const std::vector<util::TSharedHandle<TextTag>> &FormattedText::GetTags() const {return const_cast<FormattedText*>(this)->GetTags();}
-std::vector<util::TSharedHandle<TextTag>> &FormattedText::GetTags() {return m_tags;}
 void FormattedText::SetTagsEnabled(bool tagsEnabled)
 {
 	if(tagsEnabled)
@@ -285,30 +303,19 @@ bool FormattedText::ShouldPreserveTagsOnLineRemoval() const
 
 void FormattedText::RemoveLine(LineIndex lineIdx,bool preserveTags)
 {
+	OperationGuard operation {*this};
 	if(lineIdx >= m_textLines.size())
 		return;
 	auto &line = *m_textLines.at(lineIdx);
-	FormattedTextLine *nextLine = nullptr;
-	if(lineIdx < m_textLines.size() -1)
-		nextLine = m_textLines.at(lineIdx +1).get();
-
-	if(lineIdx > 1)
-	{
-		// Link start anchor points of previous and next line
-		auto &prevLine = *m_textLines.at(lineIdx -1);
-		auto &prevLineAnchorStartPoint = prevLine.GetStartAnchorPoint();
-		prevLineAnchorStartPoint.ClearPreviousLineAnchorStartPoint();
-		if(nextLine)
-			prevLineAnchorStartPoint.SetPreviousLineAnchorStartPoint(nextLine->GetStartAnchorPoint());
-	}
-	// If this line is the first line, the next line's start anchor point's parent will be
-	// cleared automatically, so we don't have to do anything about it
+	auto *nextLine = line.GetNextLine();
 
 	// Find tags located in removed line, these will have to be moved into the next
 	// or previous line
 	util::Utf8String strTagComponents {};
 	if(preserveTags == true && ShouldPreserveTagsOnLineRemoval())
 	{
+		if(m_batch.pendingTagLines.find(&line) != m_batch.pendingTagLines.end())
+			ParsePendingTags(lineIdx +1);
 		for(auto &tagComponent : line.GetTagComponents())
 			strTagComponents += tagComponent->GetTagString(*this);
 
@@ -321,29 +328,18 @@ void FormattedText::RemoveLine(LineIndex lineIdx,bool preserveTags)
 		}
 	}
 
-	auto pline = m_textLines.at(lineIdx);
-	m_textLines.erase(m_textLines.begin() +lineIdx);
-	for(auto i=lineIdx;i<m_textLines.size();++i)
-	{
-		auto &line = *m_textLines.at(i);
-		line.SetIndex(line.GetIndex() -1);
-	}
+	// Tags with components in this line become invalid
+	auto removedTags = FindLineTags(lineIdx,1);
 
-	// The anchor points for the subsequent lines mustn't be updated before the line
-	// has actually been removed, otherwise line references may be incorrect
-	if(nextLine)
-	{
-		auto &nextLineAnchorStartPoint = nextLine->GetStartAnchorPoint();
-		nextLineAnchorStartPoint.ShiftByOffset(-static_cast<ShiftOffset>(line.GetAbsLength()));
-		auto prevLine = (lineIdx > 0) ? m_textLines.at(lineIdx -1) : nullptr;
-		if(prevLine)
-			nextLineAnchorStartPoint.SetPreviousLineAnchorStartPoint(prevLine->GetStartAnchorPoint());
-	}
+	// The start offsets of the subsequent lines (and therefore of their anchor points) are
+	// derived from the line tree and will be updated automatically
+	RecordLineRemoval(lineIdx,1);
+	auto pline = m_textLines.Erase(lineIdx);
 	
-	UpdateTextOffsets(lineIdx);
 	m_bDirty = true;
-	OnLineRemoved(*pline);
+	OnLineRemoved(*pline,lineIdx);
 	pline = nullptr; // Line has to be completely destroyed before tags are parsed again
+	UpdateRemovedTags(removedTags);
 
 	// ParseTags(lineIdx,0,1);
 
@@ -366,146 +362,109 @@ void FormattedText::RemoveLine(LineIndex lineIdx,bool preserveTags)
 	auto prevLineIdx = lineIdx -1;
 	// Move to end of previous line
 	InsertText(strTagComponents,prevLineIdx);
-	RemoveEmptyTags(prevLineIdx,true);
+	RemoveEmptyTags(prevLineIdx);
 }
 
 void FormattedText::RemoveLine(LineIndex lineIdx) {RemoveLine(lineIdx,true);}
+void FormattedText::RemoveLines(LineIndex lineIdx,uint32_t count)
+{
+	OperationGuard operation {*this};
+	if(lineIdx >= m_textLines.size())
+		return;
+	count = std::min<uint32_t>(count,m_textLines.size() -lineIdx);
+	RecordLineRemoval(lineIdx,count);
+	auto removedTags = FindLineTags(lineIdx,count); // See RemoveLine
+	auto lines = m_textLines.Erase(lineIdx,count);
+	if(lines.empty())
+		return;
+	m_bDirty = true;
+	// The removals are merged into a single line change
+	for(auto &line : lines)
+		OnLineRemoved(*line,lineIdx);
+	lines.clear(); // Lines have to be completely destroyed before tags are parsed again
+	UpdateRemovedTags(removedTags);
+}
 
-TextOffset FormattedText::FindFirstVisibleChar(util::text::LineIndex lineIndex,bool fromEnd) const
+void FormattedText::RemoveEmptyTags(util::text::LineIndex lineIndex)
 {
-	auto &line = m_textLines.at(lineIndex);
-	// Find first visible character
-	auto lineStartOffset = line->GetStartOffset();
-	auto &tagComponents = line->GetTagComponents();
-	auto &unformattedLine = line->GetUnformattedLine();
-	auto len = unformattedLine.GetLength();
-	if(fromEnd == false)
+	if(lineIndex >= m_textLines.size())
+		return;
+	ParsePendingTags(lineIndex +1);
+	auto &line = *m_textLines.at(lineIndex);
+	auto lineStartOffset = line.GetStartOffset();
+	auto lineEndOffset = lineStartOffset +line.GetLength();
+
+	// Ranges covered by the tag components of this line, which are ordered by their offsets
+	std::vector<std::pair<TextOffset,TextOffset>> componentRanges {};
+	componentRanges.reserve(line.GetTagComponents().size());
+	for(auto &hTagComponent : line.GetTagComponents())
 	{
-		auto curTagIdx = 0u;
-		TextOffset offset = 0u;
-		while(offset < len)
-		{
-			if(curTagIdx < tagComponents.size())
-			{
-				auto &tagComponent = tagComponents.at(curTagIdx);
-				auto startOffset = tagComponent->GetStartAnchorPoint()->GetTextCharOffset() -lineStartOffset;
-				if(offset == startOffset)
-				{
-					offset += tagComponent->GetLength();
-					++curTagIdx;
-					continue;
-				}
-			}
-			break; // Visible character found!
-		}
-		return offset;
+		if(hTagComponent.IsExpired() || hTagComponent->IsValid() == false)
+			continue;
+		componentRanges.push_back({hTagComponent->GetStartAnchorPoint()->GetTextCharOffset(),hTagComponent->GetEndAnchorPoint()->GetTextCharOffset()});
 	}
-	auto curTagIdx = tagComponents.empty() ? 0 : (tagComponents.size() -1);
-	TextOffset offset = (len > 0) ? (len -1) : 0;
-	while(offset >= 0)
-	{
-		if(curTagIdx < tagComponents.size())
+	// A tag is empty if its contents consist of nothing but (other) tag components
+	const auto isInvisible = [&componentRanges](TextOffset startOffset,TextOffset endOffset) -> bool {
+		auto offset = startOffset;
+		for(auto &range : componentRanges)
 		{
-			auto &tagComponent = tagComponents.at(curTagIdx);
-			auto endOffset = tagComponent->GetEndAnchorPoint()->GetTextCharOffset() -lineStartOffset;
-			if(offset == endOffset)
-			{
-				offset -= tagComponent->GetLength();
-				--curTagIdx;
+			if(range.second < offset)
 				continue;
-			}
+			if(range.first > offset)
+				return false;
+			offset = range.second +1;
+			if(offset > endOffset)
+				return true;
 		}
-		break; // Visible character found!
-	}
-	return offset;
-}
+		return false;
+	};
 
-void FormattedText::RemoveEmptyTags(util::text::LineIndex lineIndex,bool fromEnd)
-{
-	static auto skip = false;
-	if(skip)
-		return;
-	// Remove all empty tags
-	for(auto it=m_tags.begin();it!=m_tags.end();)
+	// All empty tags are collected first and their components removed afterwards, starting with the last one,
+	// so the offsets of the remaining ones stay intact
+	std::vector<std::pair<TextOffset,TextLength>> removeRanges {};
+	const auto addRemoveRange = [&removeRanges](const TextTagComponent &tagComponent) {
+		auto startOffset = tagComponent.GetStartAnchorPoint()->GetTextCharOffset();
+		removeRanges.push_back({startOffset,tagComponent.GetEndAnchorPoint()->GetTextCharOffset() -startOffset +1});
+	};
+	for(auto &it : m_tags.Query(lineStartOffset,lineStartOffset +line.GetAbsLength() -1,true))
 	{
 		auto &hTag = *it;
-		if(hTag->IsValid() == false)
+		if(hTag.IsExpired() || hTag->IsValid() == false)
 		{
-			if(m_callbacks.onTagRemoved)
+			if(hTag.IsExpired() == false && m_callbacks.onTagRemoved)
 				m_callbacks.onTagRemoved(*hTag);
-			it = m_tags.erase(it);
+			m_tags.Erase(it);
 			continue;
 		}
 		if(hTag->IsClosed() == false)
-		{
-			++it;
 			continue;
-		}
+		auto outerRange = hTag->GetOuterRange();
+		if(outerRange.has_value() == false || outerRange->first < lineStartOffset || outerRange->first +outerRange->second > lineEndOffset)
+			continue;
 		auto innerRange = hTag->GetInnerRange();
-		if(innerRange.has_value() == false)
-		{
-			// Tag is completely empty, we can just remove it in one step
-			auto outerRange = hTag->GetOuterRange();
-			auto result = outerRange.has_value();
-			if(result == true)
-			{
-				assert(outerRange->second >= outerRange->first);
-				if(outerRange->second >= outerRange->first)
-				{
-					skip = true;
-					result = RemoveText(outerRange->first,outerRange->second -outerRange->first);
-					skip = false;
-				}
-			}
-			if(result)
-				RemoveEmptyTags(lineIndex); // Restart in case m_tags array has been changed
-			return;
-		}
-		else
-		{
-			auto &line = m_textLines.at(lineIndex);
-			auto offset = FindFirstVisibleChar(lineIndex,fromEnd);
-			auto rangeEndOffset = innerRange->first +innerRange->second -1;
-
-			// Check if there are any visible characters within the tag
-			if(offset <= rangeEndOffset)
-			{
-				// There are visible characters within the tag, which means we'll have to
-				// keep the tag
-				++it;
-				continue;
-			}
-			if(offset > rangeEndOffset || line->GetFormattedLength() == 0)
-			{
-				// There are no visible characters within the tag.
-
-				// Opening and closing tags have to be removed separately, because there may be
-				// other tags located between them! The closing tag will be removed first, because
-				// otherwise the tag would become invalid.
-				auto hTagCpy = hTag;
-				auto &closingTag = *hTag->GetClosingTagComponent();
-				auto closingTagStartOffset = closingTag.GetStartAnchorPoint()->GetTextCharOffset();
-				auto closingTagEndOffset = closingTag.GetEndAnchorPoint()->GetTextCharOffset();
-
-				auto &openingTag = *hTag->GetOpeningTagComponent();
-				auto openingTagStartOffset = openingTag.GetStartAnchorPoint()->GetTextCharOffset();
-				auto openingTagEndOffset = openingTag.GetEndAnchorPoint()->GetTextCharOffset();
-
-				skip = true;
-				// Closing tag has to be removed first to make sure the offsets don't become invalid
-				auto result = RemoveText(closingTagStartOffset,closingTagEndOffset -closingTagStartOffset +1) == true && RemoveText(openingTagStartOffset,openingTagEndOffset -openingTagStartOffset +1);
-				skip = false;
-				if(result)
-					RemoveEmptyTags(lineIndex); // Restart in case m_tags array has been changed
-				return;
-			}
-		}
-		++it;
+		if(innerRange.has_value() && isInvisible(innerRange->first,innerRange->first +innerRange->second -1) == false)
+			continue;
+		// Opening and closing tags have to be removed separately, because there may be other tags located between them
+		addRemoveRange(*hTag->GetClosingTagComponent());
+		addRemoveRange(*hTag->GetOpeningTagComponent());
+	}
+	if(removeRanges.empty())
+		return;
+	std::sort(removeRanges.begin(),removeRanges.end(),[](const std::pair<TextOffset,TextLength> &a,const std::pair<TextOffset,TextLength> &b) {
+		return a.first > b.first;
+	});
+	removeRanges.erase(std::unique(removeRanges.begin(),removeRanges.end()),removeRanges.end());
+	BatchGuard batch {*this};
+	for(auto &range : removeRanges)
+	{
+		if(RemoveText(range.first,range.second) == false)
+			break;
 	}
 }
 
 bool FormattedText::RemoveText(TextOffset offset,TextLength len)
 {
+	OperationGuard operation {*this};
 	if(len == 0)
 		return true;
 	auto endOffset = offset +len -1;
@@ -513,19 +472,33 @@ bool FormattedText::RemoveText(TextOffset offset,TextLength len)
 	auto relEndOffset = GetRelativeCharOffset(endOffset);
 	if(relStartOffset.has_value() == false || relEndOffset.has_value() == false)
 		return false;
+	auto startLineIdx = relStartOffset->first;
 	auto endLineIdx = relEndOffset->first;
-	for(auto lineIdx=relStartOffset->first +1;lineIdx<relEndOffset->first;++lineIdx)
+	// Removing text starting at a line break isn't supported (see below), which has to be known before anything is removed
+	if(relStartOffset->second >= m_textLines.at(startLineIdx)->GetLength())
+		return false;
+	if(endLineIdx > startLineIdx)
 	{
-		RemoveLine(lineIdx,false);
-		--endLineIdx;
+		// Lines covered by the range in their entirety are removed all at once. That includes the last line of the range
+		// if the range ends at its line break, in which case the line following it is joined with the first line.
+		// The last line of the text doesn't have a line break that could be removed.
+		auto endsAtLineBreak = relEndOffset->second >= m_textLines.at(endLineIdx)->GetLength() && endLineIdx +1 < m_textLines.size();
+		auto lastCoveredLineIdx = endsAtLineBreak ? endLineIdx : (endLineIdx -1);
+		RemoveLines(startLineIdx +1,lastCoveredLineIdx -startLineIdx);
+		endLineIdx = endsAtLineBreak ? startLineIdx : (startLineIdx +1);
 	}
-	if(endLineIdx != relStartOffset->first && RemoveText(endLineIdx,0,relEndOffset->second +1) == false)
-		return false;
-	return RemoveText(relStartOffset->first,relStartOffset->second,len);
+	if(endLineIdx != startLineIdx)
+	{
+		auto endLen = std::min<TextLength>(relEndOffset->second +1,m_textLines.at(endLineIdx)->GetLength());
+		if(endLen > 0 && RemoveText(endLineIdx,0,endLen) == false)
+			return false;
+	}
+	return RemoveText(startLineIdx,relStartOffset->second,len);
 }
 
 bool FormattedText::RemoveText(LineIndex lineIdx,CharOffset charOffset,TextLength len)
 {
+	OperationGuard operation {*this};
 	if(lineIdx >= m_textLines.size())
 		return false;
 	auto &line = *m_textLines.at(lineIdx);
@@ -551,58 +524,148 @@ bool FormattedText::RemoveText(LineIndex lineIdx,CharOffset charOffset,TextLengt
 			if(RemoveText(lineIdx,charOffset,lineLen -charOffset) == false)
 				return false;
 		}
-		auto nextLineIdx = lineIdx +1;
-		if(nextLineIdx >= m_textLines.size())
+		if(lineIdx +1 >= m_textLines.size())
 			return true; // There is no next line, so there is nothing left to do
-		auto &nextLine = *m_textLines.at(nextLineIdx);
-		// Move next line into this one
-		return MoveText(nextLineIdx,0,nextLine.GetAbsLength(),lineIdx,charOffset);
+		return JoinLines(lineIdx);
 	}
 
+	// Erasing (part of) a tag component changes the ranges of the affected tags
+	auto absOffset = line.GetStartOffset() +charOffset;
+	auto &tagComponents = line.GetTagComponents();
+	std::vector<TagTree::Iterator> removedTags {};
+	if(std::find_if(tagComponents.begin(),tagComponents.end(),[absOffset,len](const util::TSharedHandle<TextTagComponent> &hTagComponent) {
+		return hTagComponent.IsExpired() == false && hTagComponent->IsValid() &&
+			(hTagComponent->GetStartAnchorPoint()->IsInRange(absOffset,len) || hTagComponent->GetEndAnchorPoint()->IsInRange(absOffset,len));
+	}) != tagComponents.end())
+		removedTags = FindTags(absOffset,absOffset +len -1);
+
+	if(IsRecordingHistory())
+		m_history.RecordRemove(absOffset,line.Substr(charOffset,len));
 	auto numErased = line.Erase(charOffset,len);
 	if(numErased.has_value() == false)
 		throw std::logic_error{"Discrepancy: Erasing failed, but 'CanErase' returned true."};
-	UpdateTextOffsets(lineIdx);
+	UpdateRemovedTags(removedTags);
 	ParseTags(lineIdx,charOffset,1);
 	m_bDirty = true;
 	OnLineChanged(line);
 	return numErased.has_value();
 }
 
+bool FormattedText::JoinLines(LineIndex lineIdx)
+{
+	OperationGuard operation {*this};
+	auto nextLineIdx = lineIdx +1;
+	if(nextLineIdx >= m_textLines.size())
+		return false;
+	auto &line = *m_textLines.at(lineIdx);
+	auto charOffset = line.GetLength();
+	if(IsRecordingHistory())
+	{
+		// Only the line break is recorded, instead of the removal and re-insertion of the next line
+		auto absOffset = line.GetStartOffset() +charOffset;
+		auto result = false;
+		{
+			HistorySuspension suspension {*this};
+			result = JoinLines(lineIdx);
+		}
+		if(result)
+			m_history.RecordRemove(absOffset,"\n");
+		else
+			m_history.Clear(); // The text may have been changed partially, which can't be undone
+		return result;
+	}
+	auto &nextLine = *m_textLines.at(nextLineIdx);
+	if(nextLine.GetLength() == 0)
+	{
+		// There's nothing to move, only the anchor points at the line break of the empty line are kept
+		auto absStartOffset = nextLine.GetStartOffset();
+		auto anchorPoints = nextLine.DetachAnchorPoints(0,nextLine.GetAbsLength());
+		RemoveLine(nextLineIdx,false);
+		line.AttachAnchorPoints(anchorPoints,static_cast<ShiftOffset>(line.GetStartOffset() +charOffset) -static_cast<ShiftOffset>(absStartOffset));
+		return true;
+	}
+	// Move next line into this one
+	return MoveText(nextLineIdx,0,nextLine.GetAbsLength(),lineIdx,charOffset);
+}
+
 bool FormattedText::MoveText(LineIndex lineIdx,CharOffset startOffset,TextLength len,LineIndex targetLineIdx,CharOffset targetCharOffset)
 {
+	OperationGuard operation {*this};
 	if(len == 0)
 		return true;
 	if(lineIdx == targetLineIdx && targetCharOffset > startOffset && targetCharOffset <= startOffset +len -1)
 		return false; // Target index is located within the range that should be moved
 	if(lineIdx >= m_textLines.size() || targetLineIdx >= m_textLines.size())
 		return false;
-	// Create temporary anchor to keep track of the target line (in case the line is changed)
-	auto tgtAnchor = CreateAnchorPoint(targetLineIdx,0,true);
-	if(tgtAnchor.IsExpired())
-		return false;
 	auto &lineSrc = *m_textLines.at(lineIdx);
+	auto srcLen = lineSrc.GetLength();
+	if(IsRecordingHistory() && startOffset < srcLen && len <= srcLen -startOffset)
+	{
+		// Moves within the characters of a line are recorded as a single move, which doesn't have to store the moved text.
+		// Other moves are recorded as the removals and insertions they consist of.
+		auto &lineTgt = *m_textLines.at(targetLineIdx);
+		if(targetCharOffset != LAST_CHAR && targetCharOffset > lineTgt.GetLength())
+			return false;
+		auto absOffset = lineSrc.GetStartOffset() +startOffset;
+		auto absTargetOffset = lineTgt.GetStartOffset() +std::min<TextLength>(targetCharOffset,lineTgt.GetLength());
+		if(absTargetOffset > absOffset)
+			absTargetOffset -= len;
+		auto result = false;
+		{
+			HistorySuspension suspension {*this};
+			result = MoveText(lineIdx,startOffset,len,targetLineIdx,targetCharOffset);
+		}
+		if(result)
+			m_history.RecordMove(absOffset,len,absTargetOffset);
+		else
+			m_history.Clear(); // See JoinLines
+		return result;
+	}
+	if(CanMoveTextInPlace(lineSrc,startOffset,len,*m_textLines.at(targetLineIdx),targetCharOffset))
+		return MoveTextInPlace(lineSrc,startOffset,len,*m_textLines.at(targetLineIdx),targetCharOffset);
 
 	auto absStartOffset = *GetTextCharOffset(lineIdx,startOffset);
 	auto srcAnchorPoints = lineSrc.DetachAnchorPoints(startOffset,len);
+	m_tags.BeginVolatileOffsets(srcAnchorPoints);
+	const auto endMove = [this](bool result) -> bool {
+		m_tags.EndVolatileOffsets();
+		return result;
+	};
 	std::vector<CharOffset> anchorPointOffsets {};
 	anchorPointOffsets.reserve(srcAnchorPoints.size());
 	for(auto &hAnchorPoint : srcAnchorPoints)
 		anchorPointOffsets.push_back(hAnchorPoint->GetTextCharOffset() -absStartOffset);
 
-	auto text = lineSrc.Substr(startOffset,len).to_str();
+	// Create temporary anchor to keep track of the target line (in case the line is changed).
+	// This has to happen after the anchor points in the move range have been detached, otherwise
+	// it would be detached as well if the target line starts within the range.
+	auto tgtAnchor = CreateAnchorPoint(targetLineIdx,0,true);
+	if(tgtAnchor.IsExpired())
+		return endMove(false);
+
+	util::Utf8String text;
+	if(lineSrc.GetUnformattedLine().IsPieceTable())
+	{
+		// Only copy the moved characters, without assembling the entire line
+		std::string str;
+		for(auto &segment : lineSrc.GetUnformattedLine().GetSegments(startOffset,len))
+			str += segment;
+		text = util::Utf8String{str};
+	}
+	else
+		text = lineSrc.Substr(startOffset,len).to_str();
 	auto tgtAnchorOffset = tgtAnchor->GetTextCharOffset();
 
-	if(RemoveText(lineIdx,startOffset,len) == false || tgtAnchor.IsExpired())
-		return false;
+	if(RemoveText(lineIdx,startOffset,len) == false || tgtAnchor.IsExpired() || tgtAnchor->IsValid() == false)
+		return endMove(false);
 
 	if(targetLineIdx == lineIdx && targetCharOffset > startOffset)
 		targetCharOffset -= len; // Target offset has changed if the target line is the same as the source line
 	auto *lineTgt = &tgtAnchor->GetLine();
 	targetLineIdx = lineTgt->GetIndex();
 
-	if(InsertText(text,targetLineIdx,targetCharOffset) == false || tgtAnchor.IsExpired())
-		return false;
+	if(InsertText(text,targetLineIdx,targetCharOffset) == false || tgtAnchor.IsExpired() || tgtAnchor->IsValid() == false)
+		return endMove(false);
 	lineTgt = &tgtAnchor->GetLine();
 
 	auto newTgtAnchorOffset = tgtAnchor->GetTextCharOffset();
@@ -612,110 +675,581 @@ bool FormattedText::MoveText(LineIndex lineIdx,CharOffset startOffset,TextLength
 	auto newAbsStartOffset = *GetTextCharOffset(targetLineIdx,targetCharOffset);
 	for(auto i=0;i<srcAnchorPoints.size();++i)
 		srcAnchorPoints.at(i)->SetOffset(newAbsStartOffset +anchorPointOffsets.at(i));
+	return endMove(true);
+}
+
+bool FormattedText::CanMoveTextInPlace(const FormattedTextLine &lineSrc,CharOffset startOffset,TextLength len,const FormattedTextLine &lineTgt,CharOffset targetCharOffset) const
+{
+	// Tags are parsed from the split lines by the generic path, which can't be reproduced by splicing the lines
+	if(AreTagsEnabled() || lineSrc.GetTagComponents().empty() == false || lineTgt.GetTagComponents().empty() == false)
+		return false;
+	auto lineLen = lineSrc.GetLength();
+	if(startOffset >= lineLen)
+		return false;
+	if(&lineSrc == &lineTgt)
+		return len <= lineLen -startOffset && targetCharOffset <= lineLen;
+	if(targetCharOffset != LAST_CHAR && targetCharOffset > lineTgt.GetLength())
+		return false;
+	// Either a range within the line, or the entire line including its line break (i.e. the line is joined with the target line)
+	return len <= lineLen -startOffset || (startOffset == 0 && len >= lineSrc.GetAbsLength());
+}
+bool FormattedText::MoveTextInPlace(FormattedTextLine &lineSrc,CharOffset startOffset,TextLength len,FormattedTextLine &lineTgt,CharOffset targetCharOffset)
+{
+	// The line storage is spliced directly and the anchor points are re-based in place, so unlike the generic path
+	// this doesn't have to copy the moved text or to remove and insert it as separate operations
+	if(&lineSrc == &lineTgt)
+	{
+		if(targetCharOffset > startOffset)
+			targetCharOffset -= len;
+		if(lineSrc.Move(startOffset,len,lineSrc,targetCharOffset) == false)
+			return false;
+		m_bDirty = true;
+		OnLineChanged(lineSrc);
+		return true;
+	}
+	if(targetCharOffset == LAST_CHAR)
+		targetCharOffset = lineTgt.GetLength();
+	auto lineLen = lineSrc.GetLength();
+	if(len <= lineLen -startOffset)
+	{
+		if(lineSrc.Move(startOffset,len,lineTgt,targetCharOffset) == false)
+			return false;
+		m_bDirty = true;
+		OnLineChanged(lineSrc);
+		OnLineChanged(lineTgt);
+		return true;
+	}
+	// The anchor points at the line break move along with the rest of the line
+	auto absStartOffset = lineSrc.GetStartOffset();
+	auto anchorPoints = lineSrc.DetachAnchorPoints(0,lineSrc.GetAbsLength());
+	auto pLineSrc = lineSrc.shared_from_this(); // Keeps the characters alive until they've been moved
+	RemoveLine(lineSrc.GetIndex(),false);
+	if(IsRecordingHistory())
+		m_history.RecordInsert(lineTgt.GetStartOffset() +targetCharOffset,pLineSrc->Substr(0,lineLen));
+	if(pLineSrc->Move(0,lineLen,lineTgt,targetCharOffset) == false)
+		return false;
+	lineTgt.AttachAnchorPoints(anchorPoints,static_cast<ShiftOffset>(lineTgt.GetStartOffset() +targetCharOffset) -static_cast<ShiftOffset>(absStartOffset));
+	m_bDirty = true;
+	OnLineChanged(lineTgt);
 	return true;
 }
 
 void FormattedText::SetCallbacks(const Callbacks &callbacks) {m_callbacks = callbacks;}
 void FormattedText::OnLineAdded(FormattedTextLine &line)
 {
+	OnLineDirty(line);
+	AddLineChange(line.GetIndex(),ChangeKind::Added);
+	if(m_batch.depth > 0)
+	{
+		m_batch.addedLines.insert(&line);
+		return;
+	}
 	if(m_callbacks.onLineAdded)
 		m_callbacks.onLineAdded(line);
 }
-void FormattedText::OnLineRemoved(FormattedTextLine &line)
+void FormattedText::OnLineRemoved(FormattedTextLine &line,LineIndex lineIdx)
 {
+	// The tags that intersected the removed line also intersect one of its neighbors (unless they were removed as well)
+	if(m_textInfo.trackSnapshotChanges && m_textLines.empty() == false)
+		OnLineDirty(*m_textLines.at(std::min<size_t>(lineIdx,m_textLines.size() -1)));
+	AddLineChange(lineIdx,ChangeKind::Removed);
+	if(m_batch.depth > 0)
+	{
+		m_batch.pendingTagLines.erase(&line);
+		m_batch.changedLines.erase(&line);
+		// Lines that have been added within the same batch were never announced
+		if(m_batch.addedLines.erase(&line) > 0)
+			return;
+	}
 	if(m_callbacks.onLineRemoved)
 		m_callbacks.onLineRemoved(line);
 }
 void FormattedText::OnLineChanged(FormattedTextLine &line)
 {
+	AddLineChange(line.GetIndex(),ChangeKind::Changed);
+	if(m_batch.depth > 0)
+	{
+		if(m_batch.addedLines.find(&line) == m_batch.addedLines.end())
+			m_batch.changedLines.insert(&line);
+		return;
+	}
 	if(m_callbacks.onLineChanged)
 		m_callbacks.onLineChanged(line);
 }
-
-LineIndex FormattedText::InsertLine(FormattedTextLine &line,LineIndex lineIdx)
+void FormattedText::OnLineDirty(FormattedTextLine &line)
 {
-	if(lineIdx > m_textLines.size())
-		lineIdx = m_textLines.size();
-	line.Initialize(lineIdx);
-	auto &startAnchorPoint = line.GetStartAnchorPoint();
-
-	// Set parent anchor point
-	if(lineIdx > 0)
+	if(m_textInfo.trackSnapshotChanges == false || line.m_bSnapshotChangeRecorded)
+		return;
+	auto &changedLines = m_textInfo.snapshotChangedLines;
+	// Lines that have been removed in the meantime don't have to be kept around
+	if(changedLines.size() >= std::max<size_t>(m_textLines.size() *2,64))
 	{
-		auto &prevLine = *m_textLines.at(lineIdx -1);
-		startAnchorPoint.SetPreviousLineAnchorStartPoint(prevLine.GetStartAnchorPoint());
-		startAnchorPoint.SetOffset(prevLine.GetAbsEndOffset() +1);
+		changedLines.erase(std::remove_if(changedLines.begin(),changedLines.end(),[](const std::weak_ptr<FormattedTextLine> &wpLine) {
+			return wpLine.expired();
+		}),changedLines.end());
 	}
-	else
+	line.m_bSnapshotChangeRecorded = true;
+	changedLines.push_back(line.weak_from_this());
+}
+
+void FormattedText::BeginBatch() {++m_batch.depth;}
+void FormattedText::EndBatch()
+{
+	if(m_batch.depth == 0 || --m_batch.depth > 0)
+		return;
+	if(m_operationDepth == 0)
+		m_history.EndGroup();
+	ParsePendingTags();
+
+	auto getSortedLines = [](std::unordered_set<FormattedTextLine*> &lineSet) {
+		std::vector<PFormattedTextLine> lines {};
+		lines.reserve(lineSet.size());
+		for(auto *line : lineSet)
+			lines.push_back(line->shared_from_this());
+		lineSet.clear();
+		std::sort(lines.begin(),lines.end(),[](const PFormattedTextLine &a,const PFormattedTextLine &b) {
+			return a->GetIndex() < b->GetIndex();
+		});
+		return lines;
+	};
+	auto addedLines = getSortedLines(m_batch.addedLines);
+	auto changedLines = getSortedLines(m_batch.changedLines);
+	// The callbacks may change the text again, so lines that have been removed in the meantime are skipped
+	if(m_callbacks.onLineAdded)
 	{
-		startAnchorPoint.ClearParent();
-		startAnchorPoint.SetOffset(0);
+		for(auto &line : addedLines)
+		{
+			if(line->GetIndex() != INVALID_LINE_INDEX)
+				m_callbacks.onLineAdded(*line);
+		}
 	}
-	// Usually SetOffset would already assign the correct line, however
-	// this does not work here because the line hasn't been added to m_textLines yet,
-	// so we have to assign the line manually.
-	startAnchorPoint.SetLine(line);
-	
-	// Set child anchor point
-	if(lineIdx < m_textLines.size())
+	if(m_callbacks.onLineChanged)
 	{
-		auto &nextLine = *m_textLines.at(lineIdx);
-		auto &nextAnchorPoint = nextLine.GetStartAnchorPoint();
-		nextAnchorPoint.SetPreviousLineAnchorStartPoint(line.GetStartAnchorPoint());
-		nextAnchorPoint.ShiftToOffset(line.GetAbsEndOffset() +1);
+		for(auto &line : changedLines)
+		{
+			if(line->GetIndex() != INVALID_LINE_INDEX)
+				m_callbacks.onLineChanged(*line);
+		}
 	}
-	m_textLines.insert(m_textLines.begin() +lineIdx,line.shared_from_this());
-	for(auto it=m_textLines.begin() +lineIdx +1;it!=m_textLines.end();++it)
+	FlushLineChanges();
+}
+bool FormattedText::IsBatchActive() const {return m_batch.depth > 0;}
+
+FormattedText::BatchGuard::BatchGuard(FormattedText &text)
+	: m_text{text}
+{
+	m_text.BeginBatch();
+}
+FormattedText::BatchGuard::~BatchGuard() {m_text.EndBatch();}
+
+FormattedText::OperationGuard::OperationGuard(FormattedText &text)
+	: text{text}
+{
+	++text.m_operationDepth;
+}
+FormattedText::OperationGuard::~OperationGuard()
+{
+	--text.m_operationDepth;
+	// Everything that has been changed by an operation (or batch) is undone in a single step
+	if(text.m_operationDepth == 0 && text.m_batch.depth == 0)
+		text.m_history.EndGroup();
+	text.FlushLineChanges();
+}
+void FormattedText::AddLineChange(LineIndex lineIdx,ChangeKind kind)
+{
+	if(!m_callbacks.onLinesChanged)
+		return;
+	if(m_lineChanges.empty() == false)
 	{
-		auto &line = **it;
-		line.SetIndex(line.GetIndex() +1);
+		// Only the most recent change can be merged, otherwise the line indices of the changes in between would be off
+		auto &last = m_lineChanges.back();
+		auto lastEnd = last.first +last.count;
+		switch(kind)
+		{
+		case ChangeKind::Added:
+			if(last.kind == ChangeKind::Added && lineIdx >= last.first && lineIdx <= lastEnd)
+			{
+				++last.count;
+				return;
+			}
+			break;
+		case ChangeKind::Removed:
+			if(last.kind == ChangeKind::Added && lineIdx >= last.first && lineIdx < lastEnd)
+			{
+				// The line was added by this operation and never announced
+				if(--last.count == 0)
+					m_lineChanges.pop_back();
+				return;
+			}
+			if(last.kind == ChangeKind::Removed && (lineIdx == last.first || lineIdx +1 == last.first))
+			{
+				last.first = lineIdx;
+				++last.count;
+				return;
+			}
+			break;
+		case ChangeKind::Changed:
+			if(last.kind == ChangeKind::Added && lineIdx >= last.first && lineIdx < lastEnd)
+				return;
+			if(last.kind == ChangeKind::Changed && lineIdx +1 >= last.first && lineIdx <= lastEnd)
+			{
+				auto first = std::min(last.first,lineIdx);
+				last.count = std::max(lastEnd,lineIdx +1) -first;
+				last.first = first;
+				return;
+			}
+			break;
+		}
 	}
-	UpdateTextOffsets(lineIdx);
-	ParseTags(lineIdx);
-	m_bDirty = true;
-	OnLineAdded(*m_textLines.at(lineIdx));
-	return lineIdx;
+	m_lineChanges.push_back({lineIdx,1,kind});
 }
-void FormattedText::AppendText(const util::Utf8StringView &text) {InsertText(text,m_textLines.empty() ? LAST_LINE : (m_textLines.size() -1),LAST_CHAR);}
-void FormattedText::AppendLine(const util::Utf8StringView &line)
+void FormattedText::FlushLineChanges()
 {
-	auto strLine = line.to_str();
-	if(m_textLines.empty() == false)
-		strLine = util::Utf8String{"\n"} +strLine;
-	InsertText(strLine,m_textLines.size());
+	if(m_operationDepth > 0 || m_batch.depth > 0 || m_lineChanges.empty())
+		return;
+	auto lineChanges = std::move(m_lineChanges);
+	m_lineChanges.clear();
+	if(!m_callbacks.onLinesChanged)
+		return;
+	for(auto &change : lineChanges)
+		m_callbacks.onLinesChanged(change.first,change.count,change.kind);
 }
-void FormattedText::PopFrontLine() {RemoveLine(0);}
-void FormattedText::PopBackLine()
+
+FormattedText::HistorySuspension::HistorySuspension(FormattedText &text)
+	: text{text}
 {
-	if(m_textLines.empty())
+	++text.m_historySuspensionDepth;
+}
+FormattedText::HistorySuspension::~HistorySuspension() {--text.m_historySuspensionDepth;}
+bool FormattedText::IsRecordingHistory() const {return m_history.IsEnabled() && m_historySuspensionDepth == 0;}
+void FormattedText::RecordLineRemoval(LineIndex lineIdx,uint32_t count)
+{
+	if(count == 0 || IsRecordingHistory() == false)
 		return;
-	RemoveLine(m_textLines.size() -1);
+	auto offset = m_textLines.at(lineIdx)->GetStartOffset();
+	TextLength len = 0;
+	if(lineIdx +count < m_textLines.size())
+		len = m_textLines.at(lineIdx +count)->GetStartOffset() -offset;
+	else
+	{
+		// The last line doesn't have a line break, the one in front of the removed lines is removed instead
+		len = GetCharCount() -1 -offset;
+		if(offset > 0)
+		{
+			--offset;
+			++len;
+		}
+	}
+	m_history.RecordRemove(offset,Substr(offset,len));
 }
-
-bool FormattedText::InsertText(const util::Utf8StringView &text,LineIndex lineIdx,CharOffset charOffset)
+size_t FormattedText::GetHistoryBudget() const {return m_history.GetBudget();}
+void FormattedText::SetHistoryBudget(size_t budget) {m_history.SetBudget(budget);}
+bool FormattedText::CanUndo() const {return m_history.GetUndoGroup() != nullptr;}
+bool FormattedText::CanRedo() const {return m_history.GetRedoGroup() != nullptr;}
+void FormattedText::ClearHistory() {m_history.Clear();}
+bool FormattedText::Undo()
 {
-	if(text.empty())
-		return true;
-	std::vector<PFormattedTextLine> lines {};
-	ParseText(text,lines);
-	if(lines.empty())
+	if(m_history.GetUndoGroup() == nullptr || IsBatchActive() || m_operationDepth > 0)
+		return false;
+	return ApplyHistoryGroup(true);
+}
+bool FormattedText::Redo()
+{
+	if(m_history.GetRedoGroup() == nullptr || IsBatchActive() || m_operationDepth > 0)
+		return false;
+	return ApplyHistoryGroup(false);
+}
+bool FormattedText::ApplyHistoryDelta(const EditHistory::Delta &delta)
+{
+	switch(delta.type)
+	{
+	case EditHistory::DeltaType::Insert:
+		return InsertTextAt(delta.offset,delta.text);
+	case EditHistory::DeltaType::Remove:
+		return RemoveTextAt(delta.offset,delta.length);
+	case EditHistory::DeltaType::Move:
+		return MoveTextAt(delta.offset,delta.length,delta.targetOffset);
+	}
+	return false;
+}
+bool FormattedText::ApplyHistoryGroup(bool undo)
+{
+	OperationGuard operation {*this};
+	auto &group = undo ? *m_history.GetUndoGroup() : *m_history.GetRedoGroup();
+	auto result = true;
+	{
+		HistorySuspension suspension {*this};
+		// Lines that were evicted from the front are restored by the group as well, the line count only has to be within bounds once all deltas have been applied
+		auto maxLineCount = m_maxLineCount;
+		m_maxLineCount = std::numeric_limits<uint32_t>::max();
+		// Deltas that revert the ones applied so far, in case a subsequent delta fails
+		std::vector<EditHistory::Delta> revertDeltas {};
+		revertDeltas.reserve(group.size());
+		for(size_t i=0;i<group.size();++i)
+		{
+			// Undoing a group applies the inverse of its deltas in reverse order
+			auto delta = undo ? EditHistory::Invert(group[group.size() -1 -i]) : group[i];
+			auto revertDelta = EditHistory::Invert(delta);
+			if(delta.type == EditHistory::DeltaType::Remove)
+				revertDelta.text = Substr(delta.offset,delta.length); // Re-inserts the characters that are actually removed
+			if(ApplyHistoryDelta(delta) == false)
+			{
+				result = false;
+				break;
+			}
+			revertDeltas.push_back(std::move(revertDelta));
+		}
+		if(result == false)
+		{
+			// The text doesn't match the history anymore. The deltas that have already been applied are reverted,
+			// so the text isn't left partially undone.
+			for(auto it=revertDeltas.rbegin();it!=revertDeltas.rend();++it)
+				ApplyHistoryDelta(*it);
+		}
+		m_maxLineCount = maxLineCount;
+	}
+	if(result == false)
+	{
+		m_history.Clear();
+		return false;
+	}
+	if(undo)
+		m_history.PopUndoGroup();
+	else
+		m_history.PopRedoGroup();
+	// The lines may exceed the maximum line count if it was lowered after the group was recorded. They're evicted the same
+	// way as by InsertText, which is recorded as a new edit.
+	if(m_textLines.size() > m_maxLineCount)
+		PopFrontLines(m_textLines.size() -m_maxLineCount);
+	return true;
+}
+bool FormattedText::InsertTextAt(TextOffset offset,const util::Utf8StringView &text)
+{
+	if(m_textLines.empty())
+		return offset == 0 && InsertText(text,0);
+	auto relOffset = GetRelativeCharOffset(offset);
+	if(relOffset.has_value() == false)
+		return false;
+	return InsertText(text,relOffset->first,relOffset->second);
+}
+bool FormattedText::RemoveTextAt(TextOffset offset,TextLength len)
+{
+	OperationGuard operation {*this};
+	// The range is checked in advance, so it's never removed partially
+	if(len > 0 && offset +len >= GetCharCount())
+		return false;
+	for(;len > 0;--len)
+	{
+		auto relOffset = GetRelativeCharOffset(offset);
+		if(relOffset.has_value() == false)
+			return false;
+		if(relOffset->second < m_textLines.at(relOffset->first)->GetLength())
+			return RemoveText(offset,len);
+		// The range starts with a line break, which RemoveText can't remove
+		if(JoinLines(relOffset->first) == false)
+			return false;
+	}
+	return true;
+}
+bool FormattedText::MoveTextAt(TextOffset offset,TextLength len,TextOffset targetOffset)
+{
+	auto relOffset = GetRelativeCharOffset(offset);
+	// MoveText expects the target offset to be relative to the text that still contains the moved range
+	auto relTargetOffset = GetRelativeCharOffset((targetOffset > offset) ? (targetOffset +len) : targetOffset);
+	if(relOffset.has_value() == false || relTargetOffset.has_value() == false)
+		return false;
+	return MoveText(relOffset->first,relOffset->second,len,relTargetOffset->first,relTargetOffset->second);
+}
+
+LineIndex FormattedText::InsertLine(FormattedTextLine &line,LineIndex lineIdx)
+{
+	if(lineIdx > m_textLines.size())
+		lineIdx = m_textLines.size();
+	// The start anchor point derives its offset from the line tree, so the anchor points
+	// of subsequent lines don't have to be shifted
+	m_textLines.Insert(lineIdx,line.shared_from_this());
+	ParseTags(lineIdx);
+	m_bDirty = true;
+	OnLineAdded(*m_textLines.at(lineIdx));
+	return lineIdx;
+}
+void FormattedText::InsertLines(const PFormattedTextLine *lines,size_t count,LineIndex lineIdx)
+{
+	if(count == 0)
+		return;
+	if(lineIdx > m_textLines.size())
+		lineIdx = m_textLines.size();
+	m_textLines.Insert(lineIdx,lines,count);
+	m_bDirty = true;
+	// The lines in front of the first one with tags can be announced right away, the others once all tags have been parsed
+	auto tagsEnabled = AreTagsEnabled();
+	std::vector<FormattedTextLine*> tagLines {};
+	auto firstTagLine = count;
+	for(auto i=decltype(count){0u};i<count;++i)
+	{
+		// New lines without any tag components can't affect existing tags, so they don't have to be parsed
+		if(tagsEnabled && lines[i]->GetUnformattedLine().GetData().find(TextTag::TAG_PREFIX) != std::string_view::npos)
+		{
+			if(m_batch.depth > 0)
+				ParseTags(lineIdx +i); // Deferred until the batch ends
+			else
+			{
+				firstTagLine = std::min(firstTagLine,i);
+				tagLines.push_back(lines[i].get());
+			}
+		}
+		if(i < firstTagLine)
+			OnLineAdded(*lines[i]);
+	}
+	ParseTags(tagLines);
+	for(auto i=firstTagLine;i<count;++i)
+		OnLineAdded(*lines[i]);
+}
+void FormattedText::AppendText(const util::Utf8StringView &text) {InsertText(text,m_textLines.empty() ? LAST_LINE : (m_textLines.size() -1),LAST_CHAR);}
+void FormattedText::StreamText(std::string text) {m_streamQueue.Push(std::move(text));}
+static size_t get_complete_utf8_length(const std::string &str)
+{
+	// Find the lead byte of the last code point and check if all of its bytes are present
+	auto len = str.size();
+	for(size_t i=1;i<=std::min<size_t>(len,4);++i)
+	{
+		auto c = static_cast<uint8_t>(str[len -i]);
+		if((c &0xC0) == 0x80)
+			continue;
+		size_t numBytes = ((c &0xE0) == 0xC0) ? 2 : ((c &0xF0) == 0xE0) ? 3 : ((c &0xF8) == 0xF0) ? 4 : 1;
+		return (numBytes > i) ? (len -i) : len;
+	}
+	return len;
+}
+bool FormattedText::FlushStreamedText()
+{
+	auto text = std::move(m_streamRemainder);
+	m_streamRemainder.clear();
+	if(m_streamQueue.Drain(text) == 0)
+	{
+		m_streamRemainder = std::move(text);
+		return false;
+	}
+	auto len = get_complete_utf8_length(text);
+	if(len < text.size())
+	{
+		m_streamRemainder = text.substr(len);
+		text.resize(len);
+	}
+	if(text.empty())
+		return false;
+	AppendText(text);
+	return true;
+}
+void FormattedText::AppendLine(const util::Utf8StringView &line)
+{
+	auto strLine = line.to_str();
+	if(m_textLines.empty() == false)
+		strLine = util::Utf8String{"\n"} +strLine;
+	InsertText(strLine,m_textLines.size());
+}
+void FormattedText::PopFrontLine() {PopFrontLines(1);}
+void FormattedText::PopFrontLines(uint32_t count)
+{
+	OperationGuard operation {*this};
+	count = std::min<uint32_t>(count,m_textLines.size());
+	if(count == 0)
+		return;
+	// Find tags located in the removed lines, these will have to be moved into the
+	// new first line. If all lines are removed, there is no point in keeping them.
+	util::Utf8String strTagComponents {};
+	if(count < m_textLines.size() && ShouldPreserveTagsOnLineRemoval())
+	{
+		ParsePendingTags(count);
+		auto it = m_textLines.begin();
+		for(auto i=decltype(count){0u};i<count;++i,++it)
+		{
+			for(auto &tagComponent : (*it)->GetTagComponents())
+				strTagComponents += tagComponent->GetTagString(*this);
+		}
+		// See RemoveLine
+		while(!strTagComponents.empty() && strTagComponents.front() == '\n')
+			strTagComponents.erase(strTagComponents.begin());
+	}
+
+	RecordLineRemoval(0,count);
+	auto removedTags = FindLineTags(0,count);
+	auto lines = m_textLines.Erase(0,count);
+	m_bDirty = true;
+	for(auto &line : lines)
+		OnLineRemoved(*line,0);
+	lines.clear(); // Lines have to be completely destroyed before tags are parsed again
+	UpdateRemovedTags(removedTags);
+
+	if(strTagComponents.empty())
+		return;
+	InsertText(strTagComponents,0,0);
+	RemoveEmptyTags(0);
+}
+void FormattedText::PopBackLine()
+{
+	if(m_textLines.empty())
+		return;
+	RemoveLine(m_textLines.size() -1);
+}
+
+bool FormattedText::InsertText(const util::Utf8StringView &text,LineIndex lineIdx,CharOffset charOffset)
+{
+	OperationGuard operation {*this};
+	if(text.empty())
+		return true;
+	std::vector<PFormattedTextLine> lines {};
+	ParseText(text,lines);
+	if(lines.empty())
 		return true;
-	while(m_textLines.size() +lines.size() > m_maxLineCount)
-		PopFrontLine(); // TODO: This may cause an infinite loop in some cases?
 	if(lineIdx == LAST_LINE)
 		lineIdx = m_textLines.size();
 	if(lineIdx > m_textLines.size() || (lineIdx == m_textLines.size() && charOffset != LAST_CHAR))
 		return false;
 	if(lineIdx == m_textLines.size())
 	{
+		// The new line is separated from the last one by a line break
+		if(m_textLines.empty() == false && IsRecordingHistory())
+			m_history.RecordInsert(GetCharCount() -1,"\n");
 		auto newLine = FormattedTextLine::Create(*this);
 		InsertLine(*newLine,LAST_LINE);
 	}
 	auto &firstLineToInsert = lines.front();
+	auto &line = *m_textLines.at(lineIdx);
+	// The insertion is recorded once it has succeeded, but before any lines are evicted
+	auto recordHistory = IsRecordingHistory();
+	auto absOffset = recordHistory ? (line.GetStartOffset() +std::min<TextLength>(charOffset,line.GetLength())) : 0;
+	// Text without line breaks can be inserted in place, instead of splitting off the remainder of the line
+	// and appending it again, which lets piece tables and gap buffers avoid moving the remainder. Tags are
+	// parsed from the split line below, so this only applies if tags are disabled.
+	if(lines.size() == 1 && AreTagsEnabled() == false)
+	{
+		if(charOffset == LAST_CHAR)
+			charOffset = line.GetLength();
+		if(charOffset > line.GetLength())
+			return false;
+		auto anchorPoints = line.DetachAnchorPoints(charOffset,UNTIL_THE_END);
+		m_tags.BeginVolatileOffsets(anchorPoints);
+		if(line.InsertString(firstLineToInsert->GetUnformattedLine().GetText(),charOffset).has_value() == false)
+		{
+			// Nothing has been inserted, so the anchor points go back to where they were
+			line.AttachAnchorPoints(anchorPoints,0);
+			m_tags.EndVolatileOffsets();
+			return false;
+		}
+		m_bDirty = true;
+		line.AttachAnchorPoints(anchorPoints,text.length());
+		m_tags.EndVolatileOffsets();
+		OnLineChanged(line);
+		if(recordHistory)
+			m_history.RecordInsert(absOffset,text);
+		return true;
+	}
 	
 	auto postfix = m_textLines.at(lineIdx)->Substr(charOffset).to_str();
 	auto &targetLineToInsert = m_textLines.at(lineIdx);
 	auto anchorPointsInMoveRange = targetLineToInsert->DetachAnchorPoints(charOffset,UNTIL_THE_END);
+	m_tags.BeginVolatileOffsets(anchorPointsInMoveRange);
 
 	auto numErased = targetLineToInsert->Erase(charOffset);
 	m_bDirty = true;
@@ -724,27 +1258,31 @@ bool FormattedText::InsertText(const util::Utf8StringView &text,LineIndex lineId
 	auto textToInsert = firstLineToInsert->GetUnformattedLine().GetText();
 	auto insertedCharOffset = targetLineToInsert->InsertString(textToInsert,charOffset);
 	if(insertedCharOffset.has_value() == false)
+	{
+		m_tags.EndVolatileOffsets();
 		return false;
+	}
 
-	UpdateTextOffsets(lineIdx);
 	ParseTags(lineIdx);//,*insertedCharOffset,textToInsert.length());
 
 	OnLineChanged(*targetLineToInsert);
 
-	m_textLines.reserve(m_textLines.size() +lines.size() -1);
-	auto lineIndexOffset = lineIdx +1;
-	for(auto it=lines.begin() +1;it!=lines.end();++it)
-		InsertLine(**it,lineIndexOffset++);
+	InsertLines(lines.data() +1,lines.size() -1,lineIdx +1);
 
 	auto lastInsertedLineIdx = lineIdx +lines.size() -1;
 	auto &lastInsertedLine = m_textLines.at(lastInsertedLineIdx);
 	auto insertOffset = lastInsertedLine->AppendString(postfix);
 	lastInsertedLine->AttachAnchorPoints(anchorPointsInMoveRange,text.length());
-	if(postfix.empty() == false)
-		UpdateTextOffsets(lastInsertedLineIdx);
+	m_tags.EndVolatileOffsets();
 	ParseTags(lastInsertedLineIdx,insertOffset);
 
 	OnLineChanged(*lastInsertedLine);
+	if(recordHistory)
+		m_history.RecordInsert(absOffset,text);
+
+	// Evict the oldest lines in bulk once the maximum line count has been exceeded
+	if(m_textLines.size() > m_maxLineCount)
+		PopFrontLines(m_textLines.size() -m_maxLineCount);
 	return true;
 }
 
@@ -752,25 +1290,20 @@ void FormattedText::ParseText(const util::Utf8StringView &text,std::vector<PForm
 {
 	if(text.empty())
 		return;
-	outLines.push_back(FormattedTextLine::Create(*this));
-	auto pCurLine = outLines.back();
-	TextOffset offset = 0;
-	auto it = text.begin();
-	while(offset < text.length())
+	// Split the text at new-line characters. This operates on the raw UTF-8 data, which is safe
+	// because the new-line byte can never occur within a multi-byte sequence. The split is bounded
+	// by the size of the view rather than a terminator, so embedded NUL characters are preserved.
+	std::string_view str {text.data(),text.size()};
+	for(;;)
 	{
-		auto c = *it;
-		switch(c)
+		auto lineEnd = str.find('\n');
+		if(lineEnd == std::string_view::npos)
 		{
-			case '\n':
-				outLines.push_back(FormattedTextLine::Create(*this));
-				pCurLine = outLines.back();
-				break;
-			default:
-				pCurLine->AppendCharacter(c);
-				break;
+			outLines.push_back(FormattedTextLine::Create(*this,std::string{str}));
+			break;
 		}
-		++offset;
-		++it;
+		outLines.push_back(FormattedTextLine::Create(*this,std::string{str.substr(0,lineEnd)}));
+		str.remove_prefix(lineEnd +1);
 	}
 }
 
@@ -888,7 +1421,7 @@ void FormattedText::UnitTest()
 		validate();
 	};
 
-	const auto assert_anchor_point = [this](std::stringstream &msg,const TSharedHandle<AnchorPoint> &pAnchorPoint,LineIndex lineIndex,CharOffset charOffset) -> bool {
+	const auto assert_anchor_point = [this](std::stringstream &msg,const AnchorPointHandle &pAnchorPoint,LineIndex lineIndex,CharOffset charOffset) -> bool {
 		if(pAnchorPoint.IsExpired())
 		{
 			msg<<"Expected anchor point to be in line "<<lineIndex<<", character "<<charOffset<<", but is expired!";
@@ -918,7 +1451,7 @@ void FormattedText::UnitTest()
 		msg<<" of line "<<line.GetIndex()<<"!";
 		return false;
 	};
-	const auto assert_invalid_anchor_point = [this](std::stringstream &msg,const TSharedHandle<AnchorPoint> &pAnchorPoint) -> bool {
+	const auto assert_invalid_anchor_point = [this](std::stringstream &msg,const AnchorPointHandle &pAnchorPoint) -> bool {
 		if(pAnchorPoint.IsExpired())
 			return true;
 		msg<<"Expected anchor point to be invalid, but is valid!";
@@ -1005,6 +1538,17 @@ void FormattedText::UnitTest()
 		return assert_anchor_point(msg,refPoint0,1,1) && assert_anchor_point(msg,refPoint1,2,4);
 	});
 
+	unit_test("TextInsertBeforeAdjacentAnchors",[this,&assert_anchor_point,&validate](std::stringstream &msg) -> bool {
+		AppendText("JKLMNO");
+		auto refPoint0 = CreateAnchorPoint(0,3u);
+		auto refPoint1 = CreateAnchorPoint(0,4u);
+		auto refPoint2 = CreateAnchorPoint(0,5u);
+		if(validate() == false) return false;
+		InsertText("DEF\nGHI",0,3);
+		if(validate() == false) return false;
+		return assert_anchor_point(msg,refPoint0,1,3) && assert_anchor_point(msg,refPoint1,1,4) && assert_anchor_point(msg,refPoint2,1,5);
+	});
+
 	unit_test("LineRemoveFirst",[this,&assert_anchor_point,&assert_invalid_anchor_point,&validate](std::stringstream &msg) -> bool {
 		AppendText("Abc\n");
 		auto refPoint0 = CreateAnchorPoint(0,1u);
@@ -1069,6 +1613,56 @@ void FormattedText::UnitTest()
 		return assert_anchor_point(msg,refPoint0,0,1) && assert_anchor_point(msg,refPoint1,1,1) && assert_invalid_anchor_point(msg,refPoint2);
 	});
 
+	unit_test("LineInsertMiddle",[this,&validate](std::stringstream &msg) -> bool {
+		AppendText("0\n9");
+		for(auto i=8;i>0;--i)
+		{
+			InsertText(std::to_string(i) +"\n",1,0);
+			if(validate() == false) return false;
+		}
+		for(LineIndex lineIdx=0;lineIdx<GetLineCount();++lineIdx)
+		{
+			auto *line = GetLine(lineIdx);
+			if(line->GetIndex() != lineIdx || line->GetStartOffset() != lineIdx *2)
+			{
+				msg<<"Expected line "<<lineIdx<<" to start at offset "<<(lineIdx *2)<<", but line has index "<<line->GetIndex()<<" and starts at offset "<<line->GetStartOffset()<<"!";
+				return false;
+			}
+		}
+		auto text = GetUnformattedText();
+		auto *expected = "0\n1\n2\n3\n4\n5\n6\n7\n8\n9";
+		if(text != expected)
+		{
+			msg<<"Expected '"<<expected<<"', got: '"<<text<<"'!\n";
+			return false;
+		}
+		return true;
+	});
+
+	unit_test("MaxLineCount",[this,&validate](std::stringstream &msg) -> bool {
+		SetMaxLineCount(3);
+		AppendText("0");
+		for(auto i=1;i<6;++i)
+		{
+			AppendText("\n" +std::to_string(i));
+			if(validate() == false) return false;
+		}
+		SetMaxLineCount(std::numeric_limits<uint32_t>::max());
+		if(GetLine(0)->GetStartOffset() != 0)
+		{
+			msg<<"Expected first line to start at offset 0, but starts at offset "<<GetLine(0)->GetStartOffset()<<"!";
+			return false;
+		}
+		auto text = GetUnformattedText();
+		auto *expected = "3\n4\n5";
+		if(text != expected)
+		{
+			msg<<"Expected '"<<expected<<"', got: '"<<text<<"'!\n";
+			return false;
+		}
+		return true;
+	});
+
 	unit_test("LineRemoveInvalid",[this,&validate](std::stringstream &msg) -> bool {
 		AppendText("Abc\n");
 		if(validate() == false) return false;
@@ -1320,7 +1914,622 @@ Move over several lines*/
 			{"a","def","",{}}
 		},msg);
 	});
-	
+	unit_test("TagLineRemoveEmptyTags",[this,&validate,&validate_tags](std::stringstream &msg) -> bool {
+		SetPreserveTagsOnLineRemoval(true);
+		AppendText("abc\n{[a]}{[b]}x{[/b]}{[/a]}{[c]}y\nghi{[/c]}");
+		if(validate() == false) return false;
+		RemoveLine(1);
+		if(validate() == false) return false;
+		auto text = GetUnformattedText();
+		auto *expected = "abc\n{[c]}ghi{[/c]}";
+		if(text != expected)
+		{
+			msg<<"Expected '"<<expected<<"', got: '"<<text<<"'!\n";
+			return false;
+		}
+		return validate_tags({
+			{"c","ghi","",{}}
+		},msg);
+	});
+	unit_test("QueryTags",[this,&validate](std::stringstream &msg) -> bool {
+		AppendText("{[a]}abc{[/a]}\ndef\n{[b]}ghi{[/b]}");
+		if(validate() == false) return false;
+		const auto query_tags = [this](LineIndex lineIdx,TextLength len) -> std::string {
+			std::string tagNames {};
+			for(auto &hTag : QueryTags(*GetTextCharOffset(lineIdx,0),len))
+				tagNames += hTag->GetOpeningTagComponent()->GetTagName();
+			return tagNames;
+		};
+		if(query_tags(0,3) != "a" || query_tags(1,3) != "" || query_tags(1,10) != "b")
+		{
+			msg<<"Unexpected tags overlapping the queried range!";
+			return false;
+		}
+		InsertText("x\n",0,0);
+		if(query_tags(1,3) != "a" || query_tags(2,3) != "")
+		{
+			msg<<"Unexpected tags overlapping the queried range after inserting text!";
+			return false;
+		}
+		return true;
+	});
+
+	unit_test("Batch",[this,&validate](std::stringstream &msg) -> bool {
+		AppendText("abc");
+		uint32_t numAdded = 0;
+		uint32_t numChanged = 0;
+		Callbacks callbacks {};
+		callbacks.onLineAdded = [&numAdded](FormattedTextLine&) {++numAdded;};
+		callbacks.onLineChanged = [&numChanged](FormattedTextLine&) {++numChanged;};
+		SetCallbacks(callbacks);
+		{
+			BatchGuard batch {*this};
+			AppendText("{[a]}def");
+			AppendText("\nghi{[/a]}");
+			AppendText("\njkl");
+			if(GetTags().empty() == false || numAdded != 0 || numChanged != 0)
+			{
+				SetCallbacks({});
+				msg<<"Tags or callbacks were not deferred until the end of the batch!";
+				return false;
+			}
+			RemoveLine(2);
+		}
+		SetCallbacks({});
+		if(validate() == false) return false;
+		if(numAdded != 1 || numChanged != 1)
+		{
+			msg<<"Expected 1 added and 1 changed line, got "<<numAdded<<" and "<<numChanged<<"!";
+			return false;
+		}
+		if(GetTags().size() != 1 || (*GetTags().begin())->GetOuterRange() != std::pair<TextOffset,TextLength>{3,18})
+		{
+			msg<<"Tags spanning the batched lines were not parsed correctly!";
+			return false;
+		}
+		return true;
+	});
+
+	unit_test("LinesChanged",[this,&validate](std::stringstream &msg) -> bool {
+		AppendText("abc\ndef");
+		std::string changes {};
+		Callbacks callbacks {};
+		callbacks.onLinesChanged = [&changes](LineIndex first,LineIndex count,ChangeKind kind) {
+			changes += std::to_string(static_cast<uint32_t>(kind)) +":" +std::to_string(first) +"+" +std::to_string(count) +" ";
+		};
+		SetCallbacks(callbacks);
+		InsertText("x\ny\nz",0,1);
+		PopFrontLines(2);
+		{
+			BatchGuard batch {*this};
+			AppendText("g");
+			AppendText("\nhi");
+			RemoveLine(2);
+		}
+		SetCallbacks({});
+		if(validate() == false) return false;
+		auto *expected = "2:0+1 0:1+2 1:0+2 2:1+1 ";
+		if(changes != expected)
+		{
+			msg<<"Expected line changes '"<<expected<<"', got: '"<<changes<<"'!\n";
+			return false;
+		}
+		return true;
+	});
+
+	unit_test("Snapshot",[this,&validate](std::stringstream &msg) -> bool {
+		AppendText("abc\n{[a]}def{[/a]}\nghi");
+		auto snapshot0 = Snapshot();
+		InsertText("x",0,1);
+		RemoveLine(2);
+		auto snapshot1 = Snapshot();
+		if(validate() == false) return false;
+		if(snapshot0->GetUnformattedText() != "abc\n{[a]}def{[/a]}\nghi" || snapshot0->GetFormattedText() != "abc\ndef\nghi" || snapshot1->GetUnformattedText() != GetUnformattedText())
+		{
+			msg<<"Snapshot contents don't match the state of the text at the time of their creation!";
+			return false;
+		}
+		if(&snapshot0->GetLine(1) != &snapshot1->GetLine(1) || Snapshot() != snapshot1)
+		{
+			msg<<"Unchanged lines or snapshots were not re-used!";
+			return false;
+		}
+		auto tags = snapshot1->QueryTags(*snapshot1->GetTextCharOffset(1,0),3);
+		if(tags.size() != 1 || tags.front().info->name != "a" || snapshot1->QueryTags(0,3).empty() == false || snapshot1->Substr(2,4) != "bc\n{")
+		{
+			msg<<"Unexpected tags or text in snapshot!";
+			return false;
+		}
+		return true;
+	});
+
+	unit_test("IncrementalSnapshot",[this,&validate](std::stringstream &msg) -> bool {
+		AppendText("{[a]}abc\ndef\nghi{[/a]}\njkl");
+		auto snapshot0 = Snapshot();
+		// The tag ranges change without the line containing the opening tag being modified
+		InsertText("xy",1,0);
+		auto snapshot1 = Snapshot();
+		RemoveLine(2);
+		auto snapshot2 = Snapshot();
+		if(validate() == false) return false;
+		const auto getTagRange = [](const PTextSnapshot &snapshot) -> std::pair<TextOffset,TextLength> {
+			auto &tags = snapshot->GetTags();
+			return (tags.size() == 1) ? std::pair<TextOffset,TextLength>{tags.front().outerOffset,tags.front().outerLength} : std::pair<TextOffset,TextLength>{0,0};
+		};
+		if(getTagRange(snapshot0) != std::pair<TextOffset,TextLength>{0,22} || getTagRange(snapshot1) != std::pair<TextOffset,TextLength>{0,24} ||
+			getTagRange(snapshot2) != std::pair<TextOffset,TextLength>{0,21} || snapshot2->QueryTags(20,1).size() != 1)
+		{
+			msg<<"Snapshot tags don't match the state of the text at the time of their creation!";
+			return false;
+		}
+		if(&snapshot0->GetLine(0) != &snapshot2->GetLine(0) || &snapshot0->GetLine(3) != &snapshot1->GetLine(3) || snapshot2->GetUnformattedText() != GetUnformattedText())
+		{
+			msg<<"Unchanged lines were not re-used!";
+			return false;
+		}
+		return true;
+	});
+
+	unit_test("BulkTagParsing",[this,&validate](std::stringstream &msg) -> bool {
+		// Tags spanning two lines each, which are paired up in a single pass
+		constexpr uint32_t numLinePairs = 1'024;
+		util::Utf8String str {};
+		for(auto i=0u;i<numLinePairs;++i)
+			str += "{[a]}x\ny{[/a]}{[b]}z{[/b]}\n";
+		AppendText(str +"{[c]}");
+		if(validate() == false) return false;
+		uint32_t numClosed = 0;
+		for(auto &hTag : GetTags())
+			numClosed += hTag->IsClosed() ? 1 : 0;
+		if(GetTags().size() != numLinePairs *2 +1 || numClosed != numLinePairs *2)
+		{
+			msg<<"Expected "<<(numLinePairs *2)<<" closed tags and one open tag, got "<<numClosed<<" closed tags out of "<<GetTags().size()<<"!";
+			return false;
+		}
+		auto lastLinePairOffset = *GetTextCharOffset((numLinePairs -1) *2,0);
+		auto tags = QueryTags(lastLinePairOffset,1);
+		if(tags.size() != 1 || tags.front()->GetOuterRange() != std::pair<TextOffset,TextLength>{lastLinePairOffset,14})
+		{
+			msg<<"Tags spanning multiple lines were not paired correctly!";
+			return false;
+		}
+		return true;
+	});
+	unit_test("LoadFromFile",[this,&validate](std::stringstream &msg) -> bool {
+		auto fileName = (std::filesystem::temp_directory_path() /"util_formatted_text_unit_test.txt").string();
+		std::string contents = "abc\n{[a]}def{[/a]}\n\nghi";
+		std::ofstream{fileName,std::ios::binary}<<contents;
+		auto loaded = LoadFromFile(fileName);
+		std::filesystem::remove(fileName);
+		if(loaded == false)
+		{
+			msg<<"Unable to load file '"<<fileName<<"'!";
+			return false;
+		}
+		if(validate() == false) return false;
+		if(GetLineCount() != 4 || GetUnformattedText() != contents || GetFormattedText() != "abc\ndef\n\nghi" || GetTags().size() != 1)
+		{
+			msg<<"Loaded text does not match file contents!";
+			return false;
+		}
+		if(GetLine(0)->GetUnformattedLine().IsView() == false)
+		{
+			msg<<"Unmodified line does not reference the mapped file!";
+			return false;
+		}
+		// Only the modified line should own a copy of its contents
+		InsertText("x",0,1);
+		if(validate() == false) return false;
+		if(GetLine(0)->GetUnformattedLine().IsView() || GetLine(3)->GetUnformattedLine().IsView() == false || GetUnformattedText() != "axbc\n{[a]}def{[/a]}\n\nghi")
+		{
+			msg<<"Modified line was not copied!";
+			return false;
+		}
+		return true;
+	});
+	unit_test("StreamText",[this,&validate](std::stringstream &msg) -> bool {
+		// Code point split between two chunks
+		StreamText("a\xC3");
+		FlushStreamedText();
+		StreamText("\xA9\n");
+		FlushStreamedText();
+		if(GetLineCount() != 2 || GetLine(0)->GetUnformattedLine().GetText() != "a\xC3\xA9")
+		{
+			msg<<"Split UTF-8 sequence was not appended correctly!";
+			return false;
+		}
+		constexpr uint32_t numThreads = 4;
+		constexpr uint32_t numLinesPerThread = 500;
+		std::atomic<uint32_t> numThreadsDone = 0;
+		std::vector<std::thread> threads {};
+		for(auto i=0u;i<numThreads;++i)
+		{
+			threads.push_back(std::thread{[this,i,&numThreadsDone]() {
+				for(auto j=0u;j<numLinesPerThread;++j)
+					StreamText(std::to_string(i) +" " +std::to_string(j) +"\n");
+				++numThreadsDone;
+			}});
+		}
+		while(numThreadsDone < numThreads)
+			FlushStreamedText();
+		for(auto &thread : threads)
+			thread.join();
+		FlushStreamedText();
+		if(validate() == false) return false;
+		if(GetLineCount() != numThreads *numLinesPerThread +2)
+		{
+			msg<<"Expected "<<(numThreads *numLinesPerThread +2)<<" lines, got "<<GetLineCount()<<"!";
+			return false;
+		}
+		// The lines of each thread have to retain their order
+		std::vector<uint32_t> nextLine(numThreads,0);
+		for(auto lineIdx=1u;lineIdx<GetLineCount() -1;++lineIdx)
+		{
+			std::stringstream ss {GetLine(lineIdx)->GetUnformattedLine().GetText().c_str()};
+			uint32_t threadIdx,i;
+			ss>>threadIdx>>i;
+			if(threadIdx >= numThreads || nextLine[threadIdx] != i)
+			{
+				msg<<"Unexpected line '"<<GetLine(lineIdx)->GetUnformattedLine().GetText()<<"'!";
+				return false;
+			}
+			++nextLine[threadIdx];
+		}
+		return true;
+	});
+	unit_test("Serialization",[this,&validate](std::stringstream &msg) -> bool {
+		auto text = FormattedText::Create("{[a:1,2]}abc\n{[b]}de{[/a]}f\n\nghi{[c]}");
+		auto hAnchorPoint = text->CreateAnchorPoint(1,4u);
+		std::vector<uint8_t> data {};
+		text->Serialize(data,{hAnchorPoint});
+
+		// Truncated data must be rejected without modifying the text
+		AppendText("x");
+		if(Deserialize(data.data(),data.size() -1) || GetUnformattedText() != "x")
+		{
+			msg<<"Truncated data was not rejected!";
+			return false;
+		}
+		std::vector<AnchorPointHandle> anchorPoints {};
+		if(Deserialize(data.data(),data.size(),&anchorPoints) == false)
+		{
+			msg<<"Unable to deserialize text!";
+			return false;
+		}
+		if(validate() == false) return false;
+		if(GetUnformattedText() != text->GetUnformattedText() || GetFormattedText() != text->GetFormattedText() || GetLineCount() != text->GetLineCount())
+		{
+			msg<<"Deserialized text does not match original text!";
+			return false;
+		}
+		if(GetTags().size() != text->GetTags().size())
+		{
+			msg<<"Expected "<<text->GetTags().size()<<" tags, got "<<GetTags().size()<<"!";
+			return false;
+		}
+		for(auto itTag=GetTags().begin(),itOther=text->GetTags().begin();itTag!=GetTags().end();++itTag,++itOther)
+		{
+			if((*itTag)->GetOuterRange() != (*itOther)->GetOuterRange() || (*itTag)->IsClosed() != (*itOther)->IsClosed() || (*itTag)->GetOpeningTag() != (*itOther)->GetOpeningTag())
+			{
+				msg<<"Deserialized tag '"<<(*itTag)->GetTagString()<<"' does not match original tag '"<<(*itOther)->GetTagString()<<"'!";
+				return false;
+			}
+		}
+		if(anchorPoints.size() != 1 || anchorPoints.front().IsExpired() || anchorPoints.front()->GetTextCharOffset() != hAnchorPoint->GetTextCharOffset())
+		{
+			msg<<"Anchor point was not restored!";
+			return false;
+		}
+		// Tags and anchor points have to be updated as usual when the restored text is edited
+		InsertText("xy",1,0);
+		if(validate() == false) return false;
+		if(anchorPoints.front()->GetTextCharOffset() != hAnchorPoint->GetTextCharOffset() +2 || GetFormattedText() != "abc\nxydef\n\nghi")
+		{
+			msg<<"Deserialized text was not updated correctly!";
+			return false;
+		}
+		return true;
+	});
+	unit_test("CharOffsetMapping",[this,&validate](std::stringstream &msg) -> bool {
+		AppendText("ab{[c]}cd{[/c]}e\n{[x]}yz");
+		if(validate() == false) return false;
+		if(GetFormattedText() != "abcde\nyz")
+		{
+			msg<<"Unexpected formatted text '"<<GetFormattedText()<<"'!";
+			return false;
+		}
+		// Characters of a tag map to the formatted offset of the tagged text
+		std::vector<TextOffset> expectedFormatted {0,1,2,2,2,2,2,2,3,3,3,3,3,3,3,4,5};
+		for(auto i=decltype(expectedFormatted.size()){0u};i<expectedFormatted.size();++i)
+		{
+			auto offset = GetFormattedTextOffset(i);
+			if(offset.has_value() == false || *offset != expectedFormatted.at(i))
+			{
+				msg<<"Expected formatted offset "<<expectedFormatted.at(i)<<" for unformatted offset "<<i<<"!";
+				return false;
+			}
+		}
+		std::vector<TextOffset> expectedUnformatted {0,1,7,8,15,16,22,23,24};
+		for(auto i=decltype(expectedUnformatted.size()){0u};i<expectedUnformatted.size();++i)
+		{
+			auto offset = GetUnformattedTextOffset(i);
+			if(offset.has_value() == false || *offset != expectedUnformatted.at(i))
+			{
+				msg<<"Expected unformatted offset "<<expectedUnformatted.at(i)<<" for formatted offset "<<i<<"!";
+				return false;
+			}
+		}
+		return true;
+	});
+	unit_test("UntaggedLines",[this,&validate](std::stringstream &msg) -> bool {
+		AppendText("abc\n{[a]}def{[/a]}\nghi");
+		if(validate() == false) return false;
+		auto *plainLine = GetLine(0);
+		auto *taggedLine = GetLine(1);
+		if(&plainLine->GetFormattedLine() != &plainLine->GetUnformattedLine() || &taggedLine->GetFormattedLine() == &taggedLine->GetUnformattedLine())
+		{
+			msg<<"Only tagged lines should have a separate formatted line!";
+			return false;
+		}
+		// The formatted length must not change until the line is formatted again
+		InsertText("xy",0,1);
+		if(plainLine->GetFormattedLength() != 3 || GetFormattedText() != "axybc\ndef\nghi" || plainLine->GetFormattedLength() != 5)
+		{
+			msg<<"Formatted text of untagged line was not updated correctly!";
+			return false;
+		}
+		InsertText("{[b]}",2,1);
+		if(validate() == false) return false;
+		auto *line = GetLine(2);
+		if(GetFormattedText() != "axybc\ndef\nghi" || &line->GetFormattedLine() == &line->GetUnformattedLine() || GetUnformattedTextOffset(12) != 28)
+		{
+			msg<<"Line was not formatted correctly after a tag was added!";
+			return false;
+		}
+		return true;
+	});
+	unit_test("PieceTable",[this,&validate](std::stringstream &msg) -> bool {
+		SetPieceTableThreshold(10);
+		AppendText("abc{[a]}def{[/a]}\nghi");
+		InsertText("xy",0,1);
+		RemoveText(0,3,2);
+		MoveText(0,0,3,0,11);
+		if(validate() == false) return false;
+		auto &line = GetLine(0)->GetUnformattedLine();
+		if(line.IsPieceTable() == false || GetLine(1)->GetUnformattedLine().IsPieceTable())
+		{
+			msg<<"Only edited lines above the threshold should be stored in a piece table!";
+			return false;
+		}
+		if(GetUnformattedText() != "{[a]}defaxy{[/a]}\nghi" || GetFormattedText() != "defaxy\nghi" || GetTags().size() != 1)
+		{
+			msg<<"Unexpected text '"<<GetUnformattedText()<<"' after editing piece table!";
+			return false;
+		}
+		auto segments = line.GetSegments(5,6);
+		std::string segmentText;
+		for(auto &segment : segments)
+			segmentText += segment;
+		if(segments.size() < 2 || segmentText != "defaxy")
+		{
+			msg<<"Unexpected segments for range of piece table!";
+			return false;
+		}
+		// Moving characters within the same line only rearranges the pieces
+		SetPieceTableThreshold(0);
+		InsertText("jkl",1,3);
+		SetPieceTableThreshold(UNTIL_THE_END);
+		auto *lastLine = GetLine(1);
+		if(lastLine->Move(0,2,*lastLine) == false || lastLine->GetUnformattedLine().IsPieceTable() == false || lastLine->GetUnformattedLine().GetText() != "ijklgh")
+		{
+			msg<<"Unexpected text '"<<lastLine->GetUnformattedLine().GetText()<<"' after moving characters within piece table!";
+			return false;
+		}
+		return true;
+	});
+	unit_test("GapBuffer",[this,&validate](std::stringstream &msg) -> bool {
+		SetTagsEnabled(false);
+		AppendText("hello world\nabc");
+		// Typing and deleting at the same position
+		for(auto c : std::string{"brave "})
+			InsertText(std::string(1,c),0,6 +GetLine(0)->GetLength() -11);
+		RemoveText(0,11,1);
+		RemoveText(0,10,1);
+		InsertText("X",0,10);
+		auto &line = GetLine(0)->GetUnformattedLine();
+		auto isGapBuffer = line.IsGapBuffer();
+		auto formattedText = GetFormattedText();
+		auto text = GetUnformattedText();
+		SetTagsEnabled(true);
+		if(validate() == false) return false;
+		if(isGapBuffer == false || line.IsGapBuffer())
+		{
+			msg<<"Line should be stored in a gap buffer while it is being edited!";
+			return false;
+		}
+		if(text != "hello bravXworld\nabc" || formattedText != text)
+		{
+			msg<<"Unexpected text '"<<text<<"' after editing gap buffer!";
+			return false;
+		}
+		return true;
+	});
+	unit_test("MoveTextInPlace",[this,&validate,&assert_anchor_point](std::stringstream &msg) -> bool {
+		SetTagsEnabled(false);
+		AppendText("abc def\nghi jkl\nmno");
+		auto refPoint0 = CreateAnchorPoint(1,4u);
+		auto refPoint1 = CreateAnchorPoint(1,0u);
+		auto refPoint2 = CreateAnchorPoint(2,0u);
+		auto success = MoveText(1,4,3,0,0); // -> jklabc def\nghi \nmno
+		success = success && RemoveText(0,9,2); // -> jklabc deghi \nmno
+		success = success && MoveText(0,0,3,0,6); // -> abcjkl deghi \nmno
+		success = success && MoveText(1,0,2,0,0); // -> mnabcjkl deghi \no
+		auto text = GetUnformattedText();
+		SetTagsEnabled(true);
+		if(validate() == false) return false;
+		auto *expected = "mnabcjkl deghi \no";
+		if(success == false || text != expected)
+		{
+			msg<<"Expected '"<<expected<<"', got: '"<<text<<"'!\n";
+			return false;
+		}
+		return assert_anchor_point(msg,refPoint0,0,5) && assert_anchor_point(msg,refPoint1,0,11) && assert_anchor_point(msg,refPoint2,0,0);
+	});
+	unit_test("RemoveTextRange",[this,&validate,&assert_anchor_point](std::stringstream &msg) -> bool {
+		AppendText("ab\ncd\n\nef\ngh\nij\n\nkl");
+		auto refPoint0 = CreateAnchorPoint(5,0u);
+		auto refPoint1 = CreateAnchorPoint(7,1u);
+		std::string changes {};
+		Callbacks callbacks {};
+		callbacks.onLinesChanged = [&changes](LineIndex first,LineIndex count,ChangeKind kind) {
+			changes += std::to_string(static_cast<uint32_t>(kind)) +":" +std::to_string(first) +"+" +std::to_string(count) +" ";
+		};
+		SetCallbacks(callbacks);
+		// The fully covered lines are removed at once
+		auto success = RemoveText(static_cast<TextOffset>(1),10); // -> ah\nij\n\nkl
+		auto lineChanges = changes;
+		// Range ending at the line break of an empty line
+		success = success && RemoveText(static_cast<TextOffset>(4),3); // -> ah\nikl
+		SetCallbacks({});
+		if(validate() == false) return false;
+		auto text = GetUnformattedText();
+		auto *expected = "ah\nikl";
+		if(success == false || text != expected)
+		{
+			msg<<"Expected '"<<expected<<"', got: '"<<text<<"'!\n";
+			return false;
+		}
+		if(lineChanges.rfind("1:1+3 ",0) != 0)
+		{
+			msg<<"Expected covered lines to be removed in a single step, got line changes: '"<<lineChanges<<"'!\n";
+			return false;
+		}
+		return assert_anchor_point(msg,refPoint0,1,0) && assert_anchor_point(msg,refPoint1,1,2);
+	});
+
+	unit_test("UndoRedo",[this,&validate,&assert_anchor_point](std::stringstream &msg) -> bool {
+		AppendText("abc\ndef\nghi");
+		SetHistoryBudget(1'024);
+		auto refPoint = CreateAnchorPoint(2,1u);
+		auto expectText = [this,&msg](const char *expected) -> bool {
+			auto text = GetUnformattedText();
+			if(text == expected)
+				return true;
+			msg<<"Expected '"<<expected<<"', got: '"<<text<<"'!\n";
+			return false;
+		};
+		InsertText("XY\nZ",0,1); // -> aXY\nZbc\ndef\nghi
+		{
+			// Undone as a single step
+			BatchGuard batch {*this};
+			RemoveText(2,0,2); // -> aXY\nZbc\nf\nghi
+			MoveText(1,0,1,1,3); // -> aXY\nbcZ\nf\nghi
+		}
+		if(expectText("aXY\nbcZ\nf\nghi") == false || assert_anchor_point(msg,refPoint,3,1) == false) return false;
+		if(Undo() == false || expectText("aXY\nZbc\ndef\nghi") == false) return false;
+		if(Undo() == false || expectText("abc\ndef\nghi") == false || CanUndo()) return false;
+		if(validate() == false || assert_anchor_point(msg,refPoint,2,1) == false) return false;
+		if(Redo() == false || Redo() == false || CanRedo() || expectText("aXY\nbcZ\nf\nghi") == false) return false;
+		if(assert_anchor_point(msg,refPoint,3,1) == false) return false;
+
+		// New edits discard the undone groups
+		Undo();
+		AppendText("!");
+		if(CanRedo())
+		{
+			msg<<"Expected redo history to be discarded after an edit!\n";
+			return false;
+		}
+		SetHistoryBudget(1);
+		auto canUndo = CanUndo();
+		SetHistoryBudget(0);
+		if(canUndo)
+		{
+			msg<<"Expected history to be discarded once the budget is exceeded!\n";
+			return false;
+		}
+		return validate();
+	});
+
+	unit_test("PopFrontLinesTags",[this](std::stringstream &msg) -> bool {
+		SetPreserveTagsOnLineRemoval(false);
+		AppendText("{[a]}x{[/a]}\n{[b]}y\nz{[/b]}\nw");
+		PopFrontLine();
+		SetPreserveTagsOnLineRemoval(true);
+		auto tags = QueryTags(0,UNTIL_THE_END);
+		if(GetTags().size() != 1 || tags.size() != 1 || tags.front()->GetOpeningTagComponent()->GetTagName() != "b" || tags.front()->GetOuterRange() != std::pair<TextOffset,TextLength>{0,14})
+		{
+			msg<<"Expected only the tags within the removed line to be erased!\n";
+			return false;
+		}
+		return true;
+	});
+
+	unit_test("RemoveTagComponentText",[this](std::stringstream &msg) -> bool {
+		AppendText("{[a]}x{[/a]}\n{[b]}y{[/b]}\n{[c]}z{[/c]}");
+		RemoveText(0,6,6); // -> {[a]}x\n{[b]}y{[/b]}\n{[c]}z{[/c]}
+		RemoveLine(1); // -> {[a]}x\n{[c]}z{[/c]}
+		auto tags = QueryTags(GetCharCount() -2,1);
+		if(tags.size() != 2 || tags.front()->IsClosed() || tags.back()->GetOpeningTagComponent()->GetTagName() != "c")
+		{
+			msg<<"Expected the unclosed tag 'a' and tag 'c' to overlap the end of the text, got "<<tags.size()<<" tags!\n";
+			return false;
+		}
+		return true;
+	});
+
+	unit_test("UndoRedoFailure",[this,&validate](std::stringstream &msg) -> bool {
+		AppendText("abc");
+		SetHistoryBudget(1'024);
+		{
+			BatchGuard batch {*this};
+			InsertText("Z",0,LAST_CHAR); // -> abcZ
+			InsertText("XY",0,0); // -> XYabcZ
+		}
+		{
+			// Edits the text behind the back of the history, so the group can only be undone partially
+			HistorySuspension suspension {*this};
+			RemoveText(0,3,3); // -> XYa
+		}
+		auto undone = Undo();
+		auto text = GetUnformattedText();
+		if(undone || text != "XYa" || CanUndo())
+		{
+			msg<<"Expected failed undo to be reverted and the history to be cleared, got: '"<<text<<"'!\n";
+			return false;
+		}
+
+		// Undoing a group may not exceed the maximum line count
+		SetText("a\nb\nc");
+		RemoveLine(0); // -> b\nc
+		SetMaxLineCount(2);
+		auto lineCount = Undo() ? GetLineCount() : 0;
+		SetMaxLineCount(std::numeric_limits<uint32_t>::max());
+		SetHistoryBudget(0);
+		if(lineCount != 2)
+		{
+			msg<<"Expected undo to evict lines beyond the maximum line count, got "<<lineCount<<" lines!\n";
+			return false;
+		}
+		return validate();
+	});
+
+	unit_test("EmbeddedNul",[this](std::stringstream &msg) -> bool {
+		AppendText(std::string{"a\0b\nc\0d",7});
+		if(GetLineCount() != 2 || GetLine(0)->GetLength() != 3 || GetLine(1)->GetLength() != 3)
+		{
+			msg<<"Expected two lines with three characters each!\n";
+			return false;
+		}
+		InsertText(std::string{"\0",1},1,1);
+		if(GetUnformattedText() != std::string{"a\0b\nc\0\0d",8} || GetLine(1)->GetUnformattedLine().GetData() != std::string_view{"c\0\0d",4})
+		{
+			msg<<"Expected embedded NUL characters to be preserved!\n";
+			return false;
+		}
+		return true;
+	});
+
 	if(allSucceeded == true)
 		std::cout<<"All unit tests have succeeded!"<<std::endl;
 }
@@ -1342,12 +2551,9 @@ void FormattedText::DebugPrint(bool printTags) const
 		{
 			strAnchors.at(startAnchorOffset) = '^';
 
-			auto *pNextLineAnchor = startAnchor.GetNextLineAnchorStartPoint();
-			for(auto &hChild : startAnchor.GetChildren())
+			for(auto &child : startAnchor.GetChildren())
 			{
-				if(hChild.IsExpired() || hChild.Get() == pNextLineAnchor)
-					continue;
-				auto anchorOffset = hChild->GetTextCharOffset() -offset;
+				auto anchorOffset = child.GetTextCharOffset() -offset;
 				strAnchors.at(anchorOffset) = '^';
 			}
 		}
@@ -1423,12 +2629,12 @@ bool FormattedText::Validate(std::stringstream &msg) const
 		}
 
 
-		for(auto &hAnchorPoint : line->GetAnchorPoints())
+		for(auto &lineAnchorPoint : anchorPoint.GetChildren())
 		{
-			if(hAnchorPoint.IsExpired() || hAnchorPoint->IsValid() == false)
+			if(lineAnchorPoint.IsValid() == false)
 				continue;
-			auto &line = hAnchorPoint->GetLine();
-			if(line.IsInRange(hAnchorPoint->GetTextCharOffset()) == false)
+			auto &line = lineAnchorPoint.GetLine();
+			if(line.IsInRange(lineAnchorPoint.GetTextCharOffset()) == false)
 			{
 				msg<<"Anchor point is out of range of its line!";
 				return false;
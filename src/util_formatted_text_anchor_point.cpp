@@ -9,11 +9,111 @@
 
 using namespace util::text;
 #pragma optimize("",off)
+AnchorPointList::Iterator::Iterator(AnchorPoint *anchorPoint)
+	: m_anchorPoint{anchorPoint},m_next{anchorPoint ? anchorPoint->m_link.next : nullptr}
+{}
+AnchorPointList::Iterator::reference AnchorPointList::Iterator::operator*() const {return *m_anchorPoint;}
+AnchorPointList::Iterator::pointer AnchorPointList::Iterator::operator->() const {return m_anchorPoint;}
+AnchorPointList::Iterator &AnchorPointList::Iterator::operator++()
+{
+	m_anchorPoint = m_next;
+	m_next = m_anchorPoint ? m_anchorPoint->m_link.next : nullptr;
+	return *this;
+}
+bool AnchorPointList::Iterator::operator==(const Iterator &other) const {return m_anchorPoint == other.m_anchorPoint;}
+bool AnchorPointList::Iterator::operator!=(const Iterator &other) const {return operator==(other) == false;}
+
+AnchorPointList::~AnchorPointList()
+{
+	for(auto *anchorPoint=m_first;anchorPoint;)
+	{
+		auto &link = anchorPoint->m_link;
+		anchorPoint = link.next;
+		link = {};
+	}
+}
+void AnchorPointList::PushBack(AnchorPoint &anchorPoint)
+{
+	auto &link = anchorPoint.m_link;
+	link.prev = m_last;
+	link.next = nullptr;
+	if(m_last)
+		m_last->m_link.next = &anchorPoint;
+	else
+		m_first = &anchorPoint;
+	m_last = &anchorPoint;
+	++m_size;
+}
+void AnchorPointList::Remove(AnchorPoint &anchorPoint)
+{
+	auto &link = anchorPoint.m_link;
+	if(link.prev)
+		link.prev->m_link.next = link.next;
+	else
+		m_first = link.next;
+	if(link.next)
+		link.next->m_link.prev = link.prev;
+	else
+		m_last = link.prev;
+	link = {};
+	--m_size;
+}
+size_t AnchorPointList::size() const {return m_size;}
+bool AnchorPointList::empty() const {return m_size == 0;}
+AnchorPointList::Iterator AnchorPointList::begin() const {return Iterator{m_first};}
+AnchorPointList::Iterator AnchorPointList::end() const {return Iterator{nullptr};}
+
+//////////////
+
+AnchorPointPool *AnchorPointPool::Create() {return new AnchorPointPool{};}
+void AnchorPointPool::AddReference() {++m_refCount;}
+void AnchorPointPool::RemoveReference()
+{
+	if(--m_refCount == 0)
+		delete this;
+}
+uint32_t AnchorPointPool::Allocate()
+{
+	if(m_firstFreeSlot == std::numeric_limits<uint32_t>::max())
+	{
+		auto slabSize = FIRST_SLAB_SIZE<<m_slabs.size();
+		m_slabs.push_back(std::make_unique<Slot[]>(slabSize));
+		// All slots of the new slab are added to the free list in order
+		auto &slab = m_slabs.back();
+		for(auto i=decltype(slabSize){0u};i<slabSize;++i)
+			slab[i].refCount = (i +1 < slabSize) ? (m_slotCount +i +1) : std::numeric_limits<uint32_t>::max();
+		m_firstFreeSlot = m_slotCount;
+		m_slotCount += slabSize;
+	}
+	auto index = m_firstFreeSlot;
+	m_firstFreeSlot = GetSlot(index).refCount;
+	return index;
+}
+void AnchorPointPool::Destroy(uint32_t index)
+{
+	auto &slot = GetSlot(index);
+	auto *anchorPoint = slot.anchorPoint;
+	// Invalidates all remaining handles to the anchor point
+	slot.anchorPoint = nullptr;
+	++slot.generation;
+	anchorPoint->~AnchorPoint();
+	slot.refCount = m_firstFreeSlot;
+	m_firstFreeSlot = index;
+}
+
+//////////////
+
 AnchorPoint::AnchorPoint(TextOffset charOffset,bool allowOutOfBounds)
-	: m_wpLine{},m_charOffset{charOffset},m_bAllowOutOfBounds{allowOutOfBounds}
+	: m_charOffset{charOffset},m_bAllowOutOfBounds{allowOutOfBounds}
 {}
+AnchorPoint::~AnchorPoint()
+{
+	if(m_parent)
+		m_parent->RemoveChild(*this);
+}
+AnchorPointPool &AnchorPoint::GetPool(FormattedTextLine &line) {return line.GetTargetText().GetAnchorPointPool();}
 
-util::TSharedHandle<AnchorPoint> AnchorPoint::GetHandle() {return util::claim_shared_handle_ownership(m_handle);}
+AnchorPointHandle AnchorPoint::GetHandle() {return m_pool->GetHandle(*this);}
 bool AnchorPoint::IsValid() const {return m_wpLine.expired() == false;}
 
 bool AnchorPoint::operator==(const AnchorPoint &other) const
@@ -29,16 +129,8 @@ bool AnchorPoint::operator>=(const AnchorPoint &other) const {return m_charOffse
 LineIndex AnchorPoint::GetLineIndex() const {return GetLine().GetIndex();}
 FormattedTextLine &AnchorPoint::GetLine() const {return *m_wpLine.lock();}
 
-void AnchorPoint::SetLine(FormattedTextLine &line)
-{
-	ClearLine();
-	line.AttachAnchorPoint(*this);
-	m_wpLine = line.shared_from_this();
-}
-LineStartAnchorPoint *AnchorPoint::GetParent()
-{
-	return m_parent.IsValid() ? static_cast<LineStartAnchorPoint*>(m_parent.Get()) : nullptr;
-}
+void AnchorPoint::SetLine(FormattedTextLine &line) {m_wpLine = line.shared_from_this();}
+LineStartAnchorPoint *AnchorPoint::GetParent() {return m_parent;}
 void AnchorPoint::SetParent(LineStartAnchorPoint &parent)
 {
 	if(&parent == this)
@@ -46,8 +138,8 @@ void AnchorPoint::SetParent(LineStartAnchorPoint &parent)
 	ClearParent();
 
 	auto offset = GetTextCharOffset();
-	parent.m_children.push_back(m_handle);
-	m_parent = parent.GetHandle();
+	parent.m_children.PushBack(*this);
+	m_parent = &parent;
 	SetOffset(offset); // Re-apply offset
 }
 bool AnchorPoint::ShouldAllowOutOfBounds() const {return m_bAllowOutOfBounds;}
@@ -55,24 +147,19 @@ bool AnchorPoint::IsInRange(TextOffset startOffset,TextLength len) const
 {
 	if(len == 0)
 		return false;
-	return m_charOffset >= startOffset && (len == UNTIL_THE_END || m_charOffset < startOffset +len);
+	auto offset = GetTextCharOffset();
+	return offset >= startOffset && (len == UNTIL_THE_END || offset < startOffset +len);
 }
 void AnchorPoint::ClearParent()
 {
-	if(m_parent.IsExpired())
+	if(m_parent == nullptr)
 		return;
 	auto offset = GetTextCharOffset();
-	auto *parent = static_cast<LineStartAnchorPoint*>(m_parent.Get());
-	parent->RemoveChild(*this);
-	m_parent = decltype(m_parent){};
+	m_parent->RemoveChild(*this);
+	m_parent = nullptr;
 	SetOffset(offset); // Re-apply offset
 }
-void AnchorPoint::ClearLine()
-{
-	if(m_wpLine.expired() == false)
-		m_wpLine.lock()->DetachAnchorPoint(*this);
-	m_wpLine = {};
-}
+void AnchorPoint::ClearLine() {m_wpLine = {};}
 bool AnchorPoint::IsAttachedToLine(FormattedTextLine &line) const
 {
 	return (m_wpLine.expired() == false) && m_wpLine.lock().get() == &line;
@@ -81,7 +168,7 @@ bool AnchorPoint::IsLineStartAnchorPoint() const {return false;}
 TextOffset AnchorPoint::GetTextCharOffset() const
 {
 	auto offset = m_charOffset;
-	if(m_parent.IsValid())
+	if(m_parent)
 		offset += m_parent->GetTextCharOffset();
 	return offset;
 }
@@ -95,7 +182,7 @@ void AnchorPoint::ShiftByOffset(ShiftOffset offset) {SetOffset(GetTextCharOffset
 void AnchorPoint::SetOffset(TextOffset offset)
 {
 	TextOffset baseOffset = 0;
-	if(m_parent.IsValid())
+	if(m_parent)
 		baseOffset = m_parent->GetTextCharOffset();
 	m_charOffset = offset -baseOffset;
 	if(m_wpLine.expired() || ShouldAllowOutOfBounds())
@@ -107,60 +194,26 @@ void AnchorPoint::SetOffset(TextOffset offset)
 
 ////////////
 
-const std::vector<util::TWeakSharedHandle<AnchorPoint>> &LineStartAnchorPoint::GetChildren() const {return const_cast<LineStartAnchorPoint*>(this)->GetChildren();}
-std::vector<util::TWeakSharedHandle<AnchorPoint>> &LineStartAnchorPoint::GetChildren() {return m_children;}
-void LineStartAnchorPoint::RemoveChild(const AnchorPoint &anchorPoint)
-{
-	auto it = std::find_if(m_children.begin(),m_children.end(),[&anchorPoint](const util::TWeakSharedHandle<AnchorPoint> &hChild) {
-		return hChild.IsValid() && hChild.Get() == &anchorPoint;
-	});
-	if(it == m_children.end())
-		return;
-	m_children.erase(it);
-
-}
-void LineStartAnchorPoint::ShiftByOffset(ShiftOffset offset)
+LineStartAnchorPoint::~LineStartAnchorPoint()
 {
-	// Faster than recursion
-	auto *pNextLineAnchorStartPoint = this;
-	while(pNextLineAnchorStartPoint)
-	{
-		pNextLineAnchorStartPoint->SetOffset(pNextLineAnchorStartPoint->GetTextCharOffset() +offset);
-		pNextLineAnchorStartPoint = pNextLineAnchorStartPoint->GetNextLineAnchorStartPoint();
-	}
-}
-void LineStartAnchorPoint::SetNextLineAnchorStartPoint(LineStartAnchorPoint &anchor)
-{
-	if(&anchor == this)
-		throw std::logic_error("Next anchor cannot be itself!");
-	if(&anchor == GetNextLineAnchorStartPoint())
-		return;
-	ClearNextLineAnchorStartPoint();
-	m_nextLineAnchorStartPoint = anchor.GetHandle();
-	anchor.SetPreviousLineAnchorStartPoint(*this);
+	// The children are detached, but their offsets remain relative to this anchor point
+	for(auto &child : m_children)
+		child.m_parent = nullptr;
 }
+const AnchorPointList &LineStartAnchorPoint::GetChildren() const {return const_cast<LineStartAnchorPoint*>(this)->GetChildren();}
+AnchorPointList &LineStartAnchorPoint::GetChildren() {return m_children;}
+void LineStartAnchorPoint::RemoveChild(AnchorPoint &anchorPoint) {m_children.Remove(anchorPoint);}
+void LineStartAnchorPoint::ShiftByOffset(ShiftOffset offset) {}
+TextOffset LineStartAnchorPoint::GetTextCharOffset() const {return IsValid() ? GetLine().GetStartOffset() : 0;}
 bool LineStartAnchorPoint::IsLineStartAnchorPoint() const {return true;}
-void LineStartAnchorPoint::ClearNextLineAnchorStartPoint()
-{
-	m_nextLineAnchorStartPoint = decltype(m_nextLineAnchorStartPoint){};
-}
 LineStartAnchorPoint *LineStartAnchorPoint::GetNextLineAnchorStartPoint()
 {
-	return m_nextLineAnchorStartPoint.IsExpired() ? nullptr : static_cast<LineStartAnchorPoint*>(m_nextLineAnchorStartPoint.Get());
+	auto *line = IsValid() ? GetLine().GetNextLine() : nullptr;
+	return line ? &line->GetStartAnchorPoint() : nullptr;
 }
-void LineStartAnchorPoint::ClearPreviousLineAnchorStartPoint()
+LineStartAnchorPoint *LineStartAnchorPoint::GetPreviousLineAnchorStartPoint()
 {
-	m_prevLineAnchorStartPoint = decltype(m_nextLineAnchorStartPoint){};
-}
-void LineStartAnchorPoint::SetPreviousLineAnchorStartPoint(LineStartAnchorPoint &anchor)
-{
-	if(&anchor == this)
-		throw std::logic_error("Previous anchor cannot be itself!");
-	if(&anchor == GetPreviousLineAnchorStartPoint())
-		return;
-	ClearPreviousLineAnchorStartPoint();
-	m_prevLineAnchorStartPoint = anchor.GetHandle();
-	anchor.SetNextLineAnchorStartPoint(*this);
+	auto *line = IsValid() ? GetLine().GetPreviousLine() : nullptr;
+	return line ? &line->GetStartAnchorPoint() : nullptr;
 }
-LineStartAnchorPoint *LineStartAnchorPoint::GetPreviousLineAnchorStartPoint() {return static_cast<LineStartAnchorPoint*>(m_prevLineAnchorStartPoint.Get());}
 #pragma optimize("",on)
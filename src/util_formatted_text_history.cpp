@@ -0,0 +1,170 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "util_formatted_text_history.hpp"
+
+using namespace util::text;
+
+EditHistory::Delta EditHistory::Invert(const Delta &delta)
+{
+	auto inverse = delta;
+	switch(delta.type)
+	{
+	case DeltaType::Insert:
+		inverse.type = DeltaType::Remove;
+		break;
+	case DeltaType::Remove:
+		inverse.type = DeltaType::Insert;
+		break;
+	case DeltaType::Move:
+		inverse.offset = delta.targetOffset;
+		inverse.targetOffset = delta.offset;
+		break;
+	}
+	return inverse;
+}
+
+void EditHistory::SetBudget(size_t budget)
+{
+	m_budget = budget;
+	if(m_budget == 0)
+	{
+		Clear();
+		return;
+	}
+	Trim();
+}
+size_t EditHistory::GetBudget() const {return m_budget;}
+bool EditHistory::IsEnabled() const {return m_budget > 0;}
+size_t EditHistory::GetSize() const {return m_size;}
+
+size_t EditHistory::GetSize(const Delta &delta) {return sizeof(delta) +delta.text.size();}
+size_t EditHistory::GetSize(const Group &group)
+{
+	size_t size = 0;
+	for(auto &delta : group)
+		size += GetSize(delta);
+	return size;
+}
+
+void EditHistory::RecordInsert(TextOffset offset,const util::Utf8StringView &text)
+{
+	if(text.empty())
+		return;
+	Record({DeltaType::Insert,offset,0,text.length(),text.to_str()});
+}
+void EditHistory::RecordRemove(TextOffset offset,const util::Utf8StringView &text)
+{
+	if(text.empty())
+		return;
+	Record({DeltaType::Remove,offset,0,text.length(),text.to_str()});
+}
+void EditHistory::RecordMove(TextOffset offset,TextLength len,TextOffset targetOffset)
+{
+	if(len == 0 || offset == targetOffset)
+		return;
+	Record({DeltaType::Move,offset,targetOffset,len,""});
+}
+void EditHistory::Record(Delta delta)
+{
+	if(IsEnabled() == false || m_groupDiscarded)
+		return;
+	// The groups that could have been redone are based on a text that doesn't exist anymore
+	for(auto &group : m_redoGroups)
+		m_size -= GetSize(group);
+	m_redoGroups.clear();
+
+	if(m_group.empty() == false)
+	{
+		auto &last = m_group.back();
+		auto lastSize = GetSize(last);
+		if(Merge(delta))
+		{
+			m_size += GetSize(last) -lastSize;
+			Trim();
+			return;
+		}
+	}
+	m_size += GetSize(delta);
+	m_group.push_back(std::move(delta));
+	Trim();
+}
+bool EditHistory::Merge(const Delta &delta)
+{
+	auto &last = m_group.back();
+	if(delta.type != last.type)
+		return false;
+	switch(delta.type)
+	{
+	case DeltaType::Insert:
+		if(delta.offset != last.offset +last.length)
+			return false;
+		last.text += delta.text;
+		break;
+	case DeltaType::Remove:
+		if(delta.offset == last.offset)
+			last.text += delta.text; // Characters removed in front of the cursor
+		else if(delta.offset +delta.length == last.offset)
+		{
+			// Characters removed behind the cursor
+			last.text = delta.text +last.text;
+			last.offset = delta.offset;
+		}
+		else
+			return false;
+		break;
+	default:
+		return false;
+	}
+	last.length += delta.length;
+	return true;
+}
+void EditHistory::EndGroup()
+{
+	m_groupDiscarded = false;
+	if(m_group.empty())
+		return;
+	m_undoGroups.push_back(std::move(m_group));
+	m_group.clear();
+	Trim();
+}
+void EditHistory::Trim()
+{
+	while(m_size > m_budget && m_undoGroups.empty() == false)
+	{
+		m_size -= GetSize(m_undoGroups.front());
+		m_undoGroups.pop_front();
+	}
+	if(m_size <= m_budget || m_group.empty())
+		return;
+	// The current group can't be undone partially, so all of it is discarded
+	m_size -= GetSize(m_group);
+	m_group.clear();
+	m_groupDiscarded = true;
+}
+
+const EditHistory::Group *EditHistory::GetUndoGroup() const {return m_undoGroups.empty() ? nullptr : &m_undoGroups.back();}
+const EditHistory::Group *EditHistory::GetRedoGroup() const {return m_redoGroups.empty() ? nullptr : &m_redoGroups.back();}
+void EditHistory::PopUndoGroup()
+{
+	if(m_undoGroups.empty())
+		return;
+	m_redoGroups.push_back(std::move(m_undoGroups.back()));
+	m_undoGroups.pop_back();
+}
+void EditHistory::PopRedoGroup()
+{
+	if(m_redoGroups.empty())
+		return;
+	m_undoGroups.push_back(std::move(m_redoGroups.back()));
+	m_redoGroups.pop_back();
+}
+void EditHistory::Clear()
+{
+	m_undoGroups.clear();
+	m_redoGroups.clear();
+	m_group.clear();
+	m_groupDiscarded = false;
+	m_size = 0;
+}
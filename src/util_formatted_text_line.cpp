@@ -3,6 +3,7 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 #include "util_formatted_text_line.hpp"
+#include "util_formatted_text.hpp"
 #include "util_formatted_text_tag.hpp"
 #include "util_formatted_text_anchor_point.hpp"
 #include <assert.h>
@@ -12,71 +13,69 @@
 
 using namespace util::text;
 
-PFormattedTextLine FormattedTextLine::Create(FormattedText &text,const std::string &line)
+// Allows make_shared to access the protected constructors, so the line and its control block share a single allocation
+struct SharedFormattedTextLine
+	: public FormattedTextLine
 {
-	return PFormattedTextLine{new FormattedTextLine{text,line}};
-}
+	template<typename TLine>
+		SharedFormattedTextLine(FormattedText &text,TLine line)
+			: FormattedTextLine{text,std::move(line)}
+	{}
+};
+PFormattedTextLine FormattedTextLine::Create(FormattedText &text,std::string line) {return std::make_shared<SharedFormattedTextLine>(text,std::move(line));}
+PFormattedTextLine FormattedTextLine::Create(FormattedText &text,TextLine line) {return std::make_shared<SharedFormattedTextLine>(text,std::move(line));}
 FormattedTextLine::~FormattedTextLine()
 {
-	for(auto &hAnchorPoint : m_anchorPoints)
-	{
-		if(hAnchorPoint.IsValid())
-			hAnchorPoint.Remove();
-	}
-	m_anchorPoints.clear();
+	// All anchor points of the line are children of its start anchor point
+	if(m_startAnchorPoint.IsValid() == false)
+		return;
+	for(auto &anchorPoint : m_startAnchorPoint->GetChildren())
+		anchorPoint.GetHandle().Remove();
+	m_startAnchorPoint.Remove();
 }
-FormattedTextLine::FormattedTextLine(FormattedText &text,const std::string &line)
-	: m_text{text}
+FormattedTextLine::FormattedTextLine(FormattedText &text,std::string line)
+	: m_text{text},m_unformattedLine{std::move(line)}
 {
-	if(line.empty())
-		return;
-	m_unformattedLine = line;
-	m_bDirty = true;
+	m_bDirty = (m_unformattedLine.GetLength() > 0);
 }
-void FormattedTextLine::Initialize(LineIndex lineIndex)
+FormattedTextLine::FormattedTextLine(FormattedText &text,TextLine line)
+	: m_text{text},m_unformattedLine{std::move(line)}
 {
-	m_lineIndex = lineIndex;
-	m_startAnchorPoint = AnchorPoint::Create<LineStartAnchorPoint>(*this);
+	m_bDirty = (m_unformattedLine.GetLength() > 0);
 }
-void FormattedTextLine::SetIndex(LineIndex lineIndex) {m_lineIndex = lineIndex;}
-LineIndex FormattedTextLine::GetIndex() const {return m_lineIndex;}
-void FormattedTextLine::DetachAnchorPoint(const AnchorPoint &anchorPoint)
+LineIndex FormattedTextLine::GetIndex() const {return m_treeNode ? LineTree::GetIndex(*m_treeNode) : INVALID_LINE_INDEX;}
+FormattedTextLine *FormattedTextLine::GetPreviousLine() const
 {
-	auto it = std::find_if(m_anchorPoints.begin(),m_anchorPoints.end(),[&anchorPoint](const util::TWeakSharedHandle<AnchorPoint> &hAnchorPoint) {
-		return hAnchorPoint.Get() == &anchorPoint;
-	});
-	if(it == m_anchorPoints.end())
-		return;
-	m_anchorPoints.erase(it);
+	auto *node = m_treeNode ? LineTree::GetPrevious(m_treeNode) : nullptr;
+	return node ? node->line.get() : nullptr;
 }
-void FormattedTextLine::AttachAnchorPoint(AnchorPoint &anchorPoint)
+FormattedTextLine *FormattedTextLine::GetNextLine() const
 {
-	auto it = std::find_if(m_anchorPoints.begin(),m_anchorPoints.end(),[&anchorPoint](const util::TWeakSharedHandle<AnchorPoint> &hAnchorPoint) {
-		return hAnchorPoint.Get() == &anchorPoint;
-	});
-    m_anchorPoints.push_back(util::TWeakSharedHandle<util::text::AnchorPoint>{anchorPoint.GetHandle()});
+	auto *node = m_treeNode ? LineTree::GetNext(m_treeNode) : nullptr;
+	return node ? node->line.get() : nullptr;
 }
 
 const TextLine &FormattedTextLine::GetFormattedLine() const {return const_cast<FormattedTextLine*>(this)->GetFormattedLine();}
-TextLine &FormattedTextLine::GetFormattedLine()
-{
-	Format();
-	return m_formattedLine;
-}
+TextLine &FormattedTextLine::GetFormattedLine() {return Format();}
 
 const TextLine &FormattedTextLine::GetUnformattedLine() const {return const_cast<FormattedTextLine*>(this)->GetUnformattedLine();}
 TextLine &FormattedTextLine::GetUnformattedLine() {return m_unformattedLine;}
 
 const std::vector<util::TSharedHandle<TextTagComponent>> &FormattedTextLine::GetTagComponents() const {return const_cast<FormattedTextLine*>(this)->GetTagComponents();}
 std::vector<util::TSharedHandle<TextTagComponent>> &FormattedTextLine::GetTagComponents() {return m_tagComponents;}
-const std::vector<util::TWeakSharedHandle<AnchorPoint>> &FormattedTextLine::GetAnchorPoints() const {return const_cast<FormattedTextLine*>(this)->GetAnchorPoints();}
-std::vector<util::TWeakSharedHandle<AnchorPoint>> &FormattedTextLine::GetAnchorPoints() {return m_anchorPoints;}
 const LineStartAnchorPoint &FormattedTextLine::GetStartAnchorPoint() const {return const_cast<FormattedTextLine*>(this)->GetStartAnchorPoint();}
-LineStartAnchorPoint &FormattedTextLine::GetStartAnchorPoint() {return static_cast<LineStartAnchorPoint&>(*m_startAnchorPoint);}
+LineStartAnchorPoint &FormattedTextLine::GetStartAnchorPoint()
+{
+	// The start anchor point is only created once it's actually needed, most lines never have any anchor points
+	if(m_startAnchorPoint.IsValid() == false)
+		m_startAnchorPoint = AnchorPoint::Create<LineStartAnchorPoint>(*this);
+	return static_cast<LineStartAnchorPoint&>(*m_startAnchorPoint);
+}
+bool FormattedTextLine::HasAnchorPoints() const {return m_startAnchorPoint.IsValid() && m_startAnchorPoint->GetChildren().empty() == false;}
 
 bool FormattedTextLine::IsEmpty() const {return m_unformattedLine.GetLength() == 0;}
-TextOffset FormattedTextLine::GetFormattedStartOffset() const {return m_formattedStartOffset;}
-TextOffset FormattedTextLine::GetStartOffset() const {return m_startAnchorPoint->GetTextCharOffset();}
+TextOffset FormattedTextLine::GetFormattedStartOffset() const {return m_treeNode ? LineTree::GetFormattedStartOffset(*m_treeNode) : 0;}
+TextOffset FormattedTextLine::GetStartOffset() const {return m_treeNode ? LineTree::GetStartOffset(*m_treeNode) : 0;}
 TextOffset FormattedTextLine::GetEndOffset() const
 {
 	if(IsEmpty())
@@ -86,8 +85,15 @@ TextOffset FormattedTextLine::GetEndOffset() const
 TextOffset FormattedTextLine::GetAbsEndOffset() const {return GetStartOffset() +(GetAbsLength() -1);}
 TextLength FormattedTextLine::GetAbsLength() const {return m_unformattedLine.GetAbsLength();}
 TextLength FormattedTextLine::GetLength() const {return m_unformattedLine.GetLength();}
-TextLength FormattedTextLine::GetAbsFormattedLength() const {return m_formattedLine.GetAbsLength();}
-TextLength FormattedTextLine::GetFormattedLength() const {return m_formattedLine.GetLength();}
+TextLength FormattedTextLine::GetAbsFormattedLength() const {return GetFormattedLength() +1;}
+TextLength FormattedTextLine::GetFormattedLength() const
+{
+	// Lines without tags share the unformatted storage, so the length has to be taken from
+	// the time the line was formatted, like for the formatted storage
+	if(m_bUntagged)
+		return m_unformattedMapLength -1;
+	return m_formattedLine.GetLength();
+}
 std::optional<CharOffset> FormattedTextLine::GetRelativeOffset(TextOffset offset) const
 {
 	if(offset == END_OF_TEXT)
@@ -116,12 +122,15 @@ std::optional<CharOffset> FormattedTextLine::InsertString(const util::Utf8String
 	if(charOffset == LAST_CHAR)
 		charOffset = GetLength();
 	auto lenLine = GetAbsLength();
+	UpdateStorage();
 	auto result = m_unformattedLine.InsertString(str,charOffset);
 	if(result == false)
 		return {};
+	if(m_treeNode)
+		LineTree::UpdateLength(*m_treeNode);
 	ShiftAnchors(charOffset,UNTIL_THE_END,static_cast<ShiftOffset>(str.length()),lenLine);
 
-	m_bDirty = true;
+	SetDirty();
 	return charOffset;
 }
 
@@ -136,64 +145,66 @@ void FormattedTextLine::ShiftAnchors(CharOffset startOffset,TextLength len,Shift
 		return;
 	if(len == UNTIL_THE_END || (startOffset +len) > oldLineLen)
 		len = oldLineLen -startOffset;
+	if(HasAnchorPoints() == false)
+		return;
 	
 	auto &startAnchorPoint = GetStartAnchorPoint();
 	startOffset += startAnchorPoint.GetTextCharOffset();
 	auto endOffset = startOffset +len -1;
 	auto endOffsetLine = startAnchorPoint.GetTextCharOffset() +oldLineLen -1;
-	auto &childAnchors = startAnchorPoint.GetChildren();
-	for(auto &hChild : childAnchors)
+	for(auto &childAnchor : startAnchorPoint.GetChildren())
 	{
-		if(hChild.IsExpired() || hChild.Get() == m_startAnchorPoint.Get())
-			continue;
-		auto *childAnchor = hChild.Get();
-		if(childAnchor->IsInRange(startOffset,len))
+		if(childAnchor.IsInRange(startOffset,len))
 		{
-			if(childAnchor->ShouldAllowOutOfBounds() == false)
-				hChild.Remove();
+			if(childAnchor.ShouldAllowOutOfBounds() == false)
+				childAnchor.GetHandle().Remove();
 			continue;
 		}
-		auto childAnchorOffset = childAnchor->GetTextCharOffset();
+		auto childAnchorOffset = childAnchor.GetTextCharOffset();
 		if(childAnchorOffset > endOffset && childAnchorOffset <= endOffsetLine)
-			childAnchor->ShiftByOffset(shiftAmount);
+			childAnchor.ShiftByOffset(shiftAmount);
 	}
-	auto *nextLineAnchorPoint = startAnchorPoint.GetNextLineAnchorStartPoint();
-	if(nextLineAnchorPoint)
-		nextLineAnchorPoint->ShiftByOffset(shiftAmount);
+	// Anchor points of subsequent lines are relative to their line start, which is derived
+	// from the line tree, so they don't have to be shifted
 }
 
 std::optional<TextLength> FormattedTextLine::Erase(CharOffset startOffset,TextLength len,util::Utf8String *outErasedString)
 {
 	auto lenLine = GetAbsLength();
+	UpdateStorage();
 	auto numErased = m_unformattedLine.Erase(startOffset,len,outErasedString);
 	if(numErased.has_value() == false)
 		return false;
+	if(m_treeNode)
+		LineTree::UpdateLength(*m_treeNode);
 	// Update anchor offsets
 	len = *numErased;
 	ShiftAnchors(startOffset,len,-static_cast<ShiftOffset>(len),lenLine);
 
-	m_bDirty = true;
+	SetDirty();
 	return len;
 }
 
-std::vector<util::TSharedHandle<util::text::AnchorPoint>> FormattedTextLine::DetachAnchorPoints(CharOffset startOffset,TextLength len)
+std::vector<AnchorPointHandle> FormattedTextLine::DetachAnchorPoints(CharOffset startOffset,TextLength len)
 {
 	if(len == UNTIL_THE_END)
 		len = GetAbsLength() -startOffset;
-	std::vector<TSharedHandle<util::text::AnchorPoint>> anchorPointsInRange {};
+	std::vector<AnchorPointHandle> anchorPointsInRange {};
+	if(HasAnchorPoints() == false)
+		return anchorPointsInRange;
 	startOffset += GetStartOffset();
-	for(auto &hChild : GetStartAnchorPoint().GetChildren())
+	for(auto &child : GetStartAnchorPoint().GetChildren())
 	{
-		if(hChild.IsValid() == false || hChild->IsValid() == false || hChild->IsInRange(startOffset,len) == false)
+		if(child.IsValid() == false || child.IsInRange(startOffset,len) == false)
 			continue;
-		anchorPointsInRange.push_back(util::claim_shared_handle_ownership(hChild));
-		hChild->ClearLine();
-		hChild->ClearParent();
+		anchorPointsInRange.push_back(child.GetHandle());
+		child.ClearLine();
+		child.ClearParent();
 	}
 	return anchorPointsInRange;
 }
 
-void FormattedTextLine::AttachAnchorPoints(std::vector<util::TSharedHandle<util::text::AnchorPoint>> &anchorPoints,ShiftOffset shiftOffset)
+void FormattedTextLine::AttachAnchorPoints(std::vector<AnchorPointHandle> &anchorPoints,ShiftOffset shiftOffset)
 {
 	for(auto &pAnchorPoint : anchorPoints)
 	{
@@ -203,16 +214,60 @@ void FormattedTextLine::AttachAnchorPoints(std::vector<util::TSharedHandle<util:
 	}
 }
 
+void FormattedTextLine::UpdateStorage()
+{
+	if(m_unformattedLine.IsPieceTable() == false && m_unformattedLine.GetLength() >= m_text.GetPieceTableThreshold())
+		m_unformattedLine.EnablePieceTable();
+}
+
 bool FormattedTextLine::Move(CharOffset startOffset,TextLength len,FormattedTextLine &moveTarget,CharOffset targetCharOffset)
 {
-	// Temporarily remove all anchor points within the move range from this line
+	if(m_unformattedLine.CanErase(startOffset,len) == false)
+		return false;
+	len = std::min<TextLength>(len,GetLength() -startOffset);
+	auto absStartOffset = GetStartOffset() +startOffset;
+	if(&moveTarget == this)
+	{
+		if(targetCharOffset == LAST_CHAR)
+			targetCharOffset = GetLength() -len;
+		if(targetCharOffset > GetLength() -len)
+			return false;
+		UpdateStorage();
+		// The anchor points between the old and the new position of the range are shifted by the length of the range,
+		// everything else in the line stays where it is
+		auto anchorPointsInMoveRange = DetachAnchorPoints(startOffset,len);
+		auto anchorPointsInBetween = (targetCharOffset < startOffset) ? DetachAnchorPoints(targetCharOffset,startOffset -targetCharOffset) :
+			DetachAnchorPoints(startOffset +len,targetCharOffset -startOffset);
+		if(m_unformattedLine.Move(startOffset,len,targetCharOffset) == false)
+			return false;
+		SetDirty();
+		AttachAnchorPoints(anchorPointsInBetween,(targetCharOffset < startOffset) ? static_cast<ShiftOffset>(len) : -static_cast<ShiftOffset>(len));
+		AttachAnchorPoints(anchorPointsInMoveRange,static_cast<ShiftOffset>(targetCharOffset) -static_cast<ShiftOffset>(startOffset));
+		return true;
+	}
+	if(targetCharOffset == LAST_CHAR)
+		targetCharOffset = moveTarget.GetLength();
+	if(targetCharOffset > moveTarget.GetLength())
+		return false;
+	// Temporarily remove all anchor points within the move range from this line, as well as the ones behind the
+	// target offset, which would otherwise be discarded by the insertion
 	auto anchorPointsInMoveRange = DetachAnchorPoints(startOffset,len);
+	auto anchorPointsAfterTarget = moveTarget.DetachAnchorPoints(targetCharOffset,UNTIL_THE_END);
 
-	util::Utf8String erasedString;
-	if(Erase(startOffset,len,&erasedString) == false || moveTarget.InsertString(erasedString,targetCharOffset) == false)
+	// The characters are inserted straight from the storage of this line before they're erased, so no intermediate copy is required
+	auto insertOffset = targetCharOffset;
+	for(auto &segment : m_unformattedLine.GetSegments(startOffset,len))
+	{
+		util::Utf8StringView str {segment};
+		if(moveTarget.InsertString(str,insertOffset).has_value() == false)
+			return false;
+		insertOffset += str.length();
+	}
+	moveTarget.AttachAnchorPoints(anchorPointsAfterTarget,static_cast<ShiftOffset>(len));
+	if(Erase(startOffset,len).has_value() == false)
 		return false;
 	// Add the removed anchor points to the target line and update their offsets accordingly
-	moveTarget.AttachAnchorPoints(anchorPointsInMoveRange,static_cast<ShiftOffset>(moveTarget.GetStartOffset() +targetCharOffset) -static_cast<ShiftOffset>(GetStartOffset() +startOffset));
+	moveTarget.AttachAnchorPoints(anchorPointsInMoveRange,static_cast<ShiftOffset>(moveTarget.GetStartOffset() +targetCharOffset) -static_cast<ShiftOffset>(absStartOffset));
 	return true;
 }
 
@@ -220,28 +275,65 @@ void FormattedTextLine::AppendCharacter(int32_t c)
 {
 	auto len = GetLength();
 	auto absLen = GetAbsLength();
+	UpdateStorage();
 	m_unformattedLine.AppendCharacter(c);
-	if(m_startAnchorPoint.IsValid()) // The line may not be initialized at this point yet
-		ShiftAnchors(len,0,1,absLen);
-	m_bDirty = true;
+	if(m_treeNode)
+		LineTree::UpdateLength(*m_treeNode);
+	ShiftAnchors(len,0,1,absLen);
+	SetDirty();
 }
 
 FormattedText &FormattedTextLine::GetTargetText() const {return m_text;}
+void FormattedTextLine::SetDirty()
+{
+	m_bDirty = true;
+	m_snapshotTags = nullptr;
+	if(m_treeNode)
+		LineTree::InvalidateSnapshot(*m_treeNode);
+	m_text.OnLineDirty(*this);
+}
+void FormattedTextLine::InvalidateSnapshotTags()
+{
+	// The paths of lines without snapshot tags have already been invalidated
+	if(m_snapshotTags == nullptr)
+		return;
+	m_snapshotTags = nullptr;
+	if(m_treeNode)
+		LineTree::InvalidateSnapshot(*m_treeNode);
+}
+std::shared_ptr<const TextSnapshot::Line> FormattedTextLine::GetSnapshot()
+{
+	Format();
+	if(m_snapshot == nullptr)
+	{
+		auto unformattedText = m_unformattedLine.Substr(0).to_str();
+		auto formattedText = m_bUntagged ? unformattedText : m_formattedLine.GetText();
+		m_snapshot = std::make_shared<TextSnapshot::Line>(TextSnapshot::Line{std::move(unformattedText),std::move(formattedText)});
+	}
+	return m_snapshot;
+}
 
 TextLine &FormattedTextLine::Format()
 {
 	if(m_bDirty == false)
-		return m_formattedLine;
+		return m_bUntagged ? m_unformattedLine : m_formattedLine;
 	m_bDirty = false;
+	m_snapshot = nullptr;
+	m_charMapSegments.clear();
+	m_unformattedMapLength = m_unformattedLine.GetAbsLength();
+	m_bUntagged = m_tagComponents.empty();
+	if(m_bUntagged)
+	{
+		// The formatted text is identical to the unformatted text, no copy required
+		m_formattedLine = TextLine{};
+		if(m_treeNode)
+			LineTree::UpdateLength(*m_treeNode);
+		return m_unformattedLine;
+	}
 	m_formattedLine.Clear();
-	m_unformattedCharIndexToFormatted.clear();
-	m_formattedCharIndexToUnformatted.clear();
 	auto len = m_unformattedLine.GetLength();
 	m_formattedLine.Reserve(len);
-	m_unformattedCharIndexToFormatted.resize(m_unformattedLine.GetAbsLength());
-	m_formattedCharIndexToUnformatted.reserve(m_unformattedLine.GetAbsLength());
 	auto lineStartOffset = GetStartOffset();
-	auto lineView = util::Utf8StringView{m_unformattedLine.GetText()};
 
 	auto curTagIdx = 0u;
 	TextOffset offset = 0u;
@@ -253,50 +345,62 @@ TextLine &FormattedTextLine::Format()
 			auto startOffset = tagComponent->GetStartAnchorPoint()->GetTextCharOffset() -lineStartOffset;
 			if(offset == startOffset)
 			{
-				auto formattedIdx = m_formattedLine.GetLength();
+				auto formattedNext = m_formattedLine.GetLength();
+				auto formattedIdx = formattedNext;
 				if(tagComponent->IsClosingTag() && formattedIdx > 0)
 					--formattedIdx;
-				for(auto i=offset;i<std::min(offset +tagComponent->GetLength(),len);++i)
-					m_unformattedCharIndexToFormatted.at(i) = formattedIdx;
+				auto endOffset = std::min<TextOffset>(offset +tagComponent->GetLength(),len);
+				m_charMapSegments.push_back({static_cast<CharOffset>(offset),static_cast<CharOffset>(endOffset),static_cast<CharOffset>(formattedIdx),static_cast<CharOffset>(formattedNext)});
 				offset += tagComponent->GetLength();
 				++curTagIdx;
 				continue;
 			}
 		}
-		auto c = m_unformattedLine.At(offset);
-		m_unformattedCharIndexToFormatted.at(offset) = m_formattedLine.GetLength();
-		m_formattedCharIndexToUnformatted.push_back(offset);
-		m_formattedLine.AppendCharacter(c);
+		m_formattedLine.AppendCharacter(m_unformattedLine.At(offset));
 		++offset;
 	}
-	for(auto i=offset;i<m_unformattedCharIndexToFormatted.size();++i)
-		m_unformattedCharIndexToFormatted.at(i) = m_formattedLine.GetLength();
+	if(m_treeNode)
+		LineTree::UpdateLength(*m_treeNode);
 	return m_formattedLine;
 }
 
 CharOffset FormattedTextLine::GetFormattedCharOffset(CharOffset offset) const
 {
-	if(offset == m_unformattedCharIndexToFormatted.size())
-		return m_formattedLine.GetLength(); // New-line or EOF
-	if(offset > m_unformattedCharIndexToFormatted.size())
+	if(offset == m_unformattedMapLength)
+		return GetFormattedLength(); // New-line or EOF
+	if(offset > m_unformattedMapLength)
 		return LAST_CHAR;
-	return m_unformattedCharIndexToFormatted.at(offset);
+	auto it = std::upper_bound(m_charMapSegments.begin(),m_charMapSegments.end(),offset,[](CharOffset offset,const CharMapSegment &segment) {
+		return offset < segment.unformattedStart;
+	});
+	if(it == m_charMapSegments.begin())
+		return offset;
+	--it;
+	if(offset < it->unformattedEnd)
+		return it->formattedOffset;
+	return it->formattedNext +(offset -it->unformattedEnd);
 }
 
 CharOffset FormattedTextLine::GetUnformattedCharOffset(CharOffset offset) const
 {
-	if(offset == m_formattedCharIndexToUnformatted.size())
+	if(offset == GetFormattedLength())
 		return m_unformattedLine.GetLength(); // New-line or EOF
-	if(offset > m_formattedCharIndexToUnformatted.size())
+	if(offset > GetFormattedLength())
 		return LAST_CHAR;
-	return m_formattedCharIndexToUnformatted.at(offset);
+	auto it = std::upper_bound(m_charMapSegments.begin(),m_charMapSegments.end(),offset,[](CharOffset offset,const CharMapSegment &segment) {
+		return offset < segment.formattedNext;
+	});
+	if(it == m_charMapSegments.begin())
+		return offset;
+	--it;
+	return it->unformattedEnd +(offset -it->formattedNext);
 }
 
-util::TSharedHandle<AnchorPoint> FormattedTextLine::CreateAnchorPoint(CharOffset charOffset,bool allowOutOfBounds)
+AnchorPointHandle FormattedTextLine::CreateAnchorPoint(CharOffset charOffset,bool allowOutOfBounds)
 {
 	if(allowOutOfBounds == false && charOffset > GetLength())
 		return {};
-	auto anchorPoint = AnchorPoint::Create(*this);
+	auto anchorPoint = AnchorPoint::Create(*this,allowOutOfBounds);
 	anchorPoint->SetOffset(GetStartOffset() +charOffset);
 	anchorPoint->SetParent(GetStartAnchorPoint());
 	return anchorPoint;
@@ -0,0 +1,401 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "util_formatted_text_line_tree.hpp"
+#include "util_formatted_text_line.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace util::text;
+
+LineTree::Iterator::Iterator(const LineTree &tree,Node *node)
+	: m_tree{&tree},m_node{node}
+{}
+LineTree::Iterator::reference LineTree::Iterator::operator*() const {return m_node->line;}
+LineTree::Iterator::pointer LineTree::Iterator::operator->() const {return &m_node->line;}
+LineTree::Iterator &LineTree::Iterator::operator++()
+{
+	m_node = LineTree::GetNext(m_node);
+	return *this;
+}
+LineTree::Iterator LineTree::Iterator::operator++(int)
+{
+	auto it = *this;
+	++(*this);
+	return it;
+}
+LineTree::Iterator &LineTree::Iterator::operator--()
+{
+	// Decrementing the end iterator yields the last line
+	m_node = m_node ? LineTree::GetPrevious(m_node) : LineTree::GetLast(m_tree->m_root);
+	return *this;
+}
+LineTree::Iterator LineTree::Iterator::operator--(int)
+{
+	auto it = *this;
+	--(*this);
+	return it;
+}
+bool LineTree::Iterator::operator==(const Iterator &other) const {return m_node == other.m_node;}
+bool LineTree::Iterator::operator!=(const Iterator &other) const {return operator==(other) == false;}
+
+//////////////
+
+LineTree::~LineTree() {Clear();}
+
+uint32_t LineTree::GetCount(const Node *node) {return node ? node->count : 0u;}
+TextLength LineTree::GetSubtreeLength(const Node *node) {return node ? node->subtreeLength : 0u;}
+TextLength LineTree::GetSubtreeFormattedLength(const Node *node) {return node ? node->subtreeFormattedLength : 0u;}
+void LineTree::Pull(Node &node)
+{
+	node.count = 1u +GetCount(node.left) +GetCount(node.right);
+	node.subtreeLength = node.length +GetSubtreeLength(node.left) +GetSubtreeLength(node.right);
+	node.subtreeFormattedLength = node.formattedLength +GetSubtreeFormattedLength(node.left) +GetSubtreeFormattedLength(node.right);
+	node.snapshot = nullptr;
+	if(node.left)
+		node.left->parent = &node;
+	if(node.right)
+		node.right->parent = &node;
+}
+
+LineIndex LineTree::GetIndex(const Node &node)
+{
+	auto idx = GetCount(node.left);
+	for(auto *cur=&node;cur->parent;cur=cur->parent)
+	{
+		if(cur->parent->right == cur)
+			idx += GetCount(cur->parent->left) +1u;
+	}
+	return idx;
+}
+TextOffset LineTree::GetStartOffset(const Node &node)
+{
+	auto offset = GetSubtreeLength(node.left);
+	for(auto *cur=&node;cur->parent;cur=cur->parent)
+	{
+		if(cur->parent->right == cur)
+			offset += GetSubtreeLength(cur->parent->left) +cur->parent->length;
+	}
+	return offset;
+}
+TextOffset LineTree::GetFormattedStartOffset(const Node &node)
+{
+	auto offset = GetSubtreeFormattedLength(node.left);
+	for(auto *cur=&node;cur->parent;cur=cur->parent)
+	{
+		if(cur->parent->right == cur)
+			offset += GetSubtreeFormattedLength(cur->parent->left) +cur->parent->formattedLength;
+	}
+	return offset;
+}
+void LineTree::UpdateLength(Node &node)
+{
+	node.length = node.line->GetAbsLength();
+	node.formattedLength = node.line->GetAbsFormattedLength();
+	for(auto *cur=&node;cur;cur=cur->parent)
+	{
+		cur->subtreeLength = cur->length +GetSubtreeLength(cur->left) +GetSubtreeLength(cur->right);
+		cur->subtreeFormattedLength = cur->formattedLength +GetSubtreeFormattedLength(cur->left) +GetSubtreeFormattedLength(cur->right);
+		cur->snapshot = nullptr;
+	}
+}
+void LineTree::InvalidateSnapshot(Node &node)
+{
+	for(auto *cur=&node;cur;cur=cur->parent)
+		cur->snapshot = nullptr;
+}
+
+LineTree::Node *LineTree::GetFirst(Node *node)
+{
+	if(node == nullptr)
+		return nullptr;
+	while(node->left)
+		node = node->left;
+	return node;
+}
+LineTree::Node *LineTree::GetLast(Node *node)
+{
+	if(node == nullptr)
+		return nullptr;
+	while(node->right)
+		node = node->right;
+	return node;
+}
+LineTree::Node *LineTree::GetNext(Node *node)
+{
+	if(node->right)
+		return GetFirst(node->right);
+	while(node->parent && node->parent->right == node)
+		node = node->parent;
+	return node->parent;
+}
+LineTree::Node *LineTree::GetPrevious(Node *node)
+{
+	if(node->left)
+		return GetLast(node->left);
+	while(node->parent && node->parent->left == node)
+		node = node->parent;
+	return node->parent;
+}
+
+LineTree::Node *LineTree::Merge(Node *a,Node *b)
+{
+	if(a == nullptr)
+		return b;
+	if(b == nullptr)
+		return a;
+	if(a->priority > b->priority)
+	{
+		a->right = Merge(a->right,b);
+		Pull(*a);
+		return a;
+	}
+	b->left = Merge(a,b->left);
+	Pull(*b);
+	return b;
+}
+void LineTree::Split(Node *node,uint32_t count,Node *&outLeft,Node *&outRight)
+{
+	if(node == nullptr)
+	{
+		outLeft = nullptr;
+		outRight = nullptr;
+		return;
+	}
+	auto leftCount = GetCount(node->left);
+	if(leftCount < count)
+	{
+		Node *right = nullptr;
+		Split(node->right,count -leftCount -1u,node->right,right);
+		if(right)
+			right->parent = nullptr;
+		Pull(*node);
+		outLeft = node;
+		outRight = right;
+		return;
+	}
+	Node *left = nullptr;
+	Split(node->left,count,left,node->left);
+	if(left)
+		left->parent = nullptr;
+	Pull(*node);
+	outLeft = left;
+	outRight = node;
+}
+void LineTree::Destroy(Node *node)
+{
+	if(node == nullptr)
+		return;
+	Destroy(node->left);
+	Destroy(node->right);
+	if(node->line)
+		node->line->m_treeNode = nullptr;
+	FreeNode(node);
+}
+void LineTree::Release(Node *node,std::vector<PFormattedTextLine> &outLines)
+{
+	if(node == nullptr)
+		return;
+	Release(node->left,outLines);
+	node->line->m_treeNode = nullptr;
+	outLines.push_back(std::move(node->line));
+	Release(node->right,outLines);
+	FreeNode(node);
+}
+uint32_t LineTree::GeneratePriority()
+{
+	// xorshift32; Deterministic, so the tree layout is reproducible across runs
+	m_seed ^= m_seed<<13u;
+	m_seed ^= m_seed>>17u;
+	m_seed ^= m_seed<<5u;
+	return m_seed;
+}
+
+LineTree::Node *LineTree::CreateNode(const PFormattedTextLine &line)
+{
+	if(m_freeNodes == nullptr)
+	{
+		auto block = std::make_unique<Node[]>(NODE_BLOCK_SIZE);
+		for(auto i=decltype(NODE_BLOCK_SIZE){0u};i<NODE_BLOCK_SIZE;++i)
+			block[i].right = (i +1 < NODE_BLOCK_SIZE) ? &block[i +1] : nullptr;
+		m_freeNodes = &block[0];
+		m_nodeBlocks.push_back(std::move(block));
+	}
+	auto *node = m_freeNodes;
+	m_freeNodes = node->right;
+	*node = {};
+	node->line = line;
+	node->priority = GeneratePriority();
+	node->length = line->GetAbsLength();
+	node->formattedLength = line->GetAbsFormattedLength();
+	node->subtreeLength = node->length;
+	node->subtreeFormattedLength = node->formattedLength;
+	line->m_treeNode = node;
+	return node;
+}
+void LineTree::FreeNode(Node *node)
+{
+	*node = {};
+	node->right = m_freeNodes;
+	m_freeNodes = node;
+}
+void LineTree::PullSubtree(Node &node)
+{
+	if(node.left)
+		PullSubtree(*node.left);
+	if(node.right)
+		PullSubtree(*node.right);
+	Pull(node);
+}
+LineTree::Node &LineTree::Insert(LineIndex lineIdx,const PFormattedTextLine &line)
+{
+	if(lineIdx > size())
+		lineIdx = size();
+	auto *node = CreateNode(line);
+
+	Node *left = nullptr;
+	Node *right = nullptr;
+	Split(m_root,lineIdx,left,right);
+	m_root = Merge(Merge(left,node),right);
+	m_root->parent = nullptr;
+	return *node;
+}
+void LineTree::Insert(LineIndex lineIdx,const PFormattedTextLine *lines,size_t count)
+{
+	if(count == 0)
+		return;
+	if(lineIdx > size())
+		lineIdx = size();
+	// Build the subtree for the new lines from left to right. The stack contains the right spine
+	// of the subtree built so far, ordered by descending priority.
+	std::vector<Node*> rightSpine {};
+	for(auto i=decltype(count){0u};i<count;++i)
+	{
+		auto *node = CreateNode(lines[i]);
+		Node *last = nullptr;
+		while(rightSpine.empty() == false && rightSpine.back()->priority < node->priority)
+		{
+			last = rightSpine.back();
+			rightSpine.pop_back();
+		}
+		node->left = last;
+		if(rightSpine.empty() == false)
+			rightSpine.back()->right = node;
+		rightSpine.push_back(node);
+	}
+	auto *subtree = rightSpine.front();
+	PullSubtree(*subtree);
+
+	Node *left = nullptr;
+	Node *right = nullptr;
+	Split(m_root,lineIdx,left,right);
+	m_root = Merge(Merge(left,subtree),right);
+	m_root->parent = nullptr;
+}
+PFormattedTextLine LineTree::Erase(LineIndex lineIdx)
+{
+	if(lineIdx >= size())
+		return nullptr;
+	Node *left = nullptr;
+	Node *mid = nullptr;
+	Node *right = nullptr;
+	Split(m_root,lineIdx,left,right);
+	Split(right,1u,mid,right);
+	m_root = Merge(left,right);
+	if(m_root)
+		m_root->parent = nullptr;
+	auto line = mid->line;
+	line->m_treeNode = nullptr;
+	FreeNode(mid);
+	return line;
+}
+std::vector<PFormattedTextLine> LineTree::Erase(LineIndex lineIdx,uint32_t count)
+{
+	std::vector<PFormattedTextLine> lines {};
+	if(lineIdx >= size() || count == 0)
+		return lines;
+	count = std::min<uint32_t>(count,size() -lineIdx);
+	Node *left = nullptr;
+	Node *mid = nullptr;
+	Node *right = nullptr;
+	Split(m_root,lineIdx,left,right);
+	Split(right,count,mid,right);
+	m_root = Merge(left,right);
+	if(m_root)
+		m_root->parent = nullptr;
+	lines.reserve(count);
+	Release(mid,lines);
+	return lines;
+}
+void LineTree::Clear()
+{
+	Destroy(m_root);
+	m_root = nullptr;
+	// Hand the memory back instead of keeping it around for lines that may never be added again
+	m_freeNodes = nullptr;
+	m_nodeBlocks.clear();
+}
+
+LineTree::Node *LineTree::FindNode(size_t lineIdx) const
+{
+	auto *node = m_root;
+	while(node)
+	{
+		auto leftCount = GetCount(node->left);
+		if(lineIdx < leftCount)
+			node = node->left;
+		else if(lineIdx == leftCount)
+			return node;
+		else
+		{
+			lineIdx -= leftCount +1u;
+			node = node->right;
+		}
+	}
+	return nullptr;
+}
+template<TextLength LineTree::Node::*TLength,TextLength LineTree::Node::*TSubtreeLength>
+	std::optional<std::pair<LineIndex,CharOffset>> LineTree::FindOffset(TextOffset offset) const
+{
+	if(m_root == nullptr || offset >= m_root->*TSubtreeLength)
+		return {};
+	LineIndex lineIdx = 0u;
+	auto *node = m_root;
+	for(;;)
+	{
+		auto leftLength = node->left ? node->left->*TSubtreeLength : 0u;
+		if(offset < leftLength)
+		{
+			node = node->left;
+			continue;
+		}
+		offset -= leftLength;
+		if(offset < node->*TLength)
+			return {{lineIdx +GetCount(node->left),static_cast<CharOffset>(offset)}};
+		offset -= node->*TLength;
+		lineIdx += GetCount(node->left) +1u;
+		node = node->right;
+	}
+}
+std::optional<std::pair<LineIndex,CharOffset>> LineTree::FindOffset(TextOffset offset) const {return FindOffset<&Node::length,&Node::subtreeLength>(offset);}
+std::optional<std::pair<LineIndex,CharOffset>> LineTree::FindFormattedOffset(TextOffset offset) const {return FindOffset<&Node::formattedLength,&Node::subtreeFormattedLength>(offset);}
+
+size_t LineTree::size() const {return GetCount(m_root);}
+bool LineTree::empty() const {return m_root == nullptr;}
+TextLength LineTree::GetLength() const {return GetSubtreeLength(m_root);}
+TextLength LineTree::GetFormattedLength() const {return GetSubtreeFormattedLength(m_root);}
+const PFormattedTextLine &LineTree::at(size_t lineIdx) const
+{
+	auto *node = FindNode(lineIdx);
+	if(node == nullptr)
+		throw std::out_of_range{"Line index out of range!"};
+	return node->line;
+}
+const PFormattedTextLine &LineTree::operator[](size_t lineIdx) const {return FindNode(lineIdx)->line;}
+const PFormattedTextLine &LineTree::front() const {return GetFirst(m_root)->line;}
+const PFormattedTextLine &LineTree::back() const {return GetLast(m_root)->line;}
+LineTree::Iterator LineTree::Find(size_t lineIdx) const {return Iterator{*this,FindNode(lineIdx)};}
+LineTree::Node *LineTree::GetRoot() const {return m_root;}
+LineTree::Iterator LineTree::begin() const {return Iterator{*this,GetFirst(m_root)};}
+LineTree::Iterator LineTree::end() const {return Iterator{*this,nullptr};}
@@ -0,0 +1,81 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "util_formatted_text_mapped_file.hpp"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace util::text;
+
+std::shared_ptr<const MappedFile> MappedFile::Open(const std::string &fileName)
+{
+	auto file = std::shared_ptr<MappedFile>{new MappedFile{}};
+#ifdef _WIN32
+	auto hFile = CreateFileA(fileName.c_str(),GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,nullptr);
+	if(hFile == INVALID_HANDLE_VALUE)
+		return nullptr;
+	file->m_fileHandle = hFile;
+	LARGE_INTEGER size;
+	if(GetFileSizeEx(hFile,&size) == FALSE)
+		return nullptr;
+	if(size.QuadPart == 0)
+		return file; // Empty files can't be mapped
+	auto hMapping = CreateFileMappingA(hFile,nullptr,PAGE_READONLY,0,0,nullptr);
+	if(hMapping == nullptr)
+		return nullptr;
+	file->m_mappingHandle = hMapping;
+	auto *data = MapViewOfFile(hMapping,FILE_MAP_READ,0,0,0);
+	if(data == nullptr)
+		return nullptr;
+	file->m_data = static_cast<const char*>(data);
+	file->m_size = static_cast<size_t>(size.QuadPart);
+#else
+	auto fd = open(fileName.c_str(),O_RDONLY);
+	if(fd == -1)
+		return nullptr;
+	struct stat st;
+	if(fstat(fd,&st) != 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+	if(st.st_size > 0)
+	{
+		auto *data = mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+		if(data == MAP_FAILED)
+		{
+			close(fd);
+			return nullptr;
+		}
+		file->m_data = static_cast<const char*>(data);
+		file->m_size = st.st_size;
+	}
+	// The mapping remains valid after the file has been closed
+	close(fd);
+#endif
+	return file;
+}
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if(m_data)
+		UnmapViewOfFile(m_data);
+	if(m_mappingHandle)
+		CloseHandle(m_mappingHandle);
+	if(m_fileHandle)
+		CloseHandle(m_fileHandle);
+#else
+	if(m_data)
+		munmap(const_cast<char*>(m_data),m_size);
+#endif
+}
+std::string_view MappedFile::GetData() const {return {m_data,m_size};}
@@ -0,0 +1,407 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "util_formatted_text.hpp"
+#include "util_formatted_text_tag.hpp"
+#include "util_formatted_text_mapped_file.hpp"
+#include <unordered_map>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <cstring>
+
+using namespace util::text;
+
+// Layout (all integers are stored in the byte order of the host, which is verified on load):
+// Header: magic, byte order mark, version, line count, tag count, anchor point count
+// Lines: byte sizes of the unformatted and formatted text, sizes of both index maps and tag component count, followed by the texts,
+//        the index maps and the tag components (start and end anchor point, opening flag, name and for opening tags label and attributes)
+// Tags: global indices of the opening and closing tag components
+// Anchor points: line index, offset relative to the line and out-of-bounds flag
+static constexpr std::array<char,4> SERIALIZATION_MAGIC = {'U','F','T','B'};
+static constexpr uint32_t SERIALIZATION_BYTE_ORDER_MARK = 0x01020304;
+static constexpr uint32_t SERIALIZATION_VERSION = 3;
+static constexpr uint32_t SERIALIZATION_INVALID_INDEX = std::numeric_limits<uint32_t>::max();
+
+namespace
+{
+	class BinaryWriter
+	{
+	public:
+		BinaryWriter(std::vector<uint8_t> &data) : m_data{data} {}
+		void Write(const void *data,size_t size)
+		{
+			auto offset = m_data.size();
+			m_data.resize(offset +size);
+			if(size > 0)
+				memcpy(m_data.data() +offset,data,size);
+		}
+		template<typename T>
+			void Write(const T &value) {Write(&value,sizeof(value));}
+		void WriteString(std::string_view str)
+		{
+			Write(static_cast<uint32_t>(str.size()));
+			Write(str.data(),str.size());
+		}
+		template<typename T>
+			void WriteArray(const std::vector<T> &values) {Write(values.data(),values.size() *sizeof(T));}
+	private:
+		std::vector<uint8_t> &m_data;
+	};
+
+	// All reads are bounds-checked, once a read has failed all subsequent reads fail as well
+	class BinaryReader
+	{
+	public:
+		BinaryReader(std::string_view data) : m_data{data} {}
+		bool Read(void *out,size_t size)
+		{
+			if(size > m_data.size() -m_offset)
+			{
+				m_offset = m_data.size();
+				m_failed = true;
+				return false;
+			}
+			if(size > 0)
+				memcpy(out,m_data.data() +m_offset,size);
+			m_offset += size;
+			return true;
+		}
+		template<typename T>
+			bool Read(T &out) {return Read(&out,sizeof(out));}
+		// Returns a view into the data instead of a copy
+		bool ReadView(size_t size,std::string_view &out)
+		{
+			if(size > m_data.size() -m_offset)
+			{
+				m_offset = m_data.size();
+				m_failed = true;
+				return false;
+			}
+			out = m_data.substr(m_offset,size);
+			m_offset += size;
+			return true;
+		}
+		bool ReadString(std::string &out)
+		{
+			uint32_t size;
+			std::string_view view;
+			if(Read(size) == false || ReadView(size,view) == false)
+				return false;
+			out = view;
+			return true;
+		}
+		template<typename T>
+			bool ReadArray(size_t count,std::vector<T> &out)
+		{
+			if(count > (m_data.size() -m_offset) /sizeof(T))
+			{
+				m_offset = m_data.size();
+				m_failed = true;
+				return false;
+			}
+			out.resize(count);
+			return Read(out.data(),count *sizeof(T));
+		}
+		bool HasFailed() const {return m_failed;}
+	private:
+		std::string_view m_data;
+		size_t m_offset = 0;
+		bool m_failed = false;
+	};
+};
+
+void FormattedText::Serialize(std::vector<uint8_t> &outData,const std::vector<AnchorPointHandle> &anchorPoints) const
+{
+	outData.clear();
+	BinaryWriter writer {outData};
+	writer.Write(SERIALIZATION_MAGIC);
+	writer.Write(SERIALIZATION_BYTE_ORDER_MARK);
+	writer.Write(SERIALIZATION_VERSION);
+	writer.Write(static_cast<uint32_t>(m_textLines.size()));
+	auto offsetTagCount = outData.size();
+	writer.Write(static_cast<uint32_t>(0)); // Tag count, written once the tags have been determined
+	writer.Write(static_cast<uint32_t>(anchorPoints.size()));
+
+	// Anchor points are stored relative to the line they're attached to
+	auto writeAnchorPoint = [&writer](const AnchorPoint *anchorPoint) {
+		if(anchorPoint == nullptr || anchorPoint->IsValid() == false)
+		{
+			writer.Write(SERIALIZATION_INVALID_INDEX);
+			writer.Write(static_cast<uint32_t>(0));
+			writer.Write(static_cast<uint8_t>(0));
+			return;
+		}
+		auto &line = anchorPoint->GetLine();
+		writer.Write(static_cast<uint32_t>(line.GetIndex()));
+		writer.Write(static_cast<uint32_t>(anchorPoint->GetTextCharOffset() -line.GetStartOffset()));
+		writer.Write(static_cast<uint8_t>(anchorPoint->ShouldAllowOutOfBounds() ? 1 : 0));
+	};
+	std::unordered_map<const TextTagComponent*,uint32_t> tagComponentIndices {};
+	for(auto &line : m_textLines)
+	{
+		auto &formattedLine = line->Format();
+		auto &tagComponents = line->GetTagComponents();
+		uint32_t numTagComponents = 0;
+		for(auto &hTagComponent : tagComponents)
+			numTagComponents += hTagComponent->IsValid() ? 1 : 0;
+		auto unformattedData = line->GetUnformattedLine().GetData();
+		// Without any tag segments the formatted text is identical to the unformatted text
+		auto formattedData = line->m_charMapSegments.empty() ? std::string_view{} : formattedLine.GetData();
+		writer.Write(static_cast<uint32_t>(unformattedData.size()));
+		writer.Write(static_cast<uint32_t>(formattedData.size()));
+		writer.Write(static_cast<uint32_t>(line->m_unformattedMapLength));
+		writer.Write(static_cast<uint32_t>(line->m_charMapSegments.size()));
+		writer.Write(numTagComponents);
+		writer.Write(unformattedData.data(),unformattedData.size());
+		writer.Write(formattedData.data(),formattedData.size());
+		writer.WriteArray(line->m_charMapSegments);
+
+		for(auto &hTagComponent : tagComponents)
+		{
+			if(hTagComponent->IsValid() == false)
+				continue;
+			auto idx = static_cast<uint32_t>(tagComponentIndices.size());
+			tagComponentIndices[hTagComponent.Get()] = idx;
+			writeAnchorPoint(hTagComponent->GetStartAnchorPoint());
+			writeAnchorPoint(hTagComponent->GetEndAnchorPoint());
+			auto isOpeningTag = hTagComponent->IsOpeningTag();
+			writer.Write(static_cast<uint8_t>(isOpeningTag ? 1 : 0));
+			writer.WriteString(hTagComponent->GetTagName());
+			if(isOpeningTag == false)
+				continue;
+			auto &openingTag = static_cast<const TextOpeningTagComponent&>(*hTagComponent);
+			writer.WriteString(openingTag.GetLabel());
+			auto &attributes = openingTag.GetTagAttributes();
+			writer.Write(static_cast<uint32_t>(attributes.size()));
+			for(auto &attr : attributes)
+				writer.WriteString(attr);
+		}
+	}
+
+	uint32_t numTags = 0;
+	for(auto &hTag : m_tags)
+	{
+		auto *openingTag = hTag->GetOpeningTagComponent();
+		auto itOpening = openingTag ? tagComponentIndices.find(openingTag) : tagComponentIndices.end();
+		if(itOpening == tagComponentIndices.end())
+			continue;
+		auto *closingTag = hTag->GetClosingTagComponent();
+		auto itClosing = closingTag ? tagComponentIndices.find(closingTag) : tagComponentIndices.end();
+		writer.Write(itOpening->second);
+		writer.Write((itClosing != tagComponentIndices.end()) ? itClosing->second : SERIALIZATION_INVALID_INDEX);
+		++numTags;
+	}
+	memcpy(outData.data() +offsetTagCount,&numTags,sizeof(numTags));
+
+	for(auto &hAnchorPoint : anchorPoints)
+		writeAnchorPoint(hAnchorPoint.IsExpired() ? nullptr : hAnchorPoint.Get());
+}
+
+bool FormattedText::Deserialize(const void *data,size_t size,std::vector<AnchorPointHandle> *outAnchorPoints)
+{
+	// The lines reference the copy until they're modified
+	auto buffer = std::make_shared<const std::string>(static_cast<const char*>(data),size);
+	return Deserialize(buffer,*buffer,outAnchorPoints);
+}
+
+bool FormattedText::DeserializeFromFile(const std::string &fileName,std::vector<AnchorPointHandle> *outAnchorPoints)
+{
+	auto file = MappedFile::Open(fileName);
+	if(file == nullptr)
+		return false;
+	return Deserialize(file,file->GetData(),outAnchorPoints);
+}
+
+bool FormattedText::Deserialize(const std::shared_ptr<const void> &source,std::string_view data,std::vector<AnchorPointHandle> *outAnchorPoints)
+{
+	BinaryReader reader {data};
+	std::array<char,4> magic;
+	uint32_t byteOrderMark,version,numLines,numTags,numAnchorPoints;
+	if(reader.Read(magic) == false || magic != SERIALIZATION_MAGIC || reader.Read(byteOrderMark) == false || byteOrderMark != SERIALIZATION_BYTE_ORDER_MARK)
+		return false;
+	if(reader.Read(version) == false || version != SERIALIZATION_VERSION)
+		return false;
+	reader.Read(numLines);
+	reader.Read(numTags);
+	reader.Read(numAnchorPoints);
+	if(reader.HasFailed())
+		return false;
+
+	// Everything is read and validated before the current text is replaced
+	struct AnchorPointInfo
+	{
+		uint32_t lineIdx;
+		uint32_t offset;
+		uint8_t allowOutOfBounds;
+	};
+	auto readAnchorPoint = [&reader](AnchorPointInfo &info) {
+		reader.Read(info.lineIdx);
+		reader.Read(info.offset);
+		return reader.Read(info.allowOutOfBounds);
+	};
+	struct TagComponentInfo
+	{
+		uint32_t lineIdx;
+		AnchorPointInfo startAnchor;
+		AnchorPointInfo endAnchor;
+		bool isOpeningTag;
+		std::string tagName;
+		std::string label;
+		std::vector<std::string> attributes;
+	};
+	std::vector<PFormattedTextLine> lines {};
+	std::vector<TagComponentInfo> tagComponentInfos {};
+	lines.reserve(std::min<size_t>(numLines,data.size()));
+	for(auto lineIdx=0u;lineIdx<numLines;++lineIdx)
+	{
+		uint32_t unformattedSize,formattedSize,unformattedMapLength,numCharMapSegments,numTagComponents;
+		std::string_view unformattedData,formattedData;
+		reader.Read(unformattedSize);
+		reader.Read(formattedSize);
+		reader.Read(unformattedMapLength);
+		reader.Read(numCharMapSegments);
+		reader.Read(numTagComponents);
+		if(reader.ReadView(unformattedSize,unformattedData) == false || reader.ReadView(formattedSize,formattedData) == false)
+			return false;
+		auto line = FormattedTextLine::Create(*this,TextLine{source,unformattedData});
+		if(reader.ReadArray(numCharMapSegments,line->m_charMapSegments) == false)
+			return false;
+		// The char maps of empty lines that were never formatted are empty
+		if(unformattedMapLength != line->GetAbsLength() && (unformattedMapLength != 0 || line->GetLength() > 0))
+			return false;
+		line->m_unformattedMapLength = unformattedMapLength;
+		line->m_bUntagged = (numCharMapSegments == 0 && unformattedMapLength > 0);
+		if(line->m_bUntagged)
+		{
+			if(formattedSize != 0)
+				return false;
+		}
+		else
+			line->m_formattedLine = TextLine{source,formattedData};
+		// The segments must be sorted and consistent with the formatted line, otherwise the lookups
+		// would produce out-of-range offsets
+		CharOffset unformattedOffset = 0;
+		CharOffset formattedOffset = 0;
+		for(auto &segment : line->m_charMapSegments)
+		{
+			if(
+				segment.unformattedStart < unformattedOffset || segment.unformattedEnd < segment.unformattedStart || segment.unformattedEnd > line->GetLength() ||
+				segment.formattedNext != formattedOffset +(segment.unformattedStart -unformattedOffset) || segment.formattedOffset > segment.formattedNext
+			)
+				return false;
+			unformattedOffset = segment.unformattedEnd;
+			formattedOffset = segment.formattedNext;
+		}
+		if(line->GetFormattedLength() != formattedOffset +(line->GetLength() -unformattedOffset))
+			return false;
+		line->m_bDirty = false;
+		for(auto i=0u;i<numTagComponents;++i)
+		{
+			TagComponentInfo info {};
+			info.lineIdx = lineIdx;
+			uint8_t isOpeningTag;
+			readAnchorPoint(info.startAnchor);
+			readAnchorPoint(info.endAnchor);
+			reader.Read(isOpeningTag);
+			info.isOpeningTag = (isOpeningTag != 0);
+			reader.ReadString(info.tagName);
+			if(info.isOpeningTag)
+			{
+				uint32_t numAttributes;
+				reader.ReadString(info.label);
+				if(reader.Read(numAttributes) == false || numAttributes > data.size())
+					return false;
+				info.attributes.resize(numAttributes);
+				for(auto &attr : info.attributes)
+					reader.ReadString(attr);
+			}
+			if(reader.HasFailed())
+				return false;
+			tagComponentInfos.push_back(std::move(info));
+		}
+		lines.push_back(line);
+	}
+	// Tag component anchor points are required, the others are restored as empty handles if they're invalid
+	auto isAnchorPointValid = [&lines](const AnchorPointInfo &info) {
+		return info.lineIdx < lines.size() && (info.allowOutOfBounds != 0 || info.offset <= lines[info.lineIdx]->GetLength());
+	};
+	for(auto &info : tagComponentInfos)
+	{
+		if(isAnchorPointValid(info.startAnchor) == false || isAnchorPointValid(info.endAnchor) == false)
+			return false;
+	}
+	std::vector<std::pair<uint32_t,uint32_t>> tagInfos {};
+	tagInfos.reserve(std::min<size_t>(numTags,data.size()));
+	for(auto i=0u;i<numTags;++i)
+	{
+		uint32_t openingIdx,closingIdx;
+		if(reader.Read(openingIdx) == false || reader.Read(closingIdx) == false)
+			return false;
+		if(openingIdx >= tagComponentInfos.size() || tagComponentInfos[openingIdx].isOpeningTag == false)
+			return false;
+		if(closingIdx != SERIALIZATION_INVALID_INDEX && (closingIdx >= tagComponentInfos.size() || tagComponentInfos[closingIdx].isOpeningTag))
+			return false;
+		tagInfos.push_back({openingIdx,closingIdx});
+	}
+	std::vector<AnchorPointInfo> anchorPointInfos {};
+	anchorPointInfos.reserve(std::min<size_t>(numAnchorPoints,data.size()));
+	for(auto i=0u;i<numAnchorPoints;++i)
+	{
+		AnchorPointInfo info;
+		if(readAnchorPoint(info) == false)
+			return false;
+		anchorPointInfos.push_back(info);
+	}
+
+	OperationGuard operation {*this};
+	Clear();
+	m_textLines.Insert(0,lines.data(),lines.size());
+	m_bDirty = true;
+
+	std::vector<util::TSharedHandle<TextTagComponent>> tagComponents {};
+	tagComponents.reserve(tagComponentInfos.size());
+	auto createAnchorPoint = [&lines](const AnchorPointInfo &info) -> AnchorPointHandle {
+		if(info.lineIdx >= lines.size())
+			return {};
+		return lines[info.lineIdx]->CreateAnchorPoint(info.offset,info.allowOutOfBounds != 0);
+	};
+	for(auto &info : tagComponentInfos)
+	{
+		auto &line = *lines[info.lineIdx];
+		auto startAnchor = createAnchorPoint(info.startAnchor);
+		auto endAnchor = createAnchorPoint(info.endAnchor);
+		if(info.isOpeningTag)
+			tagComponents.push_back(util::TSharedHandle<TextTagComponent>{new TextOpeningTagComponent{info.tagName,info.label,info.attributes,startAnchor,endAnchor}});
+		else
+			tagComponents.push_back(util::TSharedHandle<TextTagComponent>{new TextTagComponent{info.tagName,startAnchor,endAnchor}});
+		line.m_tagComponents.push_back(tagComponents.back());
+	}
+	std::vector<util::TSharedHandle<TextTag>> tags {};
+	tags.reserve(tagInfos.size());
+	for(auto &info : tagInfos)
+	{
+		tags.push_back(util::TSharedHandle<TextTag>{new TextTag{*this,tagComponents[info.first]}});
+		if(info.second != SERIALIZATION_INVALID_INDEX)
+			tags.back()->SetClosingTagComponent(tagComponents[info.second]);
+	}
+	m_tags.Insert(tags);
+
+	if(outAnchorPoints)
+	{
+		outAnchorPoints->clear();
+		outAnchorPoints->reserve(anchorPointInfos.size());
+		for(auto &info : anchorPointInfos)
+			outAnchorPoints->push_back(createAnchorPoint(info));
+	}
+
+	for(auto &line : lines)
+		OnLineAdded(*line);
+	if(m_callbacks.onTagAdded)
+	{
+		for(auto &hTag : tags)
+			m_callbacks.onTagAdded(*hTag);
+	}
+	return true;
+}
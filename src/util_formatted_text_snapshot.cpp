@@ -0,0 +1,317 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "util_formatted_text_snapshot.hpp"
+#include "util_formatted_text.hpp"
+#include "util_formatted_text_tag.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+
+using namespace util::text;
+
+struct TextSnapshot::Node
+{
+	std::shared_ptr<const Line> line = nullptr;
+	// Tags opened within the line, with offsets relative to the start of the line
+	std::shared_ptr<const std::vector<Tag>> tags = nullptr;
+	std::shared_ptr<const Node> left = nullptr;
+	std::shared_ptr<const Node> right = nullptr;
+	uint32_t count = 1u;
+	// Length of the line (including the new-line character) and of the entire subtree
+	TextLength lineLength = 0u;
+	TextLength length = 0u;
+	size_t tagCount = 0u;
+	// Highest end offset of all tags within the subtree, relative to the start of the subtree
+	TextOffset maxTagEndOffset = 0u;
+};
+
+// Unclosed tags extend to the end of the text
+static constexpr auto MAX_TAG_END_OFFSET = std::numeric_limits<TextOffset>::max();
+static uint32_t get_count(const TextSnapshot::Node *node) {return node ? node->count : 0u;}
+static TextLength get_length(const TextSnapshot::Node *node) {return node ? node->length : 0u;}
+static TextOffset add_tag_offset(TextOffset offset,TextOffset relOffset) {return (relOffset >= MAX_TAG_END_OFFSET -offset) ? MAX_TAG_END_OFFSET : (offset +relOffset);}
+static void pull(TextSnapshot::Node &node)
+{
+	auto *left = node.left.get();
+	auto *right = node.right.get();
+	node.count = 1u +get_count(left) +get_count(right);
+	node.length = node.lineLength +get_length(left) +get_length(right);
+	node.tagCount = node.tags->size() +(left ? left->tagCount : 0u) +(right ? right->tagCount : 0u);
+	auto leftLength = get_length(left);
+	TextOffset maxTagEndOffset = (left && left->tagCount > 0) ? left->maxTagEndOffset : 0u;
+	for(auto &tag : *node.tags)
+		maxTagEndOffset = std::max(maxTagEndOffset,add_tag_offset(leftLength,tag.closed ? (tag.outerOffset +tag.outerLength) : MAX_TAG_END_OFFSET));
+	if(right && right->tagCount > 0)
+		maxTagEndOffset = std::max(maxTagEndOffset,add_tag_offset(leftLength +node.lineLength,right->maxTagEndOffset));
+	node.maxTagEndOffset = maxTagEndOffset;
+}
+// Returns the node of the specified line, as well as the start offset of the line
+static const TextSnapshot::Node *find_line(const TextSnapshot::Node *node,LineIndex lineIdx,TextOffset &outStartOffset)
+{
+	outStartOffset = 0;
+	while(node)
+	{
+		auto leftCount = get_count(node->left.get());
+		if(lineIdx < leftCount)
+		{
+			node = node->left.get();
+			continue;
+		}
+		outStartOffset += get_length(node->left.get());
+		if(lineIdx == leftCount)
+			return node;
+		lineIdx -= leftCount +1;
+		outStartOffset += node->lineLength;
+		node = node->right.get();
+	}
+	return nullptr;
+}
+// Calls f(node,lineIdx,lineStartOffset) for all lines starting at the specified index in order, until f returns false
+template<typename TFunction>
+	static bool for_each_line(const TextSnapshot::Node *node,LineIndex firstLineIdx,LineIndex subtreeLineIdx,TextOffset subtreeOffset,const TFunction &f)
+{
+	if(node == nullptr)
+		return true;
+	auto leftCount = get_count(node->left.get());
+	auto lineIdx = subtreeLineIdx +leftCount;
+	if(firstLineIdx < lineIdx && for_each_line(node->left.get(),firstLineIdx,subtreeLineIdx,subtreeOffset,f) == false)
+		return false;
+	auto lineStartOffset = subtreeOffset +get_length(node->left.get());
+	if(firstLineIdx <= lineIdx && f(*node,lineIdx,lineStartOffset) == false)
+		return false;
+	return for_each_line(node->right.get(),firstLineIdx,lineIdx +1,lineStartOffset +node->lineLength,f);
+}
+static void query_tags(const TextSnapshot::Node *node,TextOffset subtreeOffset,TextOffset startOffset,TextOffset endOffset,std::vector<TextSnapshot::Tag> &outTags)
+{
+	// Subtrees without any tags reaching into the range can be skipped entirely
+	if(node == nullptr || node->tagCount == 0 || subtreeOffset >= endOffset || add_tag_offset(subtreeOffset,node->maxTagEndOffset) <= startOffset)
+		return;
+	query_tags(node->left.get(),subtreeOffset,startOffset,endOffset,outTags);
+	auto lineStartOffset = subtreeOffset +get_length(node->left.get());
+	for(auto &tag : *node->tags)
+	{
+		auto outerOffset = lineStartOffset +tag.outerOffset;
+		if(outerOffset >= endOffset)
+			break;
+		if(tag.closed && outerOffset +tag.outerLength <= startOffset)
+			continue;
+		outTags.push_back(tag);
+		outTags.back().outerOffset = outerOffset;
+		outTags.back().innerOffset += lineStartOffset;
+	}
+	query_tags(node->right.get(),lineStartOffset +node->lineLength,startOffset,endOffset,outTags);
+}
+
+uint32_t TextSnapshot::GetLineCount() const {return get_count(m_root.get());}
+uint32_t TextSnapshot::GetCharCount() const {return get_length(m_root.get());}
+const TextSnapshot::Line &TextSnapshot::GetLine(LineIndex lineIdx) const
+{
+	TextOffset startOffset;
+	auto *node = find_line(m_root.get(),lineIdx,startOffset);
+	if(node == nullptr)
+		throw std::out_of_range{"Line index out of range!"};
+	return *node->line;
+}
+std::optional<TextOffset> TextSnapshot::GetTextCharOffset(LineIndex lineIdx,CharOffset charOffset) const
+{
+	TextOffset startOffset;
+	auto *node = find_line(m_root.get(),lineIdx,startOffset);
+	if(node == nullptr || charOffset >= node->lineLength)
+		return {};
+	return startOffset +charOffset;
+}
+std::optional<std::pair<LineIndex,CharOffset>> TextSnapshot::GetRelativeCharOffset(TextOffset absCharOffset) const
+{
+	if(absCharOffset >= GetCharCount())
+		return {};
+	LineIndex lineIdx = 0;
+	auto *node = m_root.get();
+	while(node)
+	{
+		auto leftLength = get_length(node->left.get());
+		if(absCharOffset < leftLength)
+		{
+			node = node->left.get();
+			continue;
+		}
+		absCharOffset -= leftLength;
+		lineIdx += get_count(node->left.get());
+		if(absCharOffset < node->lineLength)
+			break;
+		absCharOffset -= node->lineLength;
+		++lineIdx;
+		node = node->right.get();
+	}
+	return {{lineIdx,static_cast<CharOffset>(absCharOffset)}};
+}
+util::Utf8String TextSnapshot::Substr(TextOffset startOffset,TextLength len) const
+{
+	auto relOffset = GetRelativeCharOffset(startOffset);
+	if(relOffset.has_value() == false)
+		return "";
+	util::Utf8String result = "";
+	auto charOffset = relOffset->second;
+	auto lineCount = GetLineCount();
+	for_each_line(m_root.get(),relOffset->first,0,0,[&result,&charOffset,&len,lineCount](const Node &node,LineIndex lineIdx,TextOffset) -> bool {
+		auto &text = node.line->unformattedText;
+		if(charOffset < text.length())
+		{
+			auto n = std::min<TextLength>(len,text.length() -charOffset);
+			result += util::Utf8StringView{text}.substr(charOffset,n);
+			len -= n;
+		}
+		// New-line character
+		if(len > 0 && lineIdx +1 < lineCount)
+		{
+			result += '\n';
+			--len;
+		}
+		charOffset = 0;
+		return len > 0;
+	});
+	return result;
+}
+
+const util::Utf8String &TextSnapshot::GetUnformattedText() const
+{
+	std::call_once(m_unformattedTextFlag,[this]() {
+		for_each_line(m_root.get(),0,0,0,[this](const Node &node,LineIndex lineIdx,TextOffset) -> bool {
+			if(lineIdx > 0)
+				m_unformattedText += '\n';
+			m_unformattedText += node.line->unformattedText;
+			return true;
+		});
+	});
+	return m_unformattedText;
+}
+const util::Utf8String &TextSnapshot::GetFormattedText() const
+{
+	std::call_once(m_formattedTextFlag,[this]() {
+		for_each_line(m_root.get(),0,0,0,[this](const Node &node,LineIndex lineIdx,TextOffset) -> bool {
+			if(lineIdx > 0)
+				m_formattedText += '\n';
+			m_formattedText += node.line->formattedText;
+			return true;
+		});
+	});
+	return m_formattedText;
+}
+
+const std::vector<TextSnapshot::Tag> &TextSnapshot::GetTags() const
+{
+	std::call_once(m_tagsFlag,[this]() {
+		m_tags.reserve(m_root ? m_root->tagCount : 0u);
+		for_each_line(m_root.get(),0,0,0,[this](const Node &node,LineIndex,TextOffset lineStartOffset) -> bool {
+			for(auto &tag : *node.tags)
+			{
+				m_tags.push_back(tag);
+				m_tags.back().outerOffset += lineStartOffset;
+				m_tags.back().innerOffset += lineStartOffset;
+			}
+			return true;
+		});
+	});
+	return m_tags;
+}
+std::vector<TextSnapshot::Tag> TextSnapshot::QueryTags(TextOffset startOffset,TextLength len) const
+{
+	std::vector<Tag> tags {};
+	if(len == 0)
+		return tags;
+	auto charCount = GetCharCount();
+	auto endOffset = (startOffset < charCount) ? (startOffset +std::min<TextLength>(len,charCount -startOffset)) : startOffset;
+	query_tags(m_root.get(),0,startOffset,endOffset,tags);
+	return tags;
+}
+
+PTextSnapshot FormattedText::Snapshot() const
+{
+	UpdateTextInfo();
+	if(m_textInfo.snapshot)
+		return m_textInfo.snapshot;
+	// The ranges of the tags intersecting a changed line may have changed as well, even if they were opened in a different line
+	for(auto &wpLine : m_textInfo.snapshotChangedLines)
+	{
+		auto line = wpLine.lock();
+		if(line == nullptr)
+			continue;
+		line->m_bSnapshotChangeRecorded = false;
+		if(line->m_treeNode == nullptr)
+			continue;
+		// Tags that have become invalid have to be removed from the snapshot as well
+		for(auto &it : m_tags.Query(line->GetStartOffset(),line->GetAbsEndOffset(),true))
+		{
+			auto &hTag = *it;
+			if(hTag.IsExpired() == false)
+				hTag->InvalidateSnapshot();
+		}
+	}
+	m_textInfo.snapshotChangedLines.clear();
+	m_textInfo.trackSnapshotChanges = true;
+
+	auto snapshot = std::shared_ptr<TextSnapshot>{new TextSnapshot{}};
+	if(auto *root = m_textLines.GetRoot())
+		snapshot->m_root = GetSnapshotNode(*root);
+	m_textInfo.snapshot = snapshot;
+	return snapshot;
+}
+std::shared_ptr<const TextSnapshot::Node> FormattedText::GetSnapshotNode(LineTree::Node &node) const
+{
+	if(node.snapshot)
+		return node.snapshot;
+	auto snapshotNode = std::make_shared<TextSnapshot::Node>();
+	// Formatting the line may update the lengths in the line tree, so this has to happen before the lengths are read
+	snapshotNode->line = node.line->GetSnapshot();
+	snapshotNode->tags = GetSnapshotTags(*node.line);
+	if(node.left)
+		snapshotNode->left = GetSnapshotNode(*node.left);
+	if(node.right)
+		snapshotNode->right = GetSnapshotNode(*node.right);
+	snapshotNode->lineLength = node.length;
+	pull(*snapshotNode);
+	node.snapshot = snapshotNode;
+	return snapshotNode;
+}
+std::shared_ptr<const std::vector<TextSnapshot::Tag>> FormattedText::GetSnapshotTags(FormattedTextLine &line) const
+{
+	if(line.m_snapshotTags)
+		return line.m_snapshotTags;
+	auto startOffset = line.GetStartOffset();
+	auto endOffset = line.GetAbsEndOffset();
+	auto candidateTags = m_tags.Query(startOffset,endOffset);
+	// Most lines don't contain any tags
+	static const auto noTags = std::make_shared<const std::vector<TextSnapshot::Tag>>();
+	if(candidateTags.empty())
+	{
+		line.m_snapshotTags = noTags;
+		return noTags;
+	}
+	auto tags = std::make_shared<std::vector<TextSnapshot::Tag>>();
+	for(auto &it : candidateTags)
+	{
+		auto &hTag = *it;
+		if(hTag.IsExpired() || hTag->IsValid() == false)
+			continue;
+		auto &tag = *hTag;
+		auto outerRange = tag.GetOuterRange();
+		if(outerRange.has_value() == false || outerRange->first < startOffset || outerRange->first > endOffset)
+			continue;
+		// Tags without contents don't have an inner range
+		auto innerRange = tag.GetInnerRange().value_or(std::pair<TextOffset,TextLength>{outerRange->first +tag.GetOpeningTagComponent()->GetLength(),0});
+		// The name, label and attributes of a tag never change, so they only have to be copied once
+		if(tag.m_snapshotInfo == nullptr)
+		{
+			auto *openingTag = tag.GetOpeningTagComponent();
+			tag.m_snapshotInfo = std::make_shared<TextSnapshot::TagInfo>(TextSnapshot::TagInfo{openingTag->GetTagName(),openingTag->GetLabel(),openingTag->GetTagAttributes()});
+		}
+		tag.m_wpSnapshotLine = line.weak_from_this();
+		tags->push_back({tag.m_snapshotInfo,outerRange->first -startOffset,outerRange->second,innerRange.first -startOffset,innerRange.second,tag.IsClosed()});
+	}
+	std::stable_sort(tags->begin(),tags->end(),[](const TextSnapshot::Tag &a,const TextSnapshot::Tag &b) {
+		return a.outerOffset < b.outerOffset;
+	});
+	line.m_snapshotTags = tags;
+	return tags;
+}
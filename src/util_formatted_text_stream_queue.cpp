@@ -0,0 +1,51 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "util_formatted_text_stream_queue.hpp"
+
+using namespace util::text;
+
+TextStreamQueue::~TextStreamQueue()
+{
+	auto *chunk = m_head.exchange(nullptr,std::memory_order_acquire);
+	while(chunk)
+	{
+		auto *next = chunk->next;
+		delete chunk;
+		chunk = next;
+	}
+}
+void TextStreamQueue::Push(std::string chunk)
+{
+	auto *newChunk = new Chunk{std::move(chunk),m_head.load(std::memory_order_relaxed)};
+	while(m_head.compare_exchange_weak(newChunk->next,newChunk,std::memory_order_release,std::memory_order_relaxed) == false)
+		;
+}
+bool TextStreamQueue::IsEmpty() const {return m_head.load(std::memory_order_relaxed) == nullptr;}
+size_t TextStreamQueue::Drain(std::string &outText)
+{
+	// Take all chunks at once, the list is ordered from newest to oldest and has to be reversed
+	auto *chunk = m_head.exchange(nullptr,std::memory_order_acquire);
+	Chunk *first = nullptr;
+	size_t size = 0;
+	size_t count = 0;
+	while(chunk)
+	{
+		auto *next = chunk->next;
+		chunk->next = first;
+		first = chunk;
+		size += chunk->text.size();
+		++count;
+		chunk = next;
+	}
+	outText.reserve(outText.size() +size);
+	while(first)
+	{
+		auto *next = first->next;
+		outText += first->text;
+		delete first;
+		first = next;
+	}
+	return count;
+}
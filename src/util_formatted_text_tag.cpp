@@ -10,7 +10,7 @@ using namespace util::text;
 const decltype(TextTag::TAG_PREFIX) TextTag::TAG_PREFIX = "{[";
 const decltype(TextTag::TAG_POSTFIX) TextTag::TAG_POSTFIX = "]}";
 
-TextTagComponent::TextTagComponent(const std::string &tagName,const util::TSharedHandle<AnchorPoint> &startAnchor,const util::TSharedHandle<AnchorPoint> &endAnchor)
+TextTagComponent::TextTagComponent(const std::string &tagName,const AnchorPointHandle &startAnchor,const AnchorPointHandle &endAnchor)
 	: m_tagName{tagName},m_startAnchor{startAnchor},m_endAnchor{endAnchor}
 {}
 bool TextTagComponent::operator==(const TextTagComponent &other) const
@@ -61,7 +61,7 @@ const std::string &TextTagComponent::GetTagName() const {return m_tagName;}
 
 TextOpeningTagComponent::TextOpeningTagComponent(
 	const std::string &tagName,const std::string &label,const std::vector<std::string> &attributes,
-	const util::TSharedHandle<AnchorPoint> &startAnchor,const util::TSharedHandle<AnchorPoint> &endAnchor
+	const AnchorPointHandle &startAnchor,const AnchorPointHandle &endAnchor
 )
 	: TextTagComponent{tagName,startAnchor,endAnchor},m_label{label},m_attributes{attributes}
 {}
@@ -120,7 +120,10 @@ util::Utf8String TextTag::GetTagContents() const
 {
 	if(IsValid() == false)
 		return {};
+	// Tags without contents don't have an inner range
 	auto range = GetInnerRange();
+	if(range.has_value() == false)
+		return {};
 	return m_wpText.lock()->Substr(range->first,range->second);
 }
 util::Utf8String TextTag::GetTagString() const
@@ -128,6 +131,8 @@ util::Utf8String TextTag::GetTagString() const
 	if(IsValid() == false)
 		return {};
 	auto range = GetOuterRange();
+	if(range.has_value() == false)
+		return {};
 	return m_wpText.lock()->Substr(range->first,range->second);
 }
 util::Utf8String TextTag::GetOpeningTag() const
@@ -142,9 +147,23 @@ util::Utf8String TextTag::GetClosingTag() const
 		return "";
 	return m_closingTag->GetTagString(*m_wpText.lock());
 }
-void TextTag::SetClosingTagComponent(const util::TSharedHandle<TextTagComponent> &closingTag) {m_closingTag = closingTag;}
+void TextTag::SetClosingTagComponent(const util::TSharedHandle<TextTagComponent> &closingTag)
+{
+	m_closingTag = closingTag;
+	InvalidateSnapshot();
+}
 const TextOpeningTagComponent *TextTag::GetOpeningTagComponent() const {return const_cast<TextTag*>(this)->GetOpeningTagComponent();}
 TextOpeningTagComponent *TextTag::GetOpeningTagComponent() {return static_cast<TextOpeningTagComponent*>(m_openingTag.Get());}
 const TextTagComponent *TextTag::GetClosingTagComponent() const {return const_cast<TextTag*>(this)->GetClosingTagComponent();}
 TextTagComponent *TextTag::GetClosingTagComponent() {return m_closingTag.Get();}
+void TextTag::InvalidateSnapshot()
+{
+	// The anchor points of the opening tag component may already have been removed, or moved to a different line
+	if(auto line = m_wpSnapshotLine.lock())
+		line->InvalidateSnapshotTags();
+	auto *openingTag = GetOpeningTagComponent();
+	auto *anchorPoint = openingTag ? openingTag->GetStartAnchorPoint() : nullptr;
+	if(anchorPoint && anchorPoint->IsValid())
+		anchorPoint->GetLine().InvalidateSnapshotTags();
+}
 #pragma optimize("",on)
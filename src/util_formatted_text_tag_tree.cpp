@@ -0,0 +1,429 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "util_formatted_text_tag_tree.hpp"
+#include "util_formatted_text_tag.hpp"
+#include "util_formatted_text_anchor_point.hpp"
+#include <algorithm>
+#include <limits>
+
+using namespace util::text;
+
+TagTree::Iterator::Iterator(const TagTree &tree,Node *node)
+	: m_tree{&tree},m_node{node}
+{}
+TagTree::Iterator::reference TagTree::Iterator::operator*() const {return m_node->tag;}
+TagTree::Iterator::pointer TagTree::Iterator::operator->() const {return &m_node->tag;}
+TagTree::Iterator &TagTree::Iterator::operator++()
+{
+	m_node = TagTree::GetNext(m_node);
+	return *this;
+}
+TagTree::Iterator TagTree::Iterator::operator++(int)
+{
+	auto it = *this;
+	++(*this);
+	return it;
+}
+TagTree::Iterator &TagTree::Iterator::operator--()
+{
+	// Decrementing the end iterator yields the last tag
+	m_node = m_node ? TagTree::GetPrevious(m_node) : TagTree::GetLast(m_tree->m_root);
+	return *this;
+}
+TagTree::Iterator TagTree::Iterator::operator--(int)
+{
+	auto it = *this;
+	--(*this);
+	return it;
+}
+bool TagTree::Iterator::operator==(const Iterator &other) const {return m_node == other.m_node;}
+bool TagTree::Iterator::operator!=(const Iterator &other) const {return operator==(other) == false;}
+
+//////////////
+
+TagTree::~TagTree() {Clear();}
+
+bool TagTree::GetRange(const Node *node,Range &outRange)
+{
+	if(node == nullptr || node->tag.IsExpired() || node->tag->IsValid() == false)
+		return false;
+	auto &tag = *node->tag;
+	auto *openingTag = tag.GetOpeningTagComponent();
+	outRange.start = openingTag->GetStartAnchorPoint()->GetTextCharOffset();
+	outRange.minOffset = outRange.start;
+	outRange.maxOffset = openingTag->GetEndAnchorPoint()->GetTextCharOffset();
+	if(tag.IsClosed() == false)
+	{
+		// Unclosed tags extend to the end of the text
+		outRange.maxOffset = std::numeric_limits<TextOffset>::max();
+		return true;
+	}
+	// The closing tag may be located in front of the opening tag
+	auto *closingTag = tag.GetClosingTagComponent();
+	outRange.minOffset = std::min(outRange.minOffset,closingTag->GetStartAnchorPoint()->GetTextCharOffset());
+	outRange.maxOffset = std::max(outRange.maxOffset,closingTag->GetEndAnchorPoint()->GetTextCharOffset());
+	return true;
+}
+bool TagTree::GetKnownRange(const Node *node,Range &outRange) {return node && node->volatileCount == 0 && GetRange(node,outRange);}
+uint32_t TagTree::GetCount(const Node *node) {return node ? node->count : 0u;}
+uint32_t TagTree::GetInvalidCount(const Node *node) {return node ? node->invalidCount : 0u;}
+
+// Returns whichever of the two nodes has the lower (or higher) offset. If the offset of a node can't be determined anymore,
+// that node is returned instead, which prevents lookups from skipping the subtree until the cache has been rebuilt.
+template<TextOffset TagTree::Range::*TOffset,bool TMax>
+	TagTree::Node *TagTree::SelectNode(Node *a,Node *b)
+{
+	if(a == nullptr)
+		return b;
+	if(b == nullptr)
+		return a;
+	Range rangeA;
+	if(GetKnownRange(a,rangeA) == false)
+		return a;
+	Range rangeB;
+	if(GetKnownRange(b,rangeB) == false)
+		return b;
+	if constexpr(TMax)
+		return (rangeB.*TOffset > rangeA.*TOffset) ? b : a;
+	else
+		return (rangeB.*TOffset < rangeA.*TOffset) ? b : a;
+}
+void TagTree::Pull(Node &node)
+{
+	node.count = 1u +GetCount(node.left) +GetCount(node.right);
+	Range range;
+	auto valid = GetRange(&node,range);
+	node.invalidCount = (valid ? 0u : 1u) +GetInvalidCount(node.left) +GetInvalidCount(node.right);
+	// Tags with volatile offsets have to be included, so they propagate upwards as unknown
+	auto *self = (valid || node.volatileCount > 0) ? &node : nullptr;
+	node.minOffset = SelectNode<&Range::minOffset,false>(SelectNode<&Range::minOffset,false>(node.left ? node.left->minOffset : nullptr,self),node.right ? node.right->minOffset : nullptr);
+	node.maxOffset = SelectNode<&Range::maxOffset,true>(SelectNode<&Range::maxOffset,true>(node.left ? node.left->maxOffset : nullptr,self),node.right ? node.right->maxOffset : nullptr);
+	node.maxStartOffset = SelectNode<&Range::start,true>(SelectNode<&Range::start,true>(node.left ? node.left->maxStartOffset : nullptr,self),node.right ? node.right->maxStartOffset : nullptr);
+	if(node.left)
+		node.left->parent = &node;
+	if(node.right)
+		node.right->parent = &node;
+}
+void TagTree::PullSubtree(Node &node)
+{
+	if(node.left)
+		PullSubtree(*node.left);
+	if(node.right)
+		PullSubtree(*node.right);
+	Pull(node);
+}
+void TagTree::PullPath(Node &node)
+{
+	for(auto *cur=&node;cur;cur=cur->parent)
+		Pull(*cur);
+}
+
+TagTree::Node *TagTree::GetFirst(Node *node)
+{
+	if(node == nullptr)
+		return nullptr;
+	while(node->left)
+		node = node->left;
+	return node;
+}
+TagTree::Node *TagTree::GetLast(Node *node)
+{
+	if(node == nullptr)
+		return nullptr;
+	while(node->right)
+		node = node->right;
+	return node;
+}
+TagTree::Node *TagTree::GetNext(Node *node)
+{
+	if(node->right)
+		return GetFirst(node->right);
+	while(node->parent && node->parent->right == node)
+		node = node->parent;
+	return node->parent;
+}
+TagTree::Node *TagTree::GetPrevious(Node *node)
+{
+	if(node->left)
+		return GetLast(node->left);
+	while(node->parent && node->parent->left == node)
+		node = node->parent;
+	return node->parent;
+}
+uint32_t TagTree::GetIndex(const Node &node)
+{
+	auto idx = GetCount(node.left);
+	for(auto *cur=&node;cur->parent;cur=cur->parent)
+	{
+		if(cur->parent->right == cur)
+			idx += GetCount(cur->parent->left) +1u;
+	}
+	return idx;
+}
+
+TagTree::Node *TagTree::Merge(Node *a,Node *b)
+{
+	if(a == nullptr)
+		return b;
+	if(b == nullptr)
+		return a;
+	if(a->priority > b->priority)
+	{
+		a->right = Merge(a->right,b);
+		Pull(*a);
+		return a;
+	}
+	b->left = Merge(a,b->left);
+	Pull(*b);
+	return b;
+}
+void TagTree::Split(Node *node,uint32_t count,Node *&outLeft,Node *&outRight)
+{
+	if(node == nullptr)
+	{
+		outLeft = nullptr;
+		outRight = nullptr;
+		return;
+	}
+	auto leftCount = GetCount(node->left);
+	if(leftCount < count)
+	{
+		Node *right = nullptr;
+		Split(node->right,count -leftCount -1u,node->right,right);
+		if(right)
+			right->parent = nullptr;
+		Pull(*node);
+		outLeft = node;
+		outRight = right;
+		return;
+	}
+	Node *left = nullptr;
+	Split(node->left,count,left,node->left);
+	if(left)
+		left->parent = nullptr;
+	Pull(*node);
+	outLeft = left;
+	outRight = node;
+}
+void TagTree::Destroy(Node *node)
+{
+	if(node == nullptr)
+		return;
+	Destroy(node->left);
+	Destroy(node->right);
+	delete node;
+}
+uint32_t TagTree::GeneratePriority()
+{
+	// xorshift32; Deterministic, so the tree layout is reproducible across runs
+	m_seed ^= m_seed<<13u;
+	m_seed ^= m_seed>>17u;
+	m_seed ^= m_seed<<5u;
+	return m_seed;
+}
+
+void TagTree::Update() const
+{
+	if(m_bDirty == false)
+		return;
+	m_bDirty = false;
+	if(m_root)
+		PullSubtree(*m_root);
+}
+void TagTree::Invalidate() {m_bDirty = true;}
+void TagTree::Refresh(Iterator it)
+{
+	if(it.m_node)
+		PullPath(*it.m_node);
+}
+void TagTree::BeginVolatileOffsets(const std::vector<AnchorPointHandle> &anchorPoints)
+{
+	m_volatileNodes.push_back({});
+	if(anchorPoints.empty())
+		return;
+	auto startOffset = std::numeric_limits<TextOffset>::max();
+	TextOffset endOffset = 0;
+	for(auto &hAnchorPoint : anchorPoints)
+	{
+		auto offset = hAnchorPoint->GetTextCharOffset();
+		startOffset = std::min(startOffset,offset);
+		endOffset = std::max(endOffset,offset);
+	}
+	auto &nodes = m_volatileNodes.back();
+	for(auto &it : Query(startOffset,endOffset,true))
+		nodes.push_back(it.m_node);
+	for(auto *node : nodes)
+	{
+		++node->volatileCount;
+		PullPath(*node);
+	}
+}
+void TagTree::EndVolatileOffsets()
+{
+	if(m_volatileNodes.empty())
+		return;
+	auto nodes = std::move(m_volatileNodes.back());
+	m_volatileNodes.pop_back();
+	// The other tags have been shifted uniformly, so only the paths of the affected tags have to be updated
+	for(auto *node : nodes)
+	{
+		if(node == nullptr)
+			continue; // Tag has been erased in the meantime
+		--node->volatileCount;
+		PullPath(*node);
+	}
+}
+
+bool TagTree::FindFirstAfter(Node *node,TextOffset offset,uint32_t &outIdx)
+{
+	Range range;
+	if(node == nullptr || node->maxStartOffset == nullptr || (GetKnownRange(node->maxStartOffset,range) && range.start <= offset))
+		return false;
+	if(FindFirstAfter(node->left,offset,outIdx))
+		return true;
+	if(GetRange(node,range) && range.start > offset)
+	{
+		outIdx = GetCount(node->left);
+		return true;
+	}
+	if(FindFirstAfter(node->right,offset,outIdx) == false)
+		return false;
+	outIdx += GetCount(node->left) +1u;
+	return true;
+}
+void TagTree::InvalidateSnapshot(const util::TSharedHandle<TextTag> &tag)
+{
+	if(tag.IsExpired() == false)
+		tag->InvalidateSnapshot();
+}
+
+TagTree::Iterator TagTree::Insert(const util::TSharedHandle<TextTag> &tag)
+{
+	Update();
+	auto *node = new Node{};
+	node->tag = tag;
+	node->priority = GeneratePriority();
+
+	Range range;
+	uint32_t idx = 0u;
+	if(GetRange(node,range) == false || FindFirstAfter(m_root,range.start,idx) == false)
+		idx = GetCount(m_root);
+	Pull(*node);
+
+	Node *left = nullptr;
+	Node *right = nullptr;
+	Split(m_root,idx,left,right);
+	m_root = Merge(Merge(left,node),right);
+	m_root->parent = nullptr;
+	InvalidateSnapshot(tag);
+	return Iterator{*this,node};
+}
+void TagTree::Insert(const std::vector<util::TSharedHandle<TextTag>> &tags)
+{
+	if(tags.empty())
+		return;
+	Update();
+	// The tags are already in order, so the subtree can be built in linear time by keeping track of its right spine
+	std::vector<Node*> rightSpine {};
+	Node *first = nullptr;
+	for(auto &tag : tags)
+	{
+		auto *node = new Node{};
+		node->tag = tag;
+		node->priority = GeneratePriority();
+		Node *left = nullptr;
+		while(rightSpine.empty() == false && rightSpine.back()->priority < node->priority)
+		{
+			left = rightSpine.back();
+			rightSpine.pop_back();
+		}
+		node->left = left;
+		if(rightSpine.empty() == false)
+			rightSpine.back()->right = node;
+		rightSpine.push_back(node);
+		if(first == nullptr)
+			first = node;
+	}
+	auto *subtree = rightSpine.front();
+	subtree->parent = nullptr;
+	PullSubtree(*subtree);
+
+	Range range;
+	uint32_t idx = 0u;
+	if(GetRange(first,range) == false || FindFirstAfter(m_root,range.start,idx) == false)
+		idx = GetCount(m_root);
+	Node *left = nullptr;
+	Node *right = nullptr;
+	Split(m_root,idx,left,right);
+	m_root = Merge(Merge(left,subtree),right);
+	m_root->parent = nullptr;
+	for(auto &tag : tags)
+		InvalidateSnapshot(tag);
+}
+TagTree::Iterator TagTree::Erase(Iterator it)
+{
+	auto *node = it.m_node;
+	if(node == nullptr)
+		return end();
+	auto *next = GetNext(node);
+	InvalidateSnapshot(node->tag);
+	if(node->volatileCount > 0)
+	{
+		for(auto &nodes : m_volatileNodes)
+			std::replace(nodes.begin(),nodes.end(),node,static_cast<Node*>(nullptr));
+	}
+	Node *left = nullptr;
+	Node *mid = nullptr;
+	Node *right = nullptr;
+	Split(m_root,GetIndex(*node),left,right);
+	Split(right,1u,mid,right);
+	m_root = Merge(left,right);
+	if(m_root)
+		m_root->parent = nullptr;
+	delete mid;
+	return Iterator{*this,next};
+}
+void TagTree::Clear()
+{
+	Destroy(m_root);
+	m_root = nullptr;
+	for(auto &nodes : m_volatileNodes)
+		nodes.clear();
+	m_bDirty = false;
+}
+
+void TagTree::Query(Node *node,TextOffset startOffset,TextOffset endOffset,bool includeInvalidTags,const TagTree &tree,std::vector<Iterator> &outTags)
+{
+	if(node == nullptr)
+		return;
+	if(includeInvalidTags == false || node->invalidCount == 0)
+	{
+		// Skip the entire subtree if none of its tags can overlap the range
+		Range range;
+		if(
+			node->minOffset == nullptr ||
+			(GetKnownRange(node->minOffset,range) && range.minOffset > endOffset) ||
+			(GetKnownRange(node->maxOffset,range) && range.maxOffset < startOffset)
+		)
+			return;
+	}
+	Query(node->left,startOffset,endOffset,includeInvalidTags,tree,outTags);
+	Range range;
+	if(GetRange(node,range) ? (range.minOffset <= endOffset && range.maxOffset >= startOffset) : includeInvalidTags)
+		outTags.push_back(Iterator{tree,node});
+	Query(node->right,startOffset,endOffset,includeInvalidTags,tree,outTags);
+}
+std::vector<TagTree::Iterator> TagTree::Query(TextOffset startOffset,TextOffset endOffset,bool includeInvalidTags) const
+{
+	Update();
+	std::vector<Iterator> tags {};
+	Query(m_root,startOffset,endOffset,includeInvalidTags,*this,tags);
+	return tags;
+}
+
+size_t TagTree::size() const {return GetCount(m_root);}
+bool TagTree::empty() const {return m_root == nullptr;}
+TagTree::Iterator TagTree::begin() const {return Iterator{*this,GetFirst(m_root)};}
+TagTree::Iterator TagTree::end() const {return Iterator{*this,nullptr};}
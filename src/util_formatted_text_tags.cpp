@@ -5,14 +5,180 @@
 #include "util_formatted_text.hpp"
 #include "util_formatted_text_tag.hpp"
 #include <algorithm>
+#include <bit>
+#include <cstring>
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
 
 using namespace util::text;
 
+// Returns a pointer to the first occurrence of the tag prefix in the byte range [begin,end), or end if there is none.
+// Both prefix characters are ASCII, so they can never be part of a multi-byte UTF-8 sequence.
+static const char *find_tag_prefix(const char *begin,const char *end)
+{
+	const auto c0 = TextTag::TAG_PREFIX[0];
+	const auto c1 = TextTag::TAG_PREFIX[1];
+	auto *p = begin;
+#if defined(__AVX2__)
+	const auto v0 = _mm256_set1_epi8(c0);
+	const auto v1 = _mm256_set1_epi8(c1);
+	for(;end -p > 32;p += 32)
+	{
+		auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p +1));
+		auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a,v0),_mm256_cmpeq_epi8(b,v1))));
+		if(mask != 0)
+			return p +std::countr_zero(mask);
+	}
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	const auto w0 = _mm_set1_epi8(c0);
+	const auto w1 = _mm_set1_epi8(c1);
+	for(;end -p > 16;p += 16)
+	{
+		auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p +1));
+		auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a,w0),_mm_cmpeq_epi8(b,w1))));
+		if(mask != 0)
+			return p +std::countr_zero(mask);
+	}
+#endif
+	for(;end -p > 1;++p)
+	{
+		if(p[0] == c0 && p[1] == c1)
+			return p;
+	}
+	return end;
+}
+static bool is_utf8_continuation_byte(char c) {return (static_cast<uint8_t>(c) &0xC0u) == 0x80u;}
+static TextLength count_code_points(const char *begin,const char *end)
+{
+	TextLength n = 0;
+	for(auto *p=begin;p<end;++p)
+		n += is_utf8_continuation_byte(*p) ? 0 : 1;
+	return n;
+}
+static const char *skip_code_points(const char *p,const char *end,TextLength count)
+{
+	for(;count > 0 && p < end;--count)
+	{
+		++p;
+		while(p < end && is_utf8_continuation_byte(*p))
+			++p;
+	}
+	return p;
+}
+
 void FormattedText::ParseTags(LineIndex lineIdx,CharOffset offset,TextLength len)
 {
 	if(AreTagsEnabled() == false || lineIdx >= m_textLines.size())
 		return;
 	auto &line = *m_textLines.at(lineIdx);
+	if(m_batch.depth > 0 && line.GetTagComponents().empty())
+	{
+		// None of the existing tags are anchored in this line, so it can safely be parsed in full once the batch ends
+		m_batch.pendingTagLines.insert(&line);
+		return;
+	}
+	ParseTags(line,offset,len);
+}
+void FormattedText::ParsePendingTags(LineIndex endLineIdx)
+{
+	if(m_batch.pendingTagLines.empty())
+		return;
+	if(AreTagsEnabled() == false)
+	{
+		m_batch.pendingTagLines.clear();
+		return;
+	}
+	std::vector<std::pair<LineIndex,PFormattedTextLine>> lines {};
+	lines.reserve(m_batch.pendingTagLines.size());
+	for(auto *line : m_batch.pendingTagLines)
+	{
+		auto lineIdx = line->GetIndex();
+		if(lineIdx < endLineIdx)
+			lines.push_back({lineIdx,line->shared_from_this()});
+	}
+	// Tags may span multiple lines, so the lines have to be parsed in order
+	std::sort(lines.begin(),lines.end(),[](const std::pair<LineIndex,PFormattedTextLine> &a,const std::pair<LineIndex,PFormattedTextLine> &b) {
+		return a.first < b.first;
+	});
+	for(auto &pair : lines)
+		m_batch.pendingTagLines.erase(pair.second.get());
+	m_bDirty = true;
+	std::vector<FormattedTextLine*> linesToParse {};
+	linesToParse.reserve(lines.size());
+	for(auto &pair : lines)
+	{
+		if(pair.second->GetIndex() != INVALID_LINE_INDEX)
+			linesToParse.push_back(pair.second.get());
+	}
+	ParseTags(linesToParse);
+}
+void FormattedText::ParseTags(const std::vector<FormattedTextLine*> &lines)
+{
+	if(AreTagsEnabled() == false || lines.empty())
+		return;
+	// Tokenizing a line only affects the line itself, so all lines are tokenized before any of the components are paired up.
+	// Lines which already have tag components may affect existing tags and are parsed as usual further below.
+	std::vector<std::vector<util::TSharedHandle<TextTagComponent>>> newTagComponents(lines.size());
+	std::vector<uint8_t> tokenized(lines.size(),0);
+	for(auto i=decltype(lines.size()){0u};i<lines.size();++i)
+	{
+		auto &line = *lines[i];
+		if(line.GetTagComponents().empty() == false)
+			continue;
+		ParseTagComponents(line,0,line.GetAbsLength(),newTagComponents[i]);
+		tokenized[i] = 1;
+	}
+
+	// If none of the existing tags are in the way, which is always the case when loading a new text, the components of
+	// all lines can be paired up in a single pass. Otherwise each line has to be merged with the existing tags separately.
+	auto candidateTags = m_tags.Query(lines.front()->GetStartOffset(),lines.back()->GetAbsEndOffset(),true);
+	auto canMerge = std::find(tokenized.begin(),tokenized.end(),0) == tokenized.end() && std::find_if(candidateTags.begin(),candidateTags.end(),[](const TagTree::Iterator &it) {
+		return it->IsExpired() == false;
+	}) == candidateTags.end();
+	if(canMerge)
+	{
+		for(auto &it : candidateTags)
+			m_tags.Erase(it);
+		size_t numTagComponents = 0;
+		for(auto &tagComponents : newTagComponents)
+			numTagComponents += tagComponents.size();
+		std::vector<util::TSharedHandle<TextTagComponent>> allTagComponents {};
+		allTagComponents.reserve(numTagComponents);
+		for(auto &tagComponents : newTagComponents)
+			allTagComponents.insert(allTagComponents.end(),tagComponents.begin(),tagComponents.end());
+		auto newTags = PairTagComponents(allTagComponents);
+		m_tags.Insert(newTags);
+		if(m_callbacks.onTagAdded)
+		{
+			for(auto &hTag : newTags)
+			{
+				if(hTag.IsExpired())
+					continue;
+				m_callbacks.onTagAdded(*hTag);
+			}
+		}
+		return;
+	}
+	for(auto i=decltype(lines.size()){0u};i<lines.size();++i)
+	{
+		auto &line = *lines[i];
+		if(tokenized[i] == 0)
+		{
+			ParseTags(line,0,UNTIL_THE_END);
+			continue;
+		}
+		auto absOffset = line.GetStartOffset();
+		auto absEndOffset = absOffset +line.GetAbsLength() -1;
+		auto candidateTags = m_tags.Query(absOffset,absEndOffset,true);
+		UpdateTags(candidateTags,absOffset,absEndOffset,newTagComponents[i]);
+	}
+}
+void FormattedText::ParseTags(FormattedTextLine &line,CharOffset offset,TextLength len)
+{
 	if(offset == LAST_CHAR)
 		offset = line.GetLength();
 	auto absOffset = line.GetStartOffset() +offset;
@@ -21,6 +187,27 @@ void FormattedText::ParseTags(LineIndex lineIdx,CharOffset offset,TextLength len
 	auto absEndOffset = absOffset +len -1;
 	
 	auto &tagComponents = line.GetTagComponents();
+	// The tags which may be affected have to be looked up before any tag components are removed below,
+	// because the offsets of tags with removed components can't be determined anymore
+	auto candidateStartOffset = absOffset;
+	auto candidateEndOffset = absEndOffset;
+	for(auto &hTagComponent : tagComponents)
+	{
+		if(hTagComponent->IsValid() == false)
+			continue;
+		auto startOffset = hTagComponent->GetStartAnchorPoint()->GetTextCharOffset();
+		auto endOffset = hTagComponent->GetEndAnchorPoint()->GetTextCharOffset();
+		if(
+			(startOffset >= candidateStartOffset && startOffset <= candidateEndOffset) ||
+			(endOffset >= candidateStartOffset && endOffset <= candidateEndOffset)
+		)
+		{
+			candidateStartOffset = std::min(candidateStartOffset,startOffset);
+			candidateEndOffset = std::max(candidateEndOffset,endOffset);
+		}
+	}
+	auto candidateTags = m_tags.Query(candidateStartOffset,candidateEndOffset,true);
+
 	for(auto it=tagComponents.begin();it!=tagComponents.end();)
 	{
 		auto &hTagComponent = *it;
@@ -60,38 +247,61 @@ void FormattedText::ParseTags(LineIndex lineIdx,CharOffset offset,TextLength len
 	len = clampedEndOffset -offset +1;
 
 	std::vector<util::TSharedHandle<TextTagComponent>> newTagComponents {}; // Contains all new tag components in sequential (by character offset) order
-	if(len > 0)
+	ParseTagComponents(line,offset,len,newTagComponents);
+	UpdateTags(candidateTags,absOffset,absEndOffset,newTagComponents);
+}
+void FormattedText::ParseTagComponents(FormattedTextLine &line,CharOffset offset,TextLength len,std::vector<util::TSharedHandle<TextTagComponent>> &outNewTagComponents)
+{
+	if(len == 0)
+		return;
+	// Parse text range and determine tag components with it
+	// Only attempt to parse a tag component where the tag prefix actually occurs, instead of at every character
+	auto &tagComponents = line.GetTagComponents();
+	auto text = line.Substr(offset,len);
+	auto endOffset = offset +len -1;
+	auto lineData = line.GetUnformattedLine().GetData();
+	auto *lineText = lineData.data();
+	auto *lineTextEnd = lineText +lineData.size();
+	auto *p = skip_code_points(lineText,lineTextEnd,offset);
+	for(auto i=offset;;)
 	{
-		// Parse text range and determine tag components with it
-		auto text = line.Substr(offset,len);
-		auto endOffset = offset +len -1;
-		for(auto i=offset;i<=endOffset;)
+		auto *pPrefix = find_tag_prefix(p,lineTextEnd);
+		if(pPrefix == lineTextEnd)
+			break;
+		i += count_code_points(p,pPrefix);
+		p = pPrefix;
+		if(i > endOffset)
+			break;
+		auto substr = text.substr(i -offset);
+		auto tagComponent = line.ParseTagComponent(i,substr);
+		if(tagComponent.IsValid())
 		{
-			auto substr = text.substr(i -offset);
-			auto tagComponent = line.ParseTagComponent(i,substr);
-			if(tagComponent.IsValid())
-			{
-				newTagComponents.insert(std::find_if(newTagComponents.begin(),newTagComponents.end(),[&tagComponent](util::TSharedHandle<TextTagComponent> &hTagComponent) {
-					return hTagComponent->GetStartAnchorPoint()->GetTextCharOffset() > tagComponent->GetStartAnchorPoint()->GetTextCharOffset();
-				}),tagComponent);
+			outNewTagComponents.insert(std::find_if(outNewTagComponents.begin(),outNewTagComponents.end(),[&tagComponent](util::TSharedHandle<TextTagComponent> &hTagComponent) {
+				return hTagComponent->GetStartAnchorPoint()->GetTextCharOffset() > tagComponent->GetStartAnchorPoint()->GetTextCharOffset();
+			}),tagComponent);
 
-				auto offset = tagComponent->GetStartAnchorPoint()->GetTextCharOffset();
-				tagComponents.insert(std::find_if(tagComponents.begin(),tagComponents.end(),[offset](util::TSharedHandle<TextTagComponent> &hTagComponent) {
-					return hTagComponent->GetStartAnchorPoint()->GetTextCharOffset() > offset;
-				}),tagComponent);
-				i += tagComponent->GetLength();
-				continue;
-			}
-			++i;
+			auto offset = tagComponent->GetStartAnchorPoint()->GetTextCharOffset();
+			tagComponents.insert(std::find_if(tagComponents.begin(),tagComponents.end(),[offset](util::TSharedHandle<TextTagComponent> &hTagComponent) {
+				return hTagComponent->GetStartAnchorPoint()->GetTextCharOffset() > offset;
+			}),tagComponent);
+			auto tagLen = tagComponent->GetLength();
+			p = skip_code_points(p,lineTextEnd,tagLen);
+			i += tagLen;
+			continue;
 		}
+		// The first prefix character is a single byte
+		++p;
+		++i;
 	}
-
-	for(auto it=m_tags.begin();it!=m_tags.end();)
+}
+void FormattedText::UpdateTags(std::vector<TagTree::Iterator> &candidateTags,TextOffset absOffset,TextOffset absEndOffset,std::vector<util::TSharedHandle<TextTagComponent>> &newTagComponents)
+{
+	for(auto &it : candidateTags)
 	{
 		auto &hTag = *it;
 		if(hTag.IsExpired())
 		{
-			it = m_tags.erase(it);
+			m_tags.Erase(it);
 			continue;
 		}
 
@@ -109,10 +319,7 @@ void FormattedText::ParseTags(LineIndex lineIdx,CharOffset offset,TextLength len
 					(tag.IsClosed() == true && (tagOffset +tagLen -1) < absOffset) || // Tag has been closed before the input range, it remains unchanged and can be ignored
 					tagOffset > absEndOffset // Tag has been opened after the input range, it remains unchanged and can be ignored
 				)
-				{
-					++it;
 					continue;
-				}
 				removeTag = true;
 			}
 		}
@@ -147,45 +354,104 @@ void FormattedText::ParseTags(LineIndex lineIdx,CharOffset offset,TextLength len
 
 			if(m_callbacks.onTagRemoved)
 				m_callbacks.onTagRemoved(*hTag);
-			hTag.Remove();
-			it = m_tags.erase(it);
-			continue;
+			auto hTagCpy = hTag;
+			m_tags.Erase(it);
+			hTagCpy.Remove();
 		}
-		++it;
 	}
 
-	std::vector<util::TSharedHandle<TextTag>> newOpenTags {};
-	for(auto &hTagComponent : newTagComponents)
+	auto newTags = PairTagComponents(newTagComponents);
+	// The new tags are only added once their closing tags are known, which keeps the cached tag ranges accurate
+	for(auto &hTag : newTags)
+		m_tags.Insert(hTag);
+	if(m_callbacks.onTagAdded)
 	{
-		if(hTagComponent->IsValid() == false)
-			continue;
-		if(hTagComponent->IsOpeningTag())
+		for(auto &hTag : newTags)
 		{
-			auto offset = hTagComponent->GetStartAnchorPoint()->GetTextCharOffset();
-			auto itInsert = std::find_if(m_tags.begin(),m_tags.end(),[offset](const util::TSharedHandle<TextTag> &tag) {
-				return tag->IsValid() && tag->GetOpeningTagComponent()->GetStartAnchorPoint()->GetTextCharOffset() > offset;
-			});
-			auto tag = util::TSharedHandle<TextTag>{new TextTag{*this,hTagComponent}};
-			m_tags.insert(itInsert,tag);
-			newOpenTags.push_back(tag);
+			if(hTag.IsExpired())
+				continue;
+			m_callbacks.onTagAdded(*hTag);
 		}
-		else
+	}
+}
+std::vector<TagTree::Iterator> FormattedText::FindLineTags(LineIndex lineIdx,uint32_t count) const
+{
+	std::vector<TagTree::Iterator> tags {};
+	count = std::min<uint32_t>(count,m_textLines.size() -std::min<LineIndex>(lineIdx,m_textLines.size()));
+	if(count == 0)
+		return tags;
+	auto hasTagComponents = false;
+	auto *line = m_textLines.at(lineIdx).get();
+	for(auto i=decltype(count){0u};i<count && hasTagComponents == false;++i,line=line->GetNextLine())
+		hasTagComponents = line->GetTagComponents().empty() == false;
+	if(hasTagComponents == false)
+		return tags;
+	return FindTags(m_textLines.at(lineIdx)->GetStartOffset(),m_textLines.at(lineIdx +count -1)->GetAbsEndOffset());
+}
+std::vector<TagTree::Iterator> FormattedText::FindTags(TextOffset startOffset,TextOffset endOffset) const
+{
+	std::vector<TagTree::Iterator> tags {};
+	const auto isInRange = [startOffset,endOffset](const TextTagComponent *tagComponent) -> bool {
+		if(tagComponent == nullptr || tagComponent->IsValid() == false)
+			return false;
+		auto componentStartOffset = tagComponent->GetStartAnchorPoint()->GetTextCharOffset();
+		auto componentEndOffset = tagComponent->GetEndAnchorPoint()->GetTextCharOffset();
+		return (componentStartOffset >= startOffset && componentStartOffset <= endOffset) || (componentEndOffset >= startOffset && componentEndOffset <= endOffset);
+	};
+	for(auto &it : m_tags.Query(startOffset,endOffset))
+	{
+		auto &hTag = *it;
+		if(isInRange(hTag->GetOpeningTagComponent()) || isInRange(hTag->GetClosingTagComponent()))
+			tags.push_back(it);
+	}
+	return tags;
+}
+void FormattedText::UpdateRemovedTags(const std::vector<TagTree::Iterator> &tags)
+{
+	// The remaining tags keep their relative order, so only the paths of the affected tags have to be updated
+	for(auto &it : tags)
+		m_tags.Refresh(it);
+	for(auto &it : tags)
+	{
+		auto &hTag = *it;
+		if(hTag.IsExpired() == false)
 		{
-			auto &tagName = hTagComponent->GetTagName();
-			auto it = std::find_if(newOpenTags.rbegin(),newOpenTags.rend(),[&tagName](const util::TSharedHandle<TextTag> &hTag) {
-				return hTag.IsValid() && hTag->IsClosed() == false && hTag->GetOpeningTagComponent()->GetTagName() == tagName;
-			});
-			if(it != newOpenTags.rend())
-				(*it)->SetClosingTagComponent(hTagComponent);
+			// Tags with a remaining component are re-created once the component is parsed again
+			auto *openingTag = hTag->GetOpeningTagComponent();
+			auto *closingTag = hTag->GetClosingTagComponent();
+			if((openingTag && openingTag->IsValid()) || (closingTag && closingTag->IsValid()))
+				continue;
+			if(m_callbacks.onTagRemoved)
+				m_callbacks.onTagRemoved(*hTag);
 		}
+		auto hTagCpy = hTag;
+		m_tags.Erase(it);
+		hTagCpy.Remove();
 	}
-	if(m_callbacks.onTagAdded)
+}
+std::vector<util::TSharedHandle<TextTag>> FormattedText::PairTagComponents(const std::vector<util::TSharedHandle<TextTagComponent>> &tagComponents)
+{
+	std::vector<util::TSharedHandle<TextTag>> newTags {};
+	std::vector<TextTag*> openTags {}; // New tags which haven't been closed yet
+	for(auto &hTagComponent : tagComponents)
 	{
-		for(auto &hTag : newOpenTags)
+		if(hTagComponent->IsValid() == false)
+			continue;
+		if(hTagComponent->IsOpeningTag())
 		{
-			if(hTag.IsExpired())
-				continue;
-			m_callbacks.onTagAdded(*hTag);
+			newTags.push_back(util::TSharedHandle<TextTag>{new TextTag{*this,hTagComponent}});
+			openTags.push_back(newTags.back().Get());
+			continue;
 		}
+		// Closing tags belong to the most recent open tag with the same name
+		auto &tagName = hTagComponent->GetTagName();
+		auto it = std::find_if(openTags.rbegin(),openTags.rend(),[&tagName](const TextTag *tag) {
+			return tag->GetOpeningTagComponent()->GetTagName() == tagName;
+		});
+		if(it == openTags.rend())
+			continue;
+		(*it)->SetClosingTagComponent(hTagComponent);
+		openTags.erase(std::next(it).base());
 	}
+	return newTags;
 }
@@ -0,0 +1,113 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "util_text_gap_buffer.hpp"
+#include "util_text_piece_table.hpp"
+#include <algorithm>
+#include <cstring>
+
+using namespace util::text;
+
+static constexpr size_t MIN_GAP_SIZE = 64;
+
+GapBuffer::GapBuffer(std::string_view str)
+	: m_gapStart{str.size()},m_gapEnd{str.size() +MIN_GAP_SIZE},m_gapCharOffset{PieceTable::GetCharLength(str)}
+{
+	m_length = m_gapCharOffset;
+	m_buffer.reserve(str.size() +MIN_GAP_SIZE);
+	m_buffer = str;
+	m_buffer.resize(str.size() +MIN_GAP_SIZE);
+}
+TextLength GapBuffer::GetLength() const {return m_length;}
+bool GapBuffer::IsSingleByte() const {return (m_buffer.size() -(m_gapEnd -m_gapStart)) == m_length;}
+std::string_view GapBuffer::GetDataBeforeGap() const {return {m_buffer.data(),m_gapStart};}
+std::string_view GapBuffer::GetDataAfterGap() const {return {m_buffer.data() +m_gapEnd,m_buffer.size() -m_gapEnd};}
+size_t GapBuffer::GetByteOffset(CharOffset charOffset) const
+{
+	if(IsSingleByte())
+		return charOffset;
+	if(charOffset <= m_gapCharOffset)
+		return PieceTable::GetByteOffset(GetDataBeforeGap(),charOffset);
+	return m_gapStart +PieceTable::GetByteOffset(GetDataAfterGap(),charOffset -m_gapCharOffset);
+}
+void GapBuffer::MoveGap(CharOffset charOffset)
+{
+	if(charOffset == m_gapCharOffset)
+		return;
+	auto byteOffset = GetByteOffset(charOffset);
+	if(byteOffset < m_gapStart)
+	{
+		auto n = m_gapStart -byteOffset;
+		memmove(m_buffer.data() +m_gapEnd -n,m_buffer.data() +byteOffset,n);
+		m_gapStart -= n;
+		m_gapEnd -= n;
+	}
+	else
+	{
+		auto n = byteOffset -m_gapStart;
+		memmove(m_buffer.data() +m_gapStart,m_buffer.data() +m_gapEnd,n);
+		m_gapStart += n;
+		m_gapEnd += n;
+	}
+	m_gapCharOffset = charOffset;
+}
+void GapBuffer::GrowGap(size_t minSize)
+{
+	if((m_gapEnd -m_gapStart) >= minSize)
+		return;
+	auto after = GetDataAfterGap();
+	auto newSize = std::max(m_buffer.size() *2,m_buffer.size() +minSize +MIN_GAP_SIZE);
+	std::string buffer {};
+	buffer.resize(newSize);
+	memcpy(buffer.data(),m_buffer.data(),m_gapStart);
+	memcpy(buffer.data() +newSize -after.size(),after.data(),after.size());
+	m_gapEnd = newSize -after.size();
+	m_buffer = std::move(buffer);
+}
+bool GapBuffer::Insert(CharOffset charOffset,std::string_view str)
+{
+	if(charOffset > m_length)
+		return false;
+	if(str.empty())
+		return true;
+	MoveGap(charOffset);
+	GrowGap(str.size());
+	memcpy(m_buffer.data() +m_gapStart,str.data(),str.size());
+	m_gapStart += str.size();
+	auto len = PieceTable::GetCharLength(str);
+	m_gapCharOffset += len;
+	m_length += len;
+	return true;
+}
+TextLength GapBuffer::Erase(CharOffset startOffset,TextLength len,std::string *outErasedString)
+{
+	if(outErasedString)
+		outErasedString->clear();
+	if(startOffset >= m_length || len == 0)
+		return 0;
+	len = std::min<TextLength>(len,m_length -startOffset);
+	MoveGap(startOffset);
+	auto after = GetDataAfterGap();
+	auto numBytes = IsSingleByte() ? len : PieceTable::GetByteOffset(after,static_cast<CharOffset>(len));
+	if(outErasedString)
+		outErasedString->assign(after.substr(0,numBytes));
+	m_gapEnd += numBytes;
+	m_length -= len;
+	return len;
+}
+std::optional<int32_t> GapBuffer::At(CharOffset offset) const
+{
+	if(offset >= m_length || IsSingleByte() == false)
+		return {};
+	auto idx = (offset < m_gapStart) ? offset : (offset +(m_gapEnd -m_gapStart));
+	return static_cast<uint8_t>(m_buffer[idx]);
+}
+std::string GapBuffer::ToString() const
+{
+	std::string str {};
+	str.reserve(m_buffer.size() -(m_gapEnd -m_gapStart));
+	str += GetDataBeforeGap();
+	str += GetDataAfterGap();
+	return str;
+}
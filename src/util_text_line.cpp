@@ -4,46 +4,195 @@
 
 #include "util_text_line.hpp"
 #include <algorithm>
+#include <utility>
 
 using namespace util::text;
 
-TextLine::TextLine(const std::string &line)
-	: m_line{line}
+TextLine::TextLine(std::string line)
+	: m_line{std::move(line)}
 {}
+TextLine::TextLine(const std::shared_ptr<const void> &source,std::string_view data)
+	: m_viewSize{static_cast<uint32_t>(data.size())},m_viewLength{static_cast<CharOffset>(util::Utf8StringView{data}.length())}
+{
+	// Empty lines have nothing to share
+	if(data.empty() == false)
+		m_view = std::shared_ptr<const char>{source,data.data()};
+}
+
+bool TextLine::IsView() const {return m_view != nullptr;}
+bool TextLine::IsPieceTable() const {return m_pieceTable != nullptr;}
+bool TextLine::IsGapBuffer() const {return m_gapBuffer != nullptr;}
+void TextLine::UpdateGapBuffer(CharOffset startOffset,TextLength len)
+{
+	if(m_gapBuffer || m_lastEditOffset == LAST_CHAR || startOffset +len >= GetLength())
+		return;
+	if(startOffset != m_lastEditOffset && startOffset +len != m_lastEditOffset)
+		return;
+	m_gapBuffer = std::make_unique<GapBuffer>(GetData());
+	m_view = nullptr;
+	m_line.clear();
+}
+void TextLine::EnablePieceTable()
+{
+	if(m_pieceTable)
+		return;
+	if(IsView())
+	{
+		// The referenced characters can be used as original buffer as they are
+		m_pieceTable = std::make_unique<PieceTable>(m_view,GetData());
+		m_view = nullptr;
+		return;
+	}
+	auto original = std::make_shared<std::string>(GetData());
+	m_pieceTable = std::make_unique<PieceTable>(original,*original);
+	m_pieceTableAssembled = true;
+}
+void TextLine::Materialize() const
+{
+	if(m_pieceTable)
+	{
+		if(m_pieceTableAssembled)
+			return;
+		m_line = util::Utf8String{m_pieceTable->ToString()};
+		m_pieceTableAssembled = true;
+		return;
+	}
+	// Reading the line ends the sequence of edits, otherwise every read would be followed by another copy into a gap buffer
+	m_lastEditOffset = LAST_CHAR;
+	if(m_gapBuffer)
+	{
+		m_line = util::Utf8String{m_gapBuffer->ToString()};
+		m_gapBuffer = nullptr;
+		return;
+	}
+	if(m_view == nullptr)
+		return;
+	m_line = util::Utf8StringView{GetData()}.to_str();
+	m_view = nullptr;
+}
+std::string_view TextLine::GetData() const
+{
+	if(IsView())
+		return {m_view.get(),m_viewSize};
+	Materialize();
+	return {m_line.data(),m_line.size()};
+}
+std::vector<std::string_view> TextLine::GetSegments(CharOffset offset,TextLength len) const
+{
+	if(m_pieceTable)
+		return m_pieceTable->GetSegments(offset,len);
+	if(offset >= GetLength() || len == 0)
+		return {};
+	auto data = GetData();
+	data = data.substr(PieceTable::GetByteOffset(data,offset));
+	if(len != UNTIL_THE_END)
+		data = data.substr(0,PieceTable::GetByteOffset(data,static_cast<CharOffset>(std::min<TextLength>(len,GetLength() -offset))));
+	return {data};
+}
 
-void TextLine::AppendCharacter(int32_t c) {m_line += c;}
+void TextLine::AppendCharacter(int32_t c)
+{
+	if(m_pieceTable)
+	{
+		util::Utf8String str {};
+		str += c;
+		m_pieceTable->Insert(static_cast<CharOffset>(m_pieceTable->GetLength()),{str.data(),str.size()});
+		m_pieceTableAssembled = false;
+		return;
+	}
+	if(m_gapBuffer)
+	{
+		util::Utf8String str {};
+		str += c;
+		m_gapBuffer->Insert(static_cast<CharOffset>(m_gapBuffer->GetLength()),{str.data(),str.size()});
+		return;
+	}
+	Materialize();
+	m_line += c;
+}
 bool TextLine::InsertString(const util::Utf8StringView &str,CharOffset charOffset)
 {
+	if(m_pieceTable)
+	{
+		if(charOffset == LAST_CHAR)
+			charOffset = static_cast<CharOffset>(m_pieceTable->GetLength());
+		auto bytes = str.to_str();
+		if(m_pieceTable->Insert(charOffset,{bytes.data(),bytes.size()}) == false)
+			return false;
+		m_pieceTableAssembled = false;
+		return true;
+	}
 	if(charOffset == LAST_CHAR)
-		charOffset = m_line.length();
-	if(charOffset > m_line.length())
+		charOffset = static_cast<CharOffset>(GetLength());
+	if(charOffset > GetLength())
 		return false;
-	m_line.insert(m_line.begin() +charOffset,str.to_str());
+	UpdateGapBuffer(charOffset,0);
+	if(m_gapBuffer)
+		m_gapBuffer->Insert(charOffset,{str.data(),str.size()});
+	else
+	{
+		Materialize();
+		m_line.insert(m_line.begin() +charOffset,str.to_str());
+	}
+	m_lastEditOffset = static_cast<CharOffset>(charOffset +str.length());
 	return true;
 }
 
-TextLength TextLine::GetLength() const {return m_line.length();}
+TextLength TextLine::GetLength() const
+{
+	if(m_pieceTable)
+		return m_pieceTable->GetLength();
+	if(m_gapBuffer)
+		return m_gapBuffer->GetLength();
+	return IsView() ? m_viewLength : m_line.length();
+}
 TextLength TextLine::GetAbsLength() const {return GetLength() +1;}
-const util::Utf8String &TextLine::GetText() const {return m_line;}
-int32_t TextLine::At(CharOffset offset) const {return m_line.at(offset);}
+const util::Utf8String &TextLine::GetText() const
+{
+	Materialize();
+	return m_line;
+}
+int32_t TextLine::At(CharOffset offset) const
+{
+	if(IsView())
+		return util::Utf8StringView{GetData()}.get(offset);
+	if(m_gapBuffer)
+	{
+		auto c = m_gapBuffer->At(offset);
+		if(c.has_value())
+			return *c;
+	}
+	Materialize();
+	return m_line.at(offset);
+}
 std::optional<int32_t> TextLine::GetChar(CharOffset offset) const
 {
-	if(offset >= m_line.length())
+	if(offset >= GetLength())
 		return {};
-	return m_line.at(offset);
+	return At(offset);
 }
 
-void TextLine::Clear() {m_line.clear();}
+void TextLine::Clear()
+{
+	m_gapBuffer = nullptr;
+	m_lastEditOffset = LAST_CHAR;
+	m_pieceTable = nullptr;
+	m_view = nullptr;
+	m_line.clear();
+}
 void TextLine::Reserve(TextLength len) {/*m_line.reserve(len);*/}
 util::Utf8StringView TextLine::Substr(CharOffset offset,TextLength len) const
 {
-	if(offset >= m_line.length())
+	if(offset >= GetLength())
 		return {};
+	if(IsView())
+		return util::Utf8StringView{GetData()}.substr(offset,len);
+	Materialize();
 	return util::Utf8StringView{m_line}.substr(offset,len);
 }
 bool TextLine::CanErase(CharOffset startOffset,TextLength len) const
 {
-	return startOffset < m_line.size() && len > 0;
+	return startOffset < GetLength() && len > 0;
 }
 std::optional<TextLength> TextLine::Erase(CharOffset startOffset,TextLength len,util::Utf8String *outErasedString)
 {
@@ -51,6 +200,28 @@ std::optional<TextLength> TextLine::Erase(CharOffset startOffset,TextLength len,
 		*outErasedString = "";
 	if(CanErase(startOffset,len) == false)
 		return {};
+	if(m_pieceTable)
+	{
+		std::string erasedString;
+		auto numErased = m_pieceTable->Erase(startOffset,len,outErasedString ? &erasedString : nullptr);
+		if(outErasedString)
+			*outErasedString = util::Utf8String{erasedString};
+		m_pieceTableAssembled = false;
+		return numErased;
+	}
+	len = std::min<TextLength>(len,GetLength() -startOffset);
+	UpdateGapBuffer(startOffset,len);
+	if(m_gapBuffer)
+	{
+		std::string erasedString;
+		auto numErased = m_gapBuffer->Erase(startOffset,len,outErasedString ? &erasedString : nullptr);
+		if(outErasedString)
+			*outErasedString = util::Utf8String{erasedString};
+		m_lastEditOffset = startOffset;
+		return numErased;
+	}
+	Materialize();
+	m_lastEditOffset = startOffset;
 	if(m_line.empty())
 		return 0;
 	auto endOffset = (len < UNTIL_THE_END) ? std::min(startOffset +len -1,m_line.size() -1) : (m_line.size() -1);
@@ -60,17 +231,41 @@ std::optional<TextLength> TextLine::Erase(CharOffset startOffset,TextLength len,
 	return endOffset -startOffset +1;
 }
 
-TextLine &TextLine::operator=(const util::Utf8String &line) {m_line = line; return *this;}
-bool TextLine::operator==(const util::Utf8StringView &line) {return m_line == line;}
-bool TextLine::operator!=(const util::Utf8StringView &line) {return m_line != line;}
-TextLine::operator const util::Utf8String&() const {return m_line;}
-TextLine::operator const char*() const {return m_line.c_str();}
+bool TextLine::Move(CharOffset startOffset,TextLength len,CharOffset targetOffset)
+{
+	if(CanErase(startOffset,len) == false)
+		return false;
+	len = std::min<TextLength>(len,GetLength() -startOffset);
+	if(targetOffset > GetLength() -len)
+		return false;
+	if(m_pieceTable)
+	{
+		m_pieceTableAssembled = false;
+		return m_pieceTable->Move(startOffset,len,targetOffset);
+	}
+	util::Utf8String movedString;
+	Erase(startOffset,len,&movedString);
+	return InsertString(movedString,targetOffset);
+}
+
+TextLine &TextLine::operator=(const util::Utf8String &line)
+{
+	m_gapBuffer = nullptr;
+	m_lastEditOffset = LAST_CHAR;
+	m_pieceTable = nullptr;
+	m_view = nullptr;
+	m_line = line;
+	return *this;
+}
+bool TextLine::operator==(const util::Utf8StringView &line) {return Substr(0) == line;}
+bool TextLine::operator!=(const util::Utf8StringView &line) {return !operator==(line);}
+TextLine::operator const util::Utf8String&() const {return GetText();}
+TextLine::operator const char*() const {return GetText().c_str();}
 
 #ifdef ENABLE_FORMATTED_TEXT_UNIT_TESTS
 bool TextLine::Validate(std::stringstream &msg) const
 {
-	auto it = std::find(m_line.begin(),m_line.end(),'\n');
-	if(it != m_line.end())
+	if(GetData().find('\n') != std::string_view::npos)
 	{
 		msg<<"New-line character found within line! This is not allowed, new-line characters should split the line into multiple lines.";
 		return false;
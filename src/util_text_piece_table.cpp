@@ -0,0 +1,179 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "util_text_piece_table.hpp"
+#include <algorithm>
+
+using namespace util::text;
+
+// Every edit has to walk the piece list, so it is compacted into a single piece once it has grown beyond this size
+static constexpr size_t MAX_PIECE_COUNT = 1'024;
+static constexpr size_t MIN_COMPACT_SIZE = 4'096;
+
+static bool is_utf8_continuation_byte(char c) {return (static_cast<uint8_t>(c) &0xC0) == 0x80;}
+size_t PieceTable::GetByteOffset(std::string_view str,CharOffset charOffset)
+{
+	for(size_t i=0;i<str.size();++i)
+	{
+		if(is_utf8_continuation_byte(str[i]))
+			continue;
+		if(charOffset == 0)
+			return i;
+		--charOffset;
+	}
+	return str.size();
+}
+CharOffset PieceTable::GetCharLength(std::string_view str)
+{
+	return static_cast<CharOffset>(std::count_if(str.begin(),str.end(),[](char c) {return is_utf8_continuation_byte(c) == false;}));
+}
+
+PieceTable::PieceTable(const std::shared_ptr<const void> &source,std::string_view original)
+	: m_original{source,original.data()},m_originalSize{original.size()},m_length{GetCharLength(original)},m_byteSize{original.size()}
+{
+	if(original.empty() == false)
+		m_pieces.push_back({0u,static_cast<uint32_t>(original.size()),static_cast<CharOffset>(m_length),false});
+}
+TextLength PieceTable::GetLength() const {return m_length;}
+size_t PieceTable::GetPieceCount() const {return m_pieces.size();}
+std::string_view PieceTable::GetData(const Piece &piece) const
+{
+	if(piece.added)
+		return std::string_view{m_added}.substr(piece.byteOffset,piece.byteSize);
+	return {m_original.get() +piece.byteOffset,piece.byteSize};
+}
+size_t PieceTable::Split(CharOffset charOffset)
+{
+	CharOffset pieceStart = 0;
+	for(auto i=decltype(m_pieces.size()){0u};i<m_pieces.size();++i)
+	{
+		if(charOffset == pieceStart)
+			return i;
+		auto &piece = m_pieces[i];
+		if(charOffset < pieceStart +piece.length)
+		{
+			auto relOffset = charOffset -pieceStart;
+			// Byte and character offsets are identical for pieces without multi-byte characters
+			auto byteOffset = static_cast<uint32_t>((piece.length == piece.byteSize) ? relOffset : GetByteOffset(GetData(piece),relOffset));
+			Piece tail {piece.byteOffset +byteOffset,piece.byteSize -byteOffset,piece.length -relOffset,piece.added};
+			piece.byteSize = byteOffset;
+			piece.length = relOffset;
+			m_pieces.insert(m_pieces.begin() +i +1,tail);
+			return i +1;
+		}
+		pieceStart += piece.length;
+	}
+	return m_pieces.size();
+}
+void PieceTable::Compact()
+{
+	if(m_pieces.size() <= MAX_PIECE_COUNT && (m_originalSize +m_added.size()) <= m_byteSize *2 +MIN_COMPACT_SIZE)
+		return;
+	auto str = std::make_shared<std::string>(ToString());
+	m_original = std::shared_ptr<const char>{str,str->data()};
+	m_originalSize = str->size();
+	m_added = {};
+	m_pieces.clear();
+	if(str->empty() == false)
+		m_pieces.push_back({0u,static_cast<uint32_t>(str->size()),static_cast<CharOffset>(m_length),false});
+}
+bool PieceTable::Insert(CharOffset charOffset,std::string_view str)
+{
+	if(charOffset > m_length)
+		return false;
+	if(str.empty())
+		return true;
+	auto idx = Split(charOffset);
+	auto len = GetCharLength(str);
+	auto *prev = (idx > 0) ? &m_pieces[idx -1] : nullptr;
+	// Consecutive insertions (e.g. typing) extend the same piece
+	if(prev && prev->added && prev->byteOffset +prev->byteSize == m_added.size())
+	{
+		prev->byteSize += static_cast<uint32_t>(str.size());
+		prev->length += len;
+	}
+	else
+		m_pieces.insert(m_pieces.begin() +idx,Piece{static_cast<uint32_t>(m_added.size()),static_cast<uint32_t>(str.size()),len,true});
+	m_added += str;
+	m_length += len;
+	m_byteSize += str.size();
+	Compact();
+	return true;
+}
+TextLength PieceTable::Erase(CharOffset startOffset,TextLength len,std::string *outErasedString)
+{
+	if(outErasedString)
+		outErasedString->clear();
+	if(startOffset >= m_length || len == 0)
+		return 0;
+	len = std::min<TextLength>(len,m_length -startOffset);
+	auto first = Split(startOffset);
+	auto last = Split(static_cast<CharOffset>(startOffset +len));
+	for(auto i=first;i<last;++i)
+	{
+		auto data = GetData(m_pieces[i]);
+		if(outErasedString)
+			*outErasedString += data;
+		m_byteSize -= data.size();
+	}
+	m_pieces.erase(m_pieces.begin() +first,m_pieces.begin() +last);
+	m_length -= len;
+	Compact();
+	return len;
+}
+bool PieceTable::Move(CharOffset startOffset,TextLength len,CharOffset targetOffset)
+{
+	if(startOffset >= m_length || len == 0)
+		return false;
+	len = std::min<TextLength>(len,m_length -startOffset);
+	if(targetOffset > m_length -len)
+		return false;
+	auto first = Split(startOffset);
+	auto last = Split(static_cast<CharOffset>(startOffset +len));
+	std::vector<Piece> movedPieces {m_pieces.begin() +first,m_pieces.begin() +last};
+	m_pieces.erase(m_pieces.begin() +first,m_pieces.begin() +last);
+	m_length -= len;
+	auto idx = Split(targetOffset);
+	m_pieces.insert(m_pieces.begin() +idx,movedPieces.begin(),movedPieces.end());
+	m_length += len;
+	Compact();
+	return true;
+}
+std::vector<std::string_view> PieceTable::GetSegments(CharOffset offset,TextLength len) const
+{
+	std::vector<std::string_view> segments {};
+	if(offset >= m_length)
+		return segments;
+	auto endOffset = (len >= m_length -offset) ? m_length : (offset +len);
+	TextOffset pieceStart = 0;
+	for(auto &piece : m_pieces)
+	{
+		auto pieceEnd = pieceStart +piece.length;
+		if(pieceEnd > offset)
+		{
+			if(pieceStart >= endOffset)
+				break;
+			auto relStart = static_cast<CharOffset>(std::max<TextOffset>(offset,pieceStart) -pieceStart);
+			auto relEnd = static_cast<CharOffset>(std::min<TextOffset>(endOffset,pieceEnd) -pieceStart);
+			auto data = GetData(piece);
+			if(piece.length == piece.byteSize)
+				segments.push_back(data.substr(relStart,relEnd -relStart));
+			else
+			{
+				auto byteStart = GetByteOffset(data,relStart);
+				segments.push_back(data.substr(byteStart,GetByteOffset(data,relEnd) -byteStart));
+			}
+		}
+		pieceStart = pieceEnd;
+	}
+	return segments;
+}
+std::string PieceTable::ToString() const
+{
+	std::string str {};
+	str.reserve(m_byteSize);
+	for(auto &piece : m_pieces)
+		str += GetData(piece);
+	return str;
+}